@@ -0,0 +1,644 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * libIris - A simple and scalable networking library for Linux.
+ *
+ * Copyright (C) 2014 Giorgos Kappes <geokapp@gmail.com>
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file LICENSE.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <netdb.h>
+#include <unistd.h>
+#include <errno.h>
+#include "coroutine.h"
+
+using namespace iris;
+
+/**
+ * @name make_nonblocking - Switch an endpoint to non-blocking mode.
+ * @param endpoint: A client or a started server endpoint.
+ *
+ * This function makes sure that the sockets of an endpoint do not block.
+ *
+ * @return 0: success, 1: error.
+ */
+static int32_t make_nonblocking(Endpoint *endpoint) {
+  if (endpoint->nonblocking())
+    return 0;
+  if (endpoint->type() == Endpoint::ServerEndpoint)
+    return ((Server *)endpoint)->set_nonblocking(true);
+  return ((Client *)endpoint)->set_nonblocking(true);
+}
+
+/**
+ * @name readiness::await_suspend - Suspend a coroutine.
+ * @param h: The coroutine that awaits.
+ *
+ * This function registers the coroutine as the waiter of its descriptors.
+ *
+ * @return True if the coroutine is suspended, false on error.
+ */
+bool AsyncLoop::readiness::await_suspend(std::coroutine_handle<> h) {
+  w.handle = h;
+  if (!w.fds)
+    w.fds = &fd;
+  if (loop->suspend(&w)) {
+    w.ready_fd = -1;
+    return false;
+  }
+  return true;
+}
+
+/**
+ * @name AsyncLoop - Constructor.
+ *
+ * Initializes a coroutine loop. The loop must be opened before it can run.
+ */
+AsyncLoop::AsyncLoop() {
+  m_epfd = UNUSED;
+  m_slots = NULL;
+  m_slots_len = 0;
+  m_ready = NULL;
+  m_ready_len = 0;
+  m_ready_size = 0;
+  m_tasks = 0;
+  m_running = 0;
+  m_events = NULL;
+}
+
+/**
+ * @name AsyncLoop - Destructor.
+ *
+ * Destroys a coroutine loop.
+ */
+AsyncLoop::~AsyncLoop() {
+  close();
+}
+
+/**
+ * @name open - Open the loop.
+ *
+ * This function creates the epoll set of the loop.
+ *
+ * @return 0: success, 1: error.
+ */
+int32_t AsyncLoop::open() {
+  if (m_epfd != UNUSED)
+    return 0;
+  m_events = (struct epoll_event *)malloc(MAX_EPOLL_EVENTS_PER_RUN * sizeof(struct epoll_event));
+  if (!m_events) {
+    fprintf(stderr, "(open) Error: No free memory left.\n");
+    return 1;
+  }
+  m_epfd = epoll_create(EPOLL_QUEUE_LEN);
+  if (m_epfd < 0) {
+    m_epfd = UNUSED;
+    fprintf(stderr, "(open) Error: epoll_create failed.\n");
+    return 1;
+  }
+  return 0;
+}
+
+/**
+ * @name close - Close the loop.
+ *
+ * This function destroys the epoll set of the loop. The coroutines that still
+ * wait are not resumed.
+ *
+ * @return 0 on success, 1 on error.
+ */
+int32_t AsyncLoop::close() {
+  int32_t result = 0;
+
+  if (m_epfd != UNUSED && ::close(m_epfd) < 0)
+    result = 1;
+  m_epfd = UNUSED;
+  if (m_slots)
+    free(m_slots);
+  m_slots = NULL;
+  m_slots_len = 0;
+  if (m_ready)
+    free(m_ready);
+  m_ready = NULL;
+  m_ready_len = m_ready_size = 0;
+  if (m_events)
+    free(m_events);
+  m_events = NULL;
+  return result;
+}
+
+/**
+ * @name spawn - Start a task.
+ * @param task: The task.
+ *
+ * This function hands a task to the loop, which starts it on the next run
+ * and destroys it when it returns. The returned value is ignored.
+ *
+ * @return Void.
+ */
+void AsyncLoop::spawn(Task<int32_t> task) {
+  Task<int32_t>::handle_type h = task.release();
+
+  if (!h)
+    return;
+  h.promise().loop = this;
+  m_tasks++;
+  schedule(h);
+}
+
+/**
+ * @name task_done - Count a finished task.
+ *
+ * This function is called when a spawned task returns.
+ *
+ * @return Void.
+ */
+void AsyncLoop::task_done() {
+  m_tasks--;
+}
+
+/**
+ * @name schedule - Make a coroutine ready.
+ * @param h: The coroutine.
+ *
+ * This function queues a coroutine to be resumed by the loop.
+ *
+ * @return 0: success, 1: error.
+ */
+int32_t AsyncLoop::schedule(std::coroutine_handle<> h) {
+  void **ready;
+  int32_t size;
+
+  if (m_ready_len == m_ready_size) {
+    size = m_ready_size ? m_ready_size * 2 : 64;
+    ready = (void **)realloc(m_ready, size * sizeof(void *));
+    if (!ready) {
+      fprintf(stderr, "(schedule) Error: No free memory left.\n");
+      return 1;
+    }
+    m_ready = ready;
+    m_ready_size = size;
+  }
+  m_ready[m_ready_len++] = h.address();
+  return 0;
+}
+
+/**
+ * @name run - Run the loop.
+ *
+ * This function resumes the ready coroutines and waits for their sockets,
+ * until every spawned task has returned or stop is called.
+ *
+ * @return 0 on success, 1 on error.
+ */
+int32_t AsyncLoop::run() {
+  int32_t i, nfds;
+
+  if (m_epfd == UNUSED)
+    return 1;
+
+  m_running = 1;
+  while (m_running) {
+    // Coroutines resumed here may make more coroutines ready.
+    for (i = 0; i < m_ready_len; i++)
+      std::coroutine_handle<>::from_address(m_ready[i]).resume();
+    m_ready_len = 0;
+
+    if (!m_running || !m_tasks)
+      break;
+
+    nfds = epoll_wait(m_epfd, m_events, MAX_EPOLL_EVENTS_PER_RUN, EPOLL_RUN_TIMEOUT);
+    if (nfds < 0) {
+      if (errno == EINTR)
+	continue;
+      m_running = 0;
+      return 1;
+    }
+    for (i = 0; i < nfds; i++)
+      wake(m_events[i].data.fd, m_events[i].events);
+  }
+  m_running = 0;
+  return 0;
+}
+
+/**
+ * @name stop - Stop the loop.
+ *
+ * This function makes run return after the ready coroutines have run. It
+ * must be called from a coroutine of the loop.
+ *
+ * @return Void.
+ */
+void AsyncLoop::stop() {
+  m_running = 0;
+}
+
+/**
+ * @name wait - Wait for a descriptor.
+ * @param fd: The descriptor.
+ * @param events: EPOLLIN or EPOLLOUT.
+ *
+ * This function returns an awaitable that resumes the coroutine when the
+ * descriptor is ready.
+ *
+ * @return The awaitable, which yields the descriptor or -1 on error.
+ */
+AsyncLoop::readiness AsyncLoop::wait(int32_t fd, uint32_t events) {
+  readiness r;
+
+  r.loop = this;
+  r.fd = fd;
+  r.w.fds = NULL;
+  r.w.fds_len = 1;
+  r.w.ready_fd = -1;
+  r.w.events = events;
+  return r;
+}
+
+/**
+ * @name wait_any - Wait for one of several descriptors.
+ * @param fds: The descriptors. The table must outlive the wait.
+ * @param fds_len: The number of descriptors.
+ * @param events: EPOLLIN or EPOLLOUT.
+ *
+ * This function returns an awaitable that resumes the coroutine when one of
+ * the descriptors is ready.
+ *
+ * @return The awaitable, which yields the ready descriptor or -1 on error.
+ */
+AsyncLoop::readiness AsyncLoop::wait_any(const int32_t *fds, int32_t fds_len, uint32_t events) {
+  readiness r;
+
+  r.loop = this;
+  r.fd = UNUSED;
+  r.w.fds = fds;
+  r.w.fds_len = fds_len;
+  r.w.ready_fd = -1;
+  r.w.events = events;
+  return r;
+}
+
+/**
+ * @name attach - Connect to a server host.
+ * @param client: The client endpoint.
+ * @param host: The hostname or ip address of the server host.
+ * @param service: the port number of the service.
+ *
+ * This coroutine is the asynchronous version of Client::attach. The client's
+ * socket is non-blocking. RUDP clients are rejected.
+ *
+ * @return 0: success, 1: error.
+ */
+Task<int32_t> AsyncLoop::attach(Client *client, const char *host, const char *service) {
+  struct addrinfo hints, *info, *res;
+  int32_t sock, error;
+  socklen_t error_len;
+
+  // Check the arguments.
+  if (!client || !host || !service) {
+    fprintf(stderr, "(attach) Error: client, host and service should not be NULL.\n");
+    co_return 1;
+  }
+  if (client->protocol() == Endpoint::RUDP) {
+    fprintf(stderr, "(attach) Error: RUDP is not supported.\n");
+    errno = EPROTONOSUPPORT;
+    co_return 1;
+  }
+
+  // Specify the hints for the getaddrinfo().
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = PF_UNSPEC;       // For both ipv4 and ipv6 protocols.
+  if (client->protocol() == Endpoint::TCP)
+    hints.ai_socktype = SOCK_STREAM;
+  else
+    hints.ai_socktype = SOCK_DGRAM;
+  if (getaddrinfo(host, service, &hints, &info) != 0) {
+    fprintf(stderr, "(attach) Error: getaddrinfo failed.\n");
+    co_return 1;
+  }
+
+  for (res = info; res; res = res->ai_next) {
+    sock = socket(res->ai_family, res->ai_socktype | SOCK_NONBLOCK, res->ai_protocol);
+    if (sock < 0)
+      continue;
+
+    // Wait for the TCP handshake instead of blocking in connect.
+    if (client->protocol() == Endpoint::TCP &&
+	connect(sock, res->ai_addr, res->ai_addrlen) < 0) {
+      if (errno != EINPROGRESS || (co_await wait(sock, EPOLLOUT)) < 0) {
+	::close(sock);
+	continue;
+      }
+      error = 0;
+      error_len = sizeof(error);
+      if (getsockopt(sock, SOL_SOCKET, SO_ERROR, &error, &error_len) < 0 || error) {
+	::close(sock);
+	continue;
+      }
+    }
+    client->set_socket(sock, true);
+    if (client->set_peer_address(res->ai_addr, res->ai_addrlen)) {
+      ::close(sock);
+      client->set_socket(UNUSED, false);
+      break;
+    }
+    freeaddrinfo(info);
+    co_return 0;
+  }
+  freeaddrinfo(info);
+  fprintf(stderr, "(attach) error: Can not connect  to '%s' for the service '%s'\n",
+	  host, service);
+  co_return 1;
+}
+
+/**
+ * @name send_data - Send data.
+ * @param endpoint: The endpoint where the data will be sent.
+ * @param data: Pointer to the data buffer.
+ * @param data_len: Size of the data buffer.
+ *
+ * This coroutine is the asynchronous version of Endpoint::send_data. It
+ * suspends while the socket buffer is full. RUDP endpoints fail with
+ * EPROTONOSUPPORT.
+ *
+ * @return Total number of bytes sent or -1 on error.
+ */
+Task<int32_t> AsyncLoop::send_data(Endpoint *endpoint, const void *data,
+				   const size_t data_len) {
+  size_t total = 0, chunk;
+  int32_t sock, bytes;
+
+  if (!endpoint || !endpoint->sockets())
+    co_return -1;
+  if (endpoint->protocol() == Endpoint::RUDP) {
+    errno = EPROTONOSUPPORT;
+    co_return -1;
+  }
+  if (make_nonblocking(endpoint))
+    co_return -1;
+  sock = endpoint->sockets()[0];
+
+  while (total < data_len || (!data_len && endpoint->protocol() == Endpoint::UDP)) {
+    if (endpoint->protocol() == Endpoint::TCP) {
+      bytes = send(sock, (const char *)data + total, data_len - total, 0);
+    } else {
+      // UDP data are split into packets.
+      chunk = data_len - total;
+      if (chunk > endpoint->packet_size())
+	chunk = endpoint->packet_size();
+      bytes = sendto(sock, (const char *)data + total, chunk, 0,
+		     endpoint->address_info()->ai_addr,
+		     endpoint->address_info()->ai_addrlen);
+    }
+    if (bytes < 0) {
+      if ((errno == EAGAIN || errno == EWOULDBLOCK) &&
+	  (co_await wait(sock, EPOLLOUT)) >= 0)
+	continue;
+      co_return -1;
+    }
+    total += bytes;
+    if (!data_len)
+      break;
+  }
+  co_return total;
+}
+
+/**
+ * @name receive_data - Receive data.
+ * @param endpoint: The endpoint from which the data will be received.
+ * @param data: Pointer to the data buffer.
+ * @param data_len: Size of the data buffer.
+ *
+ * This coroutine is the asynchronous version of Endpoint::receive_data. It
+ * suspends until data are available and returns what one recv, or for UDP
+ * one recvfrom, returns. RUDP endpoints fail with EPROTONOSUPPORT.
+ *
+ * @return Total number of bytes received, 0 on end of stream or -1 on error.
+ */
+Task<int32_t> AsyncLoop::receive_data(Endpoint *endpoint, void *data, size_t data_len) {
+  int32_t sock, bytes;
+
+  if (!endpoint || !endpoint->sockets())
+    co_return -1;
+  if (endpoint->protocol() == Endpoint::RUDP) {
+    errno = EPROTONOSUPPORT;
+    co_return -1;
+  }
+  if (make_nonblocking(endpoint))
+    co_return -1;
+  sock = endpoint->sockets()[0];
+
+  while (1) {
+    if (endpoint->protocol() == Endpoint::TCP)
+      bytes = recv(sock, data, data_len, 0);
+    else
+      bytes = recvfrom(sock, data, data_len, 0, NULL, NULL);
+    if (bytes >= 0)
+      co_return bytes;
+    if ((errno != EAGAIN && errno != EWOULDBLOCK) ||
+	(co_await wait(sock, EPOLLIN)) < 0)
+      co_return -1;
+  }
+}
+
+/**
+ * @name get_client - Wait for the next client.
+ * @param server: A started server endpoint.
+ * @param client: A pointer to a valid client object.
+ *
+ * This coroutine is the asynchronous version of Server::get_client. For TCP
+ * it returns as soon as a connection is accepted, without waiting for its
+ * data; the client's socket is non-blocking. For UDP it returns when a
+ * datagram arrives, like Server::get_client. RUDP servers are rejected.
+ *
+ * @return 0: success, 1: error.
+ */
+Task<int32_t> AsyncLoop::get_client(Server *server, Client *client) {
+  struct sockaddr_storage client_addr;
+  socklen_t client_sin_size;
+  int32_t i, sock;
+  char data;
+
+  if (server && server->protocol() == Endpoint::RUDP) {
+    fprintf(stderr, "(get_client) Error: RUDP is not supported.\n");
+    errno = EPROTONOSUPPORT;
+    co_return 1;
+  }
+
+  // Check the arguments. Client must point to a valid client object.
+  if (!server || !client || !server->sockets() || make_nonblocking(server)) {
+    fprintf(stderr, "(get_client) Error: Invalid server or client.\n");
+    co_return 1;
+  }
+  client->set_protocol(server->protocol());
+
+  while (1) {
+    for (i = 0; i < server->sockets_len(); i++) {
+      client_sin_size = sizeof(client_addr);
+      if (server->protocol() == Endpoint::TCP) {
+	sock = accept4(server->sockets()[i], (struct sockaddr *)&client_addr,
+		       &client_sin_size, SOCK_NONBLOCK);
+	if (sock < 0)
+	  continue;
+	client->set_socket(sock, true);
+      } else {
+	if (recvfrom(server->sockets()[i], &data, sizeof(data), MSG_PEEK,
+		     (struct sockaddr *)&client_addr, &client_sin_size) < 0)
+	  continue;
+	client->set_socket(server->sockets()[i], true);
+      }
+      if (client->set_peer_address((struct sockaddr *)&client_addr, client_sin_size))
+	co_return 1;
+      co_return 0;
+    }
+
+    // Nothing is pending on any server socket.
+    if ((co_await wait_any(server->sockets(), server->sockets_len(), EPOLLIN)) < 0)
+      co_return 1;
+  }
+}
+
+/**
+ * @name suspend - Register a waiter.
+ * @param w: The waiter.
+ *
+ * This function makes the waiter the reader, or the writer, of each of its
+ * descriptors and arms the descriptors in the epoll set. On error the waiter
+ * is taken back from the descriptors that it was registered on.
+ *
+ * @return 0: success, 1: error.
+ */
+int32_t AsyncLoop::suspend(struct waiter *w) {
+  struct slot *slots;
+  int32_t i, fd, len;
+
+  if (m_epfd == UNUSED)
+    return 1;
+  for (i = 0; i < w->fds_len; i++) {
+    fd = w->fds[i];
+    if (fd < 0)
+      break;
+
+    // Grow the table so that it can be indexed by fd.
+    if (fd >= m_slots_len) {
+      len = m_slots_len ? m_slots_len : 64;
+      while (len <= fd)
+	len *= 2;
+      slots = (struct slot *)realloc(m_slots, len * sizeof(struct slot));
+      if (!slots) {
+	fprintf(stderr, "(suspend) Error: No free memory left.\n");
+	break;
+      }
+      memset(slots + m_slots_len, 0, (len - m_slots_len) * sizeof(struct slot));
+      m_slots = slots;
+      m_slots_len = len;
+    }
+
+    // Only one coroutine may wait for each direction of a descriptor.
+    if (w->events & EPOLLIN) {
+      if (m_slots[fd].reader && m_slots[fd].reader != w)
+	break;
+      m_slots[fd].reader = w;
+    } else {
+      if (m_slots[fd].writer && m_slots[fd].writer != w)
+	break;
+      m_slots[fd].writer = w;
+    }
+    if (arm(fd))
+      break;
+  }
+  if (i == w->fds_len)
+    return 0;
+
+  // The waiter is not suspended; leave no pointer to it behind.
+  for (; i >= 0; i--) {
+    fd = w->fds[i];
+    if (fd < 0 || fd >= m_slots_len)
+      continue;
+    if (m_slots[fd].reader == w)
+      m_slots[fd].reader = NULL;
+    if (m_slots[fd].writer == w)
+      m_slots[fd].writer = NULL;
+    arm(fd);
+  }
+  return 1;
+}
+
+/**
+ * @name arm - Arm a descriptor.
+ * @param fd: The descriptor.
+ *
+ * This function registers a descriptor in the epoll set, as a one shot event,
+ * for the directions its waiters wait for. A descriptor that was closed and
+ * reused is registered again.
+ *
+ * @return 0: success, 1: error.
+ */
+int32_t AsyncLoop::arm(int32_t fd) {
+  struct epoll_event ev;
+
+  ev.events = EPOLLONESHOT;
+  if (m_slots[fd].reader)
+    ev.events |= EPOLLIN;
+  if (m_slots[fd].writer)
+    ev.events |= EPOLLOUT;
+  ev.data.fd = fd;
+  if (epoll_ctl(m_epfd, EPOLL_CTL_MOD, fd, &ev) < 0) {
+    if (errno != ENOENT || epoll_ctl(m_epfd, EPOLL_CTL_ADD, fd, &ev) < 0)
+      return 1;
+  }
+  return 0;
+}
+
+/**
+ * @name wake - Resume the waiters of a descriptor.
+ * @param fd: The ready descriptor.
+ * @param events: The ready epoll events.
+ *
+ * This function schedules the waiters of a ready descriptor and removes them
+ * from every descriptor they wait for. An error or a hang up wakes both.
+ *
+ * @return Void.
+ */
+void AsyncLoop::wake(int32_t fd, uint32_t events) {
+  struct waiter *ready[2] = { NULL, NULL };
+  struct waiter *w;
+  int32_t i, j, other;
+
+  if (fd < 0 || fd >= m_slots_len)
+    return;
+  if (events & (EPOLLIN | EPOLLERR | EPOLLHUP))
+    ready[0] = m_slots[fd].reader;
+  if (events & (EPOLLOUT | EPOLLERR | EPOLLHUP))
+    ready[1] = m_slots[fd].writer;
+
+  for (i = 0; i < 2; i++) {
+    w = ready[i];
+    if (!w)
+      continue;
+    for (j = 0; j < w->fds_len; j++) {
+      other = w->fds[j];
+      if (m_slots[other].reader == w)
+	m_slots[other].reader = NULL;
+      if (m_slots[other].writer == w)
+	m_slots[other].writer = NULL;
+    }
+    w->ready_fd = fd;
+    schedule(w->handle);
+  }
+
+  // The one shot event is spent; arm it again for the remaining waiter.
+  if (m_slots[fd].reader || m_slots[fd].writer)
+    arm(fd);
+}
@@ -0,0 +1,237 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * libIris - A simple and scalable networking library for Linux.
+ *
+ * Copyright (C) 2014 Giorgos Kappes <geokapp@gmail.com>
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file LICENSE.
+ *
+ */
+
+#ifndef LIBIRIS_COROUTINE_H
+#define LIBIRIS_COROUTINE_H
+
+#if __cplusplus < 202002L
+#error "libiris/coroutine.h requires C++20 (-std=c++20)."
+#endif
+
+#include <coroutine>
+#include <exception>
+#include "libiris.h"
+
+namespace iris {
+
+class AsyncLoop;
+
+/**
+ * @name Task - An awaitable coroutine.
+ *
+ * This class template is the return type of the libiris coroutines. A task
+ * starts when it is awaited, or when it is handed to AsyncLoop::spawn, and its
+ * awaiter resumes when the task returns its value with co_return.
+ */
+template <typename T>
+class Task {
+ public:
+  struct promise_type;
+  typedef std::coroutine_handle<promise_type> handle_type;
+
+  /**
+   * final_awaiter - Task completion.
+   *
+   * The final_awaiter resumes the coroutine that awaits the task. A spawned
+   * task has no awaiter; it destroys itself and tells its loop.
+   */
+  struct final_awaiter {
+    bool await_ready() noexcept { return false; }
+    std::coroutine_handle<> await_suspend(handle_type h) noexcept;
+    void await_resume() noexcept {}
+  };
+
+  /**
+   * promise_type - Task state.
+   *
+   * The promise_type struct holds the returned value and the coroutine that
+   * awaits the task.
+   */
+  struct promise_type {
+    T value;
+    std::coroutine_handle<> continuation;
+    AsyncLoop *loop;
+
+    promise_type() : value(), continuation(), loop(NULL) {}
+    Task get_return_object() { return Task(handle_type::from_promise(*this)); }
+    std::suspend_always initial_suspend() noexcept { return std::suspend_always(); }
+    final_awaiter final_suspend() noexcept { return final_awaiter(); }
+    void return_value(T v) { value = v; }
+    void unhandled_exception() { std::terminate(); }
+  };
+
+ private:
+  handle_type m_handle;
+
+ public:
+  explicit Task(handle_type h) : m_handle(h) {}
+  Task(Task &&other) noexcept : m_handle(other.m_handle) { other.m_handle = NULL; }
+  Task(const Task &) = delete;
+  Task &operator=(const Task &) = delete;
+  ~Task() {
+    if (m_handle)
+      m_handle.destroy();
+  }
+
+  bool await_ready() { return !m_handle || m_handle.done(); }
+  std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiter) {
+    m_handle.promise().continuation = awaiter;
+    return m_handle;
+  }
+  T await_resume() { return m_handle.promise().value; }
+
+  handle_type release() {
+    handle_type h = m_handle;
+    m_handle = NULL;
+    return h;
+  }
+};
+
+/**
+ * @name AsyncLoop - The coroutine event loop.
+ *
+ * This class runs libiris coroutines on one thread. The coroutines await the
+ * asynchronous versions of attach, send_data, receive_data and get_client, which
+ * suspend on EAGAIN instead of blocking; the loop waits for the sockets with one
+ * epoll set and resumes the coroutines whose sockets became ready. The sockets the
+ * loop works on are switched to non-blocking mode. RUDP endpoints are not supported,
+ * since a RUDP send waits for the acknowledgements of the peer. For example:
+ * ------------------------------------
+ * Task<int32_t> serve(AsyncLoop *loop, Client *client) {
+ *   char buf[100];
+ *   int32_t bytes;
+ *   while ((bytes = co_await loop->receive_data(client, buf, 100)) > 0)
+ *     co_await loop->send_data(client, buf, bytes);
+ *   client->detach();
+ *   delete client;
+ *   co_return 0;
+ * }
+ *
+ * Task<int32_t> listen(AsyncLoop *loop, Server *server) {
+ *   while (1) {
+ *     Client *client = new Client;
+ *     if (co_await loop->get_client(server, client)) {
+ *       delete client;
+ *       co_return 1;
+ *     }
+ *     loop->spawn(serve(loop, client));
+ *   }
+ * }
+ *
+ * AsyncLoop loop;
+ * server->start(NULL, "8000", 10);
+ * loop.open();
+ * loop.spawn(listen(&loop, server));
+ * loop.run();
+ * ------------------------------------
+ */
+class AsyncLoop {
+ public:
+  /**
+   * waiter - A suspended coroutine.
+   *
+   * The waiter struct is kept in the awaiting coroutine's frame while it
+   * waits for one or more descriptors.
+   */
+  struct waiter {
+    std::coroutine_handle<> handle;
+    const int32_t *fds;
+    int32_t fds_len;
+    int32_t ready_fd;
+    uint32_t events;
+  };
+
+  /**
+   * slot - The waiters of a descriptor.
+   *
+   * The slot struct holds the coroutines waiting to read from and to write
+   * to a descriptor.
+   */
+  struct slot {
+    struct waiter *reader;
+    struct waiter *writer;
+  };
+
+  /**
+   * readiness - Awaitable readiness of descriptors.
+   *
+   * The readiness struct suspends a coroutine until one of its descriptors
+   * is ready for the requested events.
+   */
+  struct readiness {
+    AsyncLoop *loop;
+    struct waiter w;
+    int32_t fd;
+    bool await_ready() { return false; }
+    bool await_suspend(std::coroutine_handle<> h);
+    int32_t await_resume() { return w.ready_fd; }
+  };
+
+ private:
+  int32_t m_epfd;
+  struct slot *m_slots;
+  int32_t m_slots_len;
+  void **m_ready;
+  int32_t m_ready_len;
+  int32_t m_ready_size;
+  int32_t m_tasks;
+  int32_t m_running;
+  struct epoll_event *m_events;
+
+ public:
+  AsyncLoop();
+  ~AsyncLoop();
+
+  int32_t open();
+  int32_t close();
+
+  void spawn(Task<int32_t> task);
+  int32_t run();
+  void stop();
+
+  readiness wait(int32_t fd, uint32_t events);
+  readiness wait_any(const int32_t *fds, int32_t fds_len, uint32_t events);
+
+  Task<int32_t> attach(Client *client, const char *host, const char *service);
+  Task<int32_t> send_data(Endpoint *endpoint, const void *data, const size_t data_len);
+  Task<int32_t> receive_data(Endpoint *endpoint, void *data, size_t data_len);
+  Task<int32_t> get_client(Server *server, Client *client);
+
+  void task_done();
+  int32_t schedule(std::coroutine_handle<> h);
+
+ private:
+  int32_t suspend(struct waiter *w);
+  int32_t arm(int32_t fd);
+  void wake(int32_t fd, uint32_t events);
+};
+
+template <typename T>
+std::coroutine_handle<> Task<T>::final_awaiter::await_suspend(handle_type h) noexcept {
+  std::coroutine_handle<> continuation = h.promise().continuation;
+  AsyncLoop *loop = h.promise().loop;
+
+  if (continuation)
+    return continuation;
+  if (loop) {
+    // A spawned task owns its frame.
+    h.destroy();
+    loop->task_done();
+  }
+  return std::noop_coroutine();
+}
+
+} // End of namespace
+
+#endif
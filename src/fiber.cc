@@ -0,0 +1,442 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * libIris - A simple and scalable networking library for Linux.
+ *
+ * Copyright (C) 2014 Giorgos Kappes <geokapp@gmail.com>
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file LICENSE.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/epoll.h>
+#include <unistd.h>
+#include <errno.h>
+#include "fiber.h"
+
+using namespace iris;
+
+// The scheduler whose fiber runs on this thread, if any.
+static __thread FiberScheduler *fiber_scheduler = NULL;
+
+/**
+ * acceptor - Accepting fiber information.
+ *
+ * The acceptor struct holds the arguments of a fiber started by serve.
+ */
+struct acceptor {
+  FiberScheduler *scheduler;
+  Server *server;
+  FiberScheduler::Connection func;
+  void *arg;
+};
+
+/**
+ * connection - Connection fiber information.
+ *
+ * The connection struct holds the arguments of the fiber of a client.
+ */
+struct connection {
+  Server *server;
+  Client *client;
+  FiberScheduler::Connection func;
+  void *arg;
+};
+
+/**
+ * @name FiberScheduler - Constructor.
+ *
+ * Initializes a fiber scheduler. The scheduler must be opened before it can run.
+ */
+FiberScheduler::FiberScheduler() {
+  m_epfd = UNUSED;
+  m_current = NULL;
+  m_ready = NULL;
+  m_ready_tail = NULL;
+  m_fibers = 0;
+  m_running = 0;
+  m_stack_size = FIBER_STACK_SIZE;
+  m_events = NULL;
+}
+
+/**
+ * @name FiberScheduler - Destructor.
+ *
+ * Destroys a fiber scheduler.
+ */
+FiberScheduler::~FiberScheduler() {
+  close();
+}
+
+/**
+ * @name set_stack_size - Set the stack size.
+ * @param size: The stack size of the fibers in bytes.
+ *
+ * Use this method to change the stack size of the fibers spawned afterwards.
+ * The default is FIBER_STACK_SIZE.
+ *
+ * @return Void.
+ */
+void FiberScheduler::set_stack_size(const size_t size) {
+  m_stack_size = size;
+}
+
+/**
+ * @name open - Open the scheduler.
+ *
+ * This function creates the epoll set of the scheduler.
+ *
+ * @return 0: success, 1: error.
+ */
+int32_t FiberScheduler::open() {
+  if (m_epfd != UNUSED)
+    return 0;
+  m_events = (struct epoll_event *)malloc(MAX_EPOLL_EVENTS_PER_RUN * sizeof(struct epoll_event));
+  if (!m_events) {
+    fprintf(stderr, "(open) Error: No free memory left.\n");
+    return 1;
+  }
+  m_epfd = epoll_create(EPOLL_QUEUE_LEN);
+  if (m_epfd < 0) {
+    m_epfd = UNUSED;
+    fprintf(stderr, "(open) Error: epoll_create failed.\n");
+    return 1;
+  }
+  return 0;
+}
+
+/**
+ * @name close - Close the scheduler.
+ *
+ * This function destroys the epoll set of the scheduler and the fibers that
+ * are ready to run. The fibers that still wait are not resumed.
+ *
+ * @return 0 on success, 1 on error.
+ */
+int32_t FiberScheduler::close() {
+  struct fiber *f;
+  int32_t result = 0;
+
+  while ((f = m_ready)) {
+    m_ready = f->next;
+    destroy(f);
+  }
+  m_ready_tail = NULL;
+  if (m_epfd != UNUSED && ::close(m_epfd) < 0)
+    result = 1;
+  m_epfd = UNUSED;
+  if (m_events)
+    free(m_events);
+  m_events = NULL;
+  return result;
+}
+
+/**
+ * @name spawn - Start a fiber.
+ * @param func: The function that the fiber runs.
+ * @param arg: The argument of the function.
+ *
+ * This function creates a fiber that runs a function on its own stack. The
+ * fiber starts on the next run of the scheduler and ends when the function
+ * returns. The stack has a guard page below it.
+ *
+ * @return 0: success, 1: error.
+ */
+int32_t FiberScheduler::spawn(FiberScheduler::Function func, void *arg) {
+  struct fiber *f;
+  size_t page = sysconf(_SC_PAGESIZE);
+
+  if (!func)
+    return 1;
+  f = (struct fiber *)malloc(sizeof(struct fiber));
+  if (!f) {
+    fprintf(stderr, "(spawn) Error: No free memory left.\n");
+    return 1;
+  }
+  memset(f, 0, sizeof(struct fiber));
+  f->stack_size = ((m_stack_size + page - 1) / page + 1) * page;
+  f->stack = mmap(NULL, f->stack_size, PROT_READ | PROT_WRITE,
+		  MAP_PRIVATE | MAP_ANONYMOUS | MAP_STACK, -1, 0);
+  if (f->stack == MAP_FAILED) {
+    fprintf(stderr, "(spawn) Error: Can not allocate the fiber stack.\n");
+    free(f);
+    return 1;
+  }
+  mprotect(f->stack, page, PROT_NONE);
+
+  if (getcontext(&f->context) < 0) {
+    munmap(f->stack, f->stack_size);
+    free(f);
+    return 1;
+  }
+  f->context.uc_stack.ss_sp = f->stack;
+  f->context.uc_stack.ss_size = f->stack_size;
+  f->context.uc_link = &m_context;
+  makecontext(&f->context, trampoline, 0);
+  f->func = func;
+  f->arg = arg;
+  m_fibers++;
+  schedule(f);
+  return 0;
+}
+
+/**
+ * @name serve - Serve a server endpoint with fibers.
+ * @param server: A started server endpoint.
+ * @param func: The function that serves a client.
+ * @param arg: The argument of the function.
+ *
+ * This function spawns a fiber that calls get_client in a loop and runs every
+ * client on a fiber of its own, by calling func. The function owns the client
+ * and must detach and delete it. Only one fiber may call get_client on a server.
+ *
+ * @return 0: success, 1: error.
+ */
+int32_t FiberScheduler::serve(Server *server, FiberScheduler::Connection func, void *arg) {
+  struct acceptor *a;
+
+  if (!server || !func) {
+    fprintf(stderr, "(serve) Error: server and func must not be NULL.\n");
+    return 1;
+  }
+  a = (struct acceptor *)malloc(sizeof(struct acceptor));
+  if (!a) {
+    fprintf(stderr, "(serve) Error: No free memory left.\n");
+    return 1;
+  }
+  a->scheduler = this;
+  a->server = server;
+  a->func = func;
+  a->arg = arg;
+  if (spawn(accept_loop, a)) {
+    free(a);
+    return 1;
+  }
+  return 0;
+}
+
+/**
+ * @name run - Run the scheduler.
+ *
+ * This function runs the ready fibers and waits for the sockets of the others,
+ * until every fiber has ended or stop is called.
+ *
+ * @return 0 on success, 1 on error.
+ */
+int32_t FiberScheduler::run() {
+  struct fiber *f;
+  int32_t i, nfds;
+
+  if (m_epfd == UNUSED)
+    return 1;
+
+  m_running = 1;
+  while (m_running) {
+    while (m_running && (f = m_ready)) {
+      m_ready = f->next;
+      if (!m_ready)
+	m_ready_tail = NULL;
+      f->next = NULL;
+
+      // Switch to the fiber until it waits, yields or ends.
+      m_current = f;
+      fiber_scheduler = this;
+      swapcontext(&m_context, &f->context);
+      fiber_scheduler = NULL;
+      m_current = NULL;
+      if (f->done)
+	destroy(f);
+    }
+    if (!m_running || !m_fibers)
+      break;
+
+    nfds = epoll_wait(m_epfd, m_events, MAX_EPOLL_EVENTS_PER_RUN, EPOLL_RUN_TIMEOUT);
+    if (nfds < 0) {
+      if (errno == EINTR)
+	continue;
+      m_running = 0;
+      return 1;
+    }
+    for (i = 0; i < nfds; i++)
+      schedule((struct fiber *)m_events[i].data.ptr);
+  }
+  m_running = 0;
+  return 0;
+}
+
+/**
+ * @name stop - Stop the scheduler.
+ *
+ * This function makes run return after the current fiber yields. It must be
+ * called from a fiber of the scheduler.
+ *
+ * @return Void.
+ */
+void FiberScheduler::stop() {
+  m_running = 0;
+}
+
+/**
+ * @name wait - Wait for a descriptor.
+ * @param fd: The descriptor.
+ * @param events: EPOLLIN or EPOLLOUT.
+ *
+ * This function suspends the current fiber until the descriptor is ready. The
+ * descriptor is registered in the epoll set as a one shot event.
+ *
+ * @return 0: success, 1: error.
+ */
+int32_t FiberScheduler::wait(int32_t fd, uint32_t events) {
+  struct epoll_event ev;
+  struct fiber *f = m_current;
+
+  if (!f)
+    return 1;
+  ev.events = events | EPOLLONESHOT;
+  ev.data.ptr = (void *)f;
+  if (epoll_ctl(m_epfd, EPOLL_CTL_MOD, fd, &ev) < 0) {
+    if (errno != ENOENT || epoll_ctl(m_epfd, EPOLL_CTL_ADD, fd, &ev) < 0)
+      return 1;
+  }
+  swapcontext(&f->context, &m_context);
+  return 0;
+}
+
+/**
+ * @name yield - Yield the current fiber.
+ *
+ * This function lets the other ready fibers run before the current one
+ * continues.
+ *
+ * @return Void.
+ */
+void FiberScheduler::yield() {
+  struct fiber *f = m_current;
+
+  if (!f)
+    return;
+  schedule(f);
+  swapcontext(&f->context, &m_context);
+}
+
+/**
+ * @name current - Get the running scheduler.
+ *
+ * This function returns the scheduler whose fiber runs on the calling thread.
+ *
+ * @return The scheduler or NULL if the caller does not run on a fiber.
+ */
+FiberScheduler *FiberScheduler::current() {
+  return fiber_scheduler;
+}
+
+/**
+ * @name schedule - Make a fiber ready.
+ * @param f: The fiber.
+ *
+ * This function appends a fiber to the ready queue.
+ *
+ * @return Void.
+ */
+void FiberScheduler::schedule(struct fiber *f) {
+  f->next = NULL;
+  if (m_ready_tail)
+    m_ready_tail->next = f;
+  else
+    m_ready = f;
+  m_ready_tail = f;
+}
+
+/**
+ * @name destroy - Destroy a fiber.
+ * @param f: The fiber.
+ *
+ * This function frees the stack and the information of a fiber.
+ *
+ * @return Void.
+ */
+void FiberScheduler::destroy(struct fiber *f) {
+  munmap(f->stack, f->stack_size);
+  free(f);
+  m_fibers--;
+}
+
+/**
+ * @name trampoline - The entry point of the fibers.
+ *
+ * This function runs the function of the current fiber and marks the fiber
+ * as done. The fiber's context then returns to the scheduler.
+ *
+ * @return Void.
+ */
+void FiberScheduler::trampoline() {
+  struct fiber *f = fiber_scheduler->m_current;
+
+  f->func(f->arg);
+  f->done = 1;
+}
+
+/**
+ * @name accept_loop - The accepting fiber.
+ * @param arg: The acceptor information.
+ *
+ * This function accepts the clients of a server and spawns a fiber for each.
+ * It ends when get_client fails.
+ *
+ * @return Void.
+ */
+void FiberScheduler::accept_loop(void *arg) {
+  struct acceptor *a = (struct acceptor *)arg;
+  struct connection *c;
+  Client *client;
+
+  while (1) {
+    client = new Client;
+    if (a->server->get_client(client)) {
+      delete client;
+      break;
+    }
+    c = (struct connection *)malloc(sizeof(struct connection));
+    if (!c) {
+      client->detach();
+      delete client;
+      continue;
+    }
+    c->server = a->server;
+    c->client = client;
+    c->func = a->func;
+    c->arg = a->arg;
+    if (a->scheduler->spawn(run_connection, c)) {
+      client->detach();
+      delete client;
+      free(c);
+    }
+  }
+  free(a);
+}
+
+/**
+ * @name run_connection - The fiber of a client.
+ * @param arg: The connection information.
+ *
+ * This function serves a client.
+ *
+ * @return Void.
+ */
+void FiberScheduler::run_connection(void *arg) {
+  struct connection *c = (struct connection *)arg;
+  Server *server = c->server;
+  Client *client = c->client;
+  FiberScheduler::Connection func = c->func;
+
+  arg = c->arg;
+  free(c);
+  func(server, client, arg);
+}
@@ -0,0 +1,111 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * libIris - A simple and scalable networking library for Linux.
+ *
+ * Copyright (C) 2014 Giorgos Kappes <geokapp@gmail.com>
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file LICENSE.
+ *
+ */
+
+#ifndef LIBIRIS_FIBER_H
+#define LIBIRIS_FIBER_H
+
+#include <ucontext.h>
+#include "libiris.h"
+
+namespace iris {
+
+#define FIBER_STACK_SIZE         (64 * 1024)
+
+/**
+ * @name FiberScheduler - The fiber runtime object.
+ *
+ * This class runs blocking libiris code on lightweight fibers, many on one thread.
+ * While a fiber runs, the blocking calls of the endpoints (Client::attach,
+ * Server::get_client, send_data and receive_data) do not block the thread; they
+ * work on non-blocking sockets and, instead of waiting in the kernel, yield the
+ * fiber to the scheduler, which waits for all the sockets with one epoll set. The
+ * endpoints keep their blocking semantics, so code written for a blocking server
+ * runs unchanged. The listening sockets of a TCP server are made non-blocking when
+ * get_client first runs on a fiber. Only one fiber may wait for a socket at a time.
+ * For example:
+ * ------------------------------------
+ * void serve(Server *server, Client *client, void *arg) {
+ *   char data[100];
+ *   server->receive_data(data, 100, client);
+ *   ...
+ *   client->detach();
+ *   delete client;
+ * }
+ *
+ * FiberScheduler scheduler;
+ * status = server->start(NULL, "8000", 10);
+ * if (!status && !scheduler.open() && !scheduler.serve(server, serve, NULL))
+ *   scheduler.run();
+ * ------------------------------------
+ */
+class FiberScheduler {
+ public:
+  typedef void (*Function)(void *arg);
+  typedef void (*Connection)(Server *server, Client *client, void *arg);
+
+  /**
+   * fiber - Fiber information.
+   *
+   * The fiber struct holds the context and the stack of a fiber.
+   */
+  struct fiber {
+    ucontext_t context;
+    void *stack;
+    size_t stack_size;
+    Function func;
+    void *arg;
+    int32_t done;
+    struct fiber *next;
+  };
+
+ private:
+  int32_t m_epfd;
+  ucontext_t m_context;
+  struct fiber *m_current;
+  struct fiber *m_ready;
+  struct fiber *m_ready_tail;
+  int32_t m_fibers;
+  int32_t m_running;
+  size_t m_stack_size;
+  struct epoll_event *m_events;
+
+ public:
+  FiberScheduler();
+  ~FiberScheduler();
+
+  void set_stack_size(const size_t size);
+  int32_t open();
+  int32_t close();
+
+  int32_t spawn(Function func, void *arg);
+  int32_t serve(Server *server, Connection func, void *arg);
+  int32_t run();
+  void stop();
+
+  int32_t wait(int32_t fd, uint32_t events);
+  void yield();
+
+  static FiberScheduler *current();
+
+ private:
+  void schedule(struct fiber *f);
+  void destroy(struct fiber *f);
+  static void trampoline();
+  static void accept_loop(void *arg);
+  static void run_connection(void *arg);
+};
+
+} // End of namespace
+
+#endif
@@ -25,10 +25,323 @@
 #include <sys/select.h>
 #include <sys/epoll.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <sys/uio.h>
+#include <sys/sendfile.h>
+#include <linux/errqueue.h>
+#include <netinet/udp.h>
 #include "libiris.h"
+#include "fiber.h"
+#include "record_pool.h"
+#include "rudp.h"
+#include "session_table.h"
+
+// The number of vector entries copied on the stack.
+#define VECTOR_LOCAL             16
+
+// The largest UDP payload.
+#define UDP_PAYLOAD_MAX          65507
+
+// The most segments that the kernel takes in one UDP_SEGMENT send.
+#define UDP_MAX_SEGMENTS         64
 
 using namespace iris;
 
+/**
+ * zerocopy - Zero-copy transmit state.
+ *
+ * The zerocopy struct counts the sends made with MSG_ZEROCOPY and the sends
+ * whose completion the kernel has reported. The completions that arrive out of
+ * order are kept as ranges of send numbers until the earlier ones arrive.
+ */
+struct iris::zerocopy {
+  bool enabled;
+  bool copied;
+  uint32_t issued;
+  uint32_t done;
+  uint32_t *ranges;
+  int32_t ranges_len;
+  int32_t ranges_size;
+};
+
+/**
+ * @name set_fd_nonblocking - Set the blocking mode of a descriptor.
+ * @param sock: Socket descriptor.
+ * @param on: True for non-blocking mode, false for blocking mode.
+ *
+ * This function sets or clears the O_NONBLOCK flag of a descriptor.
+ *
+ * @return 0: success, 1: error.
+ */
+static int32_t set_fd_nonblocking(int32_t sock, const bool on) {
+  int32_t flags;
+
+  flags = fcntl(sock, F_GETFL, 0);
+  if (flags < 0)
+    return 1;
+  flags = on ? (flags | O_NONBLOCK) : (flags & ~O_NONBLOCK);
+  if (fcntl(sock, F_SETFL, flags) < 0)
+    return 1;
+  return 0;
+}
+
+/**
+ * @name fiber_wait - Wait for a descriptor on a fiber.
+ * @param sock: Socket descriptor.
+ * @param events: EPOLLIN or EPOLLOUT.
+ *
+ * This function is called after a socket call failed. If the caller runs on a
+ * fiber and the call would block, it yields the fiber until the socket is ready.
+ *
+ * @return 0 if the call can be retried, 1 otherwise.
+ */
+static int32_t fiber_wait(int32_t sock, uint32_t events) {
+  FiberScheduler *scheduler = FiberScheduler::current();
+
+  if (!scheduler ||
+      (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINPROGRESS))
+    return 1;
+  return scheduler->wait(sock, events);
+}
+
+/**
+ * @name fiber_connect - Connect a socket.
+ * @param sock: Socket descriptor.
+ * @param addr: The address of the server.
+ * @param addr_len: The size of the address.
+ *
+ * This function calls connect. On a fiber the socket is non-blocking, so the
+ * fiber yields until the connection completes.
+ *
+ * @return 0: success, -1: error.
+ */
+static int32_t fiber_connect(int32_t sock, const struct sockaddr *addr, socklen_t addr_len) {
+  int32_t error = 0;
+  socklen_t error_len = sizeof(error);
+
+  if (connect(sock, addr, addr_len) == 0)
+    return 0;
+  if (fiber_wait(sock, EPOLLOUT))
+    return -1;
+  if (getsockopt(sock, SOL_SOCKET, SO_ERROR, &error, &error_len) < 0 || error)
+    return -1;
+  return 0;
+}
+
+/**
+ * @name skip_vector - Skip the transferred part of a vector.
+ * @param iov: The buffers. The pointer and the first remaining buffer are modified.
+ * @param iovcnt: The number of buffers.
+ * @param bytes: The number of bytes transferred.
+ *
+ * This function drops the buffers that were transferred completely and trims
+ * the one that was transferred in part, so a transfer can be resumed.
+ *
+ * @return The number of buffers left.
+ */
+static int32_t skip_vector(struct iovec **iov, int32_t iovcnt, size_t bytes) {
+  while (iovcnt > 0 && bytes >= (*iov)->iov_len) {
+    bytes -= (*iov)->iov_len;
+    (*iov)++;
+    iovcnt--;
+  }
+  if (iovcnt > 0) {
+    (*iov)->iov_base = (char *)(*iov)->iov_base + bytes;
+    (*iov)->iov_len -= bytes;
+  }
+  return iovcnt;
+}
+
+/**
+ * @name copy_vector - Copy a vector table.
+ * @param iov: The buffers.
+ * @param iovcnt: The number of buffers.
+ * @param local: A table of VECTOR_LOCAL entries to use for short vectors.
+ *
+ * This function copies the table of a vector, so that a transfer can trim it
+ * without changing the caller's table. Long tables are allocated and must be
+ * freed if they are not local.
+ *
+ * @return The copy or NULL on error.
+ */
+static struct iovec *copy_vector(const struct iovec *iov, int32_t iovcnt,
+				 struct iovec *local) {
+  struct iovec *vec = local;
+
+  if (iovcnt > VECTOR_LOCAL) {
+    vec = (struct iovec *)malloc(iovcnt * sizeof(struct iovec));
+    if (!vec) {
+      fprintf(stderr, "(copy_vector) Error: No free memory left.\n");
+      return NULL;
+    }
+  }
+  memcpy(vec, iov, iovcnt * sizeof(struct iovec));
+  return vec;
+}
+
+/**
+ * @name vector_length - Get the size of a vector.
+ * @param iov: The buffers.
+ * @param iovcnt: The number of buffers.
+ *
+ * @return The number of bytes of the buffers.
+ */
+static size_t vector_length(const struct iovec *iov, int32_t iovcnt) {
+  size_t len = 0;
+
+  for (int32_t i = 0; i < iovcnt; i++)
+    len += iov[i].iov_len;
+  return len;
+}
+
+/**
+ * @name flatten_vector - Copy a vector to one buffer.
+ * @param iov: The buffers.
+ * @param iovcnt: The number of buffers.
+ * @param len: The number of bytes of the buffers.
+ *
+ * This function copies the buffers in order to an allocated buffer, which
+ * must be freed, for the transfers that need contiguous data.
+ *
+ * @return The buffer or NULL on error.
+ */
+static char *flatten_vector(const struct iovec *iov, int32_t iovcnt, size_t len) {
+  char *data;
+  size_t off = 0;
+
+  data = (char *)malloc(len ? len : 1);
+  if (!data) {
+    fprintf(stderr, "(flatten_vector) Error: No free memory left.\n");
+    return NULL;
+  }
+  for (int32_t i = 0; i < iovcnt; i++) {
+    memcpy(data + off, iov[i].iov_base, iov[i].iov_len);
+    off += iov[i].iov_len;
+  }
+  return data;
+}
+
+/**
+ * @name scatter_vector - Copy a buffer to a vector.
+ * @param iov: The buffers.
+ * @param iovcnt: The number of buffers.
+ * @param data: The data.
+ * @param len: The size of the data.
+ *
+ * @return Void.
+ */
+static void scatter_vector(const struct iovec *iov, int32_t iovcnt, const char *data,
+			   size_t len) {
+  size_t chunk;
+
+  for (int32_t i = 0; i < iovcnt && len; i++) {
+    chunk = iov[i].iov_len < len ? iov[i].iov_len : len;
+    memcpy(iov[i].iov_base, data, chunk);
+    data += chunk;
+    len -= chunk;
+  }
+}
+
+/**
+ * @name send_vector - Send a vector of buffers.
+ * @param target: The endpoint where the data will be sent.
+ * @param iov: The buffers. The table is modified.
+ * @param iovcnt: The number of buffers.
+ *
+ * This function sends the buffers in order with sendmsg until all of them are
+ * written. If the endpoint is in non-blocking mode and the socket buffer fills
+ * up, the bytes sent so far are returned.
+ *
+ * @return Total number of bytes sent or -1 on error.
+ */
+static ssize_t send_vector(Endpoint *target, struct iovec *iov, int32_t iovcnt) {
+  struct msghdr msg;
+  size_t total = 0;
+  ssize_t bytes;
+
+  memset(&msg, 0, sizeof(msg));
+  while (iovcnt > 0) {
+    msg.msg_iov = iov;
+    msg.msg_iovlen = iovcnt;
+    bytes = sendmsg(target->sockets()[0], &msg, 0);
+    if (bytes == -1) {
+      if (target->nonblocking() && total > 0 &&
+	  (errno == EAGAIN || errno == EWOULDBLOCK))
+	break;
+      if (!target->nonblocking() && !fiber_wait(target->sockets()[0], EPOLLOUT))
+	continue;
+      return -1;
+    }
+    total += bytes;
+    iovcnt = skip_vector(&iov, iovcnt, bytes);
+  }
+  return total;
+}
+
+/**
+ * @name send_packet - Send a datagram.
+ * @param target: The endpoint where the datagram will be sent.
+ * @param data: Pointer to the datagram.
+ * @param data_len: Size of the datagram.
+ *
+ * This function sends one datagram to the address of an endpoint.
+ *
+ * @return The number of bytes sent or -1 on error.
+ */
+static int32_t send_packet(Endpoint *target, const void *data, size_t data_len) {
+  int32_t bytes;
+
+  do {
+    bytes = sendto(target->sockets()[0], data, data_len, 0,
+		   target->address_info()->ai_addr,
+		   target->address_info()->ai_addrlen);
+  } while (bytes == -1 && !target->nonblocking() &&
+	   !fiber_wait(target->sockets()[0], EPOLLOUT));
+  return bytes;
+}
+
+/**
+ * @name send_segments - Send a datagram in segments.
+ * @param target: The endpoint where the datagrams will be sent.
+ * @param data: Pointer to the data.
+ * @param data_len: Size of the data, at most UDP_PAYLOAD_MAX bytes.
+ * @param size: The size of the datagrams.
+ *
+ * This function sends data with one sendmsg and a UDP_SEGMENT control message, so
+ * the kernel, or the network card, splits them into datagrams of the given size.
+ *
+ * @return The number of bytes sent or -1 on error.
+ */
+static int32_t send_segments(Endpoint *target, const void *data, size_t data_len,
+			     size_t size) {
+  char control[CMSG_SPACE(sizeof(uint16_t))];
+  struct cmsghdr *cmsg;
+  struct msghdr msg;
+  struct iovec iov;
+  int32_t bytes;
+
+  iov.iov_base = (void *)data;
+  iov.iov_len = data_len;
+  memset(&msg, 0, sizeof(msg));
+  memset(control, 0, sizeof(control));
+  msg.msg_name = target->address_info()->ai_addr;
+  msg.msg_namelen = target->address_info()->ai_addrlen;
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control;
+  msg.msg_controllen = sizeof(control);
+  cmsg = CMSG_FIRSTHDR(&msg);
+  cmsg->cmsg_level = SOL_UDP;
+  cmsg->cmsg_type = UDP_SEGMENT;
+  cmsg->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+  *(uint16_t *)CMSG_DATA(cmsg) = size;
+  do {
+    bytes = sendmsg(target->sockets()[0], &msg, 0);
+  } while (bytes == -1 && !target->nonblocking() &&
+	   !fiber_wait(target->sockets()[0], EPOLLOUT));
+  return bytes;
+}
+
 /**
  * @name Endpoint - Constructor.
  *
@@ -41,6 +354,26 @@ Endpoint::Endpoint() {
   m_sockets = NULL;
   m_sockets_len = 0;
   m_address_info = NULL;
+  m_address_pooled = false;
+  m_nonblocking = false;
+  m_gather_on = false;
+  m_gather = NULL;
+  m_gather_len = 0;
+  m_gather_size = 0;
+  m_read = NULL;
+  m_read_size = 0;
+  m_read_start = 0;
+  m_read_end = 0;
+  m_message_max = MESSAGE_MAX;
+  m_zerocopy = NULL;
+  m_segment_off = false;
+  m_segment_on = false;
+  m_packet_size = UDPPACKETSIZE;
+  m_mtu_discovery = false;
+  m_rudp = NULL;
+  m_owner = NULL;
+  m_sessions = NULL;
+  m_peer_socket = false;
 }
 
 /**
@@ -58,6 +391,26 @@ Endpoint::Endpoint(const Endpoint::Protocol proto, const Endpoint::Type type) {
   m_sockets = NULL;
   m_sockets_len = 0;
   m_address_info = NULL;
+  m_address_pooled = false;
+  m_nonblocking = false;
+  m_gather_on = false;
+  m_gather = NULL;
+  m_gather_len = 0;
+  m_gather_size = 0;
+  m_read = NULL;
+  m_read_size = 0;
+  m_read_start = 0;
+  m_read_end = 0;
+  m_message_max = MESSAGE_MAX;
+  m_zerocopy = NULL;
+  m_segment_off = false;
+  m_segment_on = false;
+  m_packet_size = UDPPACKETSIZE;
+  m_mtu_discovery = false;
+  m_rudp = NULL;
+  m_owner = NULL;
+  m_sessions = NULL;
+  m_peer_socket = false;
 }
 
 /**
@@ -72,16 +425,34 @@ Endpoint::~Endpoint() {
   m_sockets_len = 0;
   
   // Safely delete m_addr
-  if (m_address_info)
-    freeaddrinfo(m_address_info);
-  m_address_info  = NULL;
+  free_address_info();
+
+  if (m_gather)
+    free(m_gather);
+  m_gather = NULL;
+
+  if (m_read)
+    free(m_read);
+  m_read = NULL;
+
+  free_zerocopy();
+
+  if (m_rudp)
+    delete m_rudp;
+  m_rudp = NULL;
+
+  if (m_sessions)
+    delete m_sessions;
+  m_sessions = NULL;
 }
 
 /**
  * @name set_protocol - Set the protocol.
- * @param proto: The protocol (TCP or UDP).
+ * @param proto: The protocol (TCP, UDP or RUDP).
  *
- * Use this method to set the communication protocol of an endpoint.
+ * Use this method to set the communication protocol of an endpoint. RUDP sends
+ * messages reliably over UDP sockets: send_data returns when the peer has received
+ * the whole message, and receive_data returns one complete message.
  *
  * @return Void.
  */
@@ -123,6 +494,47 @@ Endpoint::Type Endpoint::type() {
   return m_type;
 }
 
+/**
+ * @name nonblocking - Get the blocking mode.
+ *
+ * This function returns true if the endpoint's socket is in non-blocking
+ * mode.
+ *
+ * @return The blocking mode.
+ */
+bool Endpoint::nonblocking() {
+  return m_nonblocking;
+}
+
+/**
+ * @name set_gather - Set the gather mode.
+ * @param on: True to gather the outgoing data, false to send them at once.
+ *
+ * In gather mode send_data copies the TCP data to a gather buffer of the
+ * endpoint instead of sending them, and flush sends the gathered slices with one
+ * system call. A slice that does not fit in the GATHER_BUFFER_SIZE bytes of the
+ * buffer is sent at once together with the gathered data, with one sendmsg and
+ * without being copied. Turning the gather mode off flushes the endpoint.
+ *
+ * @return Void.
+ */
+void Endpoint::set_gather(const bool on) {
+  if (!on && m_gather_on)
+    flush();
+  m_gather_on = on;
+}
+
+/**
+ * @name gather - Check the gather mode.
+ *
+ * This function returns true if the endpoint gathers its outgoing data.
+ *
+ * @return The gather mode.
+ */
+bool Endpoint::gather() {
+  return m_gather_on;
+}
+
 /**
  * @name sockets - Get the socket descriptor table.
  *
@@ -163,7 +575,10 @@ struct addrinfo *Endpoint::address_info() {
  * @param client: The endpoint where the data will be sent. By default this is NULL
  *                and must be used only by the Server side to send data to a client.
  *
- * This function sends data to an endpoint.
+ * This function sends data to an endpoint. If the endpoint is in non-blocking mode
+ * and the socket buffer fills up, the bytes sent so far are returned. UDP data
+ * are sent in packets of the endpoint's packet size; the kernel splits large data
+ * with UDP_SEGMENT, up to UDP_MAX_SEGMENTS packets per send, if it supports it.
  *
  * @return Total number of bytes sent or -1 on error.
  */
@@ -172,58 +587,69 @@ int32_t Endpoint::send_data(const void *data, const size_t data_len, Endpoint *c
   int32_t bytes;
   size_t total = 0;
   int32_t bytes_left = data_len;
-  int32_t packets = data_len / UDPPACKETSIZE;   
-  int32_t packet_left = data_len % UDPPACKETSIZE;    
+  size_t size, chunk;
   
   if (client)
     target = client;
   else
     target = this;
   
+  // Gather TCP data until the endpoint is flushed.
+  if (target->protocol() == Endpoint::TCP && target->m_gather_on)
+    return target->gather_data(data, data_len);
+
   // Handle TCP send.
   if (target->protocol() == Endpoint::TCP) {
     while (total < data_len) {
       bytes = send(target->sockets()[0], ((char*)data) + total, bytes_left, 0); 
       if (bytes == -1)  {
+	if (target->nonblocking() && total > 0 &&
+	    (errno == EAGAIN || errno == EWOULDBLOCK))
+	  break;
+	if (!target->nonblocking() && !fiber_wait(target->sockets()[0], EPOLLOUT))
+	  continue;
 	return -1; 
       } 
       total += bytes;
       bytes_left -= bytes;
     }
   } else if (target->protocol() == Endpoint::UDP) { 
-    // We have to split data into packets.
-    for (int32_t i = 0; i <= packets; i++) {
-      // We have only one packet to send.
-      if (packets < 1) {
-	bytes = sendto(target->sockets()[0], data, data_len, 0,
-		       target->address_info()->ai_addr,
-		       target->address_info()->ai_addrlen);
-	if (bytes == -1) {
-	  return -1; 
-	} 
-	total = bytes;
+    // We have to split data into packets of the endpoint's packet size.
+    do {
+      size = target->m_packet_size;
+      chunk = data_len - total;
+      if (chunk > size && !target->m_segment_off) {
+	// Let the kernel split data into packets.
+	if (chunk > (UDP_PAYLOAD_MAX / size) * size)
+	  chunk = (UDP_PAYLOAD_MAX / size) * size;
+	if (chunk > UDP_MAX_SEGMENTS * size)
+	  chunk = UDP_MAX_SEGMENTS * size;
+	bytes = send_segments(target, ((char*)data) + total, chunk, size);
+	if (bytes == -1 && (errno == EIO || errno == ENOPROTOOPT || errno == EOPNOTSUPP ||
+			    (errno == EINVAL && !target->m_segment_on))) {
+	  // Segmentation is not supported.
+	  target->m_segment_off = true;
+	  continue;
+	}
+	if (bytes != -1)
+	  target->m_segment_on = true;
       } else {
-	// We have got more than one packets
-	if (i < packets) {
-	  bytes = sendto(target->sockets()[0], data, UDPPACKETSIZE, 0,
-			 target->address_info()->ai_addr,
-			 target->address_info()->ai_addrlen);
-	  if (bytes == -1) {
-	    return -1; 
-	  } 
-	  total += bytes;
-	  data = ((char*)data) + UDPPACKETSIZE;
-	} else {
-	  bytes = sendto(target->sockets()[0], data, packet_left, 0,
-			 target->address_info()->ai_addr,
-			 target->address_info()->ai_addrlen);
-	  if (bytes == -1) {
-	    return -1; 
-	  } 
-	  total += bytes;
-	}   
+	if (chunk > size)
+	  chunk = size;
+	bytes = send_packet(target, ((char*)data) + total, chunk);
       }
-    }
+      if (bytes == -1) {
+	// The path takes smaller packets.
+	if (errno == EMSGSIZE && !target->probe_packet_size())
+	  continue;
+	return -1; 
+      }
+      total += bytes;
+    } while (total < data_len);
+  } else if (target->protocol() == Endpoint::RUDP) {
+    // The protocol state belongs to the endpoint that owns the socket.
+    return target->rudp()->send(target->sockets()[0], target->address_info()->ai_addr,
+				target->address_info()->ai_addrlen, data, data_len);
   } else {
     // Unknown endpoint type.
     return -1;
@@ -231,6 +657,161 @@ int32_t Endpoint::send_data(const void *data, const size_t data_len, Endpoint *c
   return total;
 }
 
+/**
+ * @name send_data - Send a vector of buffers.
+ * @param iov: The buffers.
+ * @param iovcnt: The number of buffers.
+ * @param client: The endpoint where the data will be sent. By default this is NULL
+ *                and must be used only by the Server side to send data to a client.
+ *
+ * This function sends the buffers of a fragmented message in order with sendmsg,
+ * without copying them to one buffer. A TCP send that is cut short continues from
+ * the byte where it stopped, even inside a buffer; the caller's table is not
+ * modified. If the endpoint is in non-blocking mode and the socket buffer fills up,
+ * the bytes sent so far are returned. To a UDP endpoint the buffers are sent as
+ * one datagram if they fit in a packet; larger data, and RUDP data, are copied to
+ * one buffer and sent like the data of the other send_data.
+ *
+ * @return Total number of bytes sent or -1 on error.
+ */
+int32_t Endpoint::send_data(const struct iovec *iov, const int32_t iovcnt, Endpoint *client) {
+  Endpoint *target = client ? client : this;
+  struct iovec local[VECTOR_LOCAL], *vec;
+  struct msghdr msg;
+  ssize_t bytes;
+  int32_t i, total = 0;
+  size_t len;
+  char *data;
+
+  if (!iov || iovcnt < 0) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  if (target->protocol() == Endpoint::TCP) {
+    // Gather TCP data until the endpoint is flushed.
+    if (target->m_gather_on) {
+      for (i = 0; i < iovcnt; i++) {
+	if (target->gather_data(iov[i].iov_base, iov[i].iov_len) < 0)
+	  return -1;
+	total += iov[i].iov_len;
+      }
+      return total;
+    }
+    vec = copy_vector(iov, iovcnt, local);
+    if (!vec)
+      return -1;
+    bytes = send_vector(target, vec, iovcnt);
+    if (vec != local)
+      free(vec);
+    return bytes;
+  }
+
+  // Packetize the data like contiguous data.
+  len = vector_length(iov, iovcnt);
+  if (target->protocol() == Endpoint::RUDP ||
+      (target->protocol() == Endpoint::UDP && len > target->m_packet_size)) {
+    data = flatten_vector(iov, iovcnt, len);
+    if (!data)
+      return -1;
+    bytes = send_data(data, len, client);
+    free(data);
+    return bytes;
+  } else if (target->protocol() == Endpoint::UDP) {
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_name = target->address_info()->ai_addr;
+    msg.msg_namelen = target->address_info()->ai_addrlen;
+    msg.msg_iov = (struct iovec *)iov;
+    msg.msg_iovlen = iovcnt;
+    do {
+      bytes = sendmsg(target->sockets()[0], &msg, 0);
+    } while (bytes == -1 && !target->nonblocking() &&
+	     !fiber_wait(target->sockets()[0], EPOLLOUT));
+    return bytes;
+  }
+  // Unknown endpoint type.
+  errno = EPROTONOSUPPORT;
+  return -1;
+}
+
+/**
+ * @name flush - Send the gathered data.
+ * @param client: The endpoint whose gathered data will be sent. By default this is
+ *                NULL and must be used only by the Server side to flush a client.
+ *
+ * This function sends the data that send_data gathered with one system call. If
+ * the endpoint is in non-blocking mode and the socket buffer fills up, the data
+ * that were not sent stay in the gather buffer.
+ *
+ * @return Total number of bytes sent or -1 on error.
+ */
+int32_t Endpoint::flush(Endpoint *client) {
+  Endpoint *target = client ? client : this;
+  struct iovec iov;
+  ssize_t bytes;
+
+  if (!target->m_gather_len)
+    return 0;
+  iov.iov_base = target->m_gather;
+  iov.iov_len = target->m_gather_len;
+  bytes = send_vector(target, &iov, 1);
+  if (bytes < 0)
+    return -1;
+  target->m_gather_len -= bytes;
+  if (target->m_gather_len)
+    memmove(target->m_gather, target->m_gather + bytes, target->m_gather_len);
+  return bytes;
+}
+
+/**
+ * @name gather_data - Gather data.
+ * @param data: Pointer to the data buffer.
+ * @param data_len: Size of the data buffer.
+ *
+ * This function copies data to the gather buffer. A blocking endpoint sends a
+ * slice that does not fit together with the gathered data; a non-blocking one
+ * grows the buffer and flushes what the socket takes.
+ *
+ * @return data_len on success or -1 on error.
+ */
+int32_t Endpoint::gather_data(const void *data, const size_t data_len) {
+  struct iovec iov[2];
+  size_t size;
+  char *buffer;
+
+  // Send the gathered data and the slice together.
+  if (!m_nonblocking && m_gather_len + data_len > GATHER_BUFFER_SIZE) {
+    iov[0].iov_base = m_gather;
+    iov[0].iov_len = m_gather_len;
+    iov[1].iov_base = (void *)data;
+    iov[1].iov_len = data_len;
+    if (send_vector(this, iov, 2) < 0)
+      return -1;
+    m_gather_len = 0;
+    return data_len;
+  }
+
+  if (m_gather_len + data_len > m_gather_size) {
+    size = m_gather_size ? m_gather_size : GATHER_BUFFER_SIZE;
+    while (size < m_gather_len + data_len)
+      size *= 2;
+    buffer = (char *)realloc(m_gather, size);
+    if (!buffer) {
+      fprintf(stderr, "(gather_data) Error: No free memory left.\n");
+      return -1;
+    }
+    m_gather = buffer;
+    m_gather_size = size;
+  }
+  memcpy(m_gather + m_gather_len, data, data_len);
+  m_gather_len += data_len;
+
+  if (m_gather_len > GATHER_BUFFER_SIZE && flush() < 0 &&
+      errno != EAGAIN && errno != EWOULDBLOCK)
+    return -1;
+  return data_len;
+}
+
 /*
  * @name receive_data - Receive data.
  * @param data: Pointer to the data buffer.
@@ -239,7 +820,11 @@ int32_t Endpoint::send_data(const void *data, const size_t data_len, Endpoint *c
  *                this is NULL and must be used only by the Server side to receive
  *                data from a client.
  *
- * This function receives data from an endpoint.
+ * This function receives data from an endpoint. A blocking TCP endpoint returns the
+ * data that one recv brings, which may be a part of what the peer sent. If the
+ * endpoint is in non-blocking mode the socket is drained until recv fails with
+ * EAGAIN or the buffer is full. If no data was available, -1 is returned and errno
+ * is set to EAGAIN.
  *
  * @return Total number of bytes received or -1 on error.
  */
@@ -252,6 +837,7 @@ int32_t Endpoint::receive_data(void *data, size_t data_len, Endpoint *client) {
   struct sockaddr_storage client_addr;
   socklen_t client_sin_size;
   char *data_ptr = (char*)data;
+  uint32_t len;
   
   // info must be point to a valid endpoint.
   if (client) {
@@ -263,21 +849,52 @@ int32_t Endpoint::receive_data(void *data, size_t data_len, Endpoint *client) {
   client_sin_size = sizeof(client_addr);
   
   if (target->protocol() == Endpoint::TCP) {
+    // Return the buffered data first.
+    if (target->m_read_end > target->m_read_start) {
+      total = target->m_read_end - target->m_read_start;
+      if (total > data_len)
+	total = data_len;
+      memcpy(data, target->m_read + target->m_read_start, total);
+      target->consume(total);
+      return total;
+    }
     while(total < data_len) {
       bytes = recv(target->sockets()[0], data_ptr, bytes_left, 0);
       if (bytes == -1) {
+	if (target->nonblocking() && total > 0 &&
+	    (errno == EAGAIN || errno == EWOULDBLOCK))
+	  break;
+	if (!target->nonblocking() && !fiber_wait(target->sockets()[0], EPOLLIN))
+	  continue;
 	return -1; 
       } 
       if (bytes == 0)  
 	break; 
       total += bytes;
-      if (strstr(data_ptr, "\0")) 
+
+      // A blocking receive returns what one recv brings; receive_message
+      // returns whole messages.
+      if (!target->nonblocking())
 	break;
       data_ptr += bytes;
       bytes_left -= bytes;
     }
     return (total);            
   } else if (target->protocol() == Endpoint::UDP) {         
+    // A server with sessions has read the datagrams of its clients already.
+    if (m_sessions && target != this && !target->m_peer_socket)
+      return m_sessions->receive(target->sockets()[0], target->address_info(), data,
+				 data_len);
+
+    // The first datagrams of a connected peer were read by get_client.
+    if (target->m_read_end > target->m_read_start) {
+      memcpy(&len, target->m_read + target->m_read_start, sizeof(len));
+      total = len < data_len ? len : data_len;
+      memcpy(data, target->m_read + target->m_read_start + sizeof(len), total);
+      target->consume(sizeof(len) + len);
+      return total;
+    }
+
     // Check if there are data to read.
     time = receive_timeout(target->sockets()[0], /*5*/ 0, 0);
     switch (time) {
@@ -297,6 +914,14 @@ int32_t Endpoint::receive_data(void *data, size_t data_len, Endpoint *client) {
       total = bytes;
       return total;
     }
+  } else if (target->protocol() == Endpoint::RUDP) {
+    // A client of a server receives only the messages of its peer.
+    if (target->m_owner)
+      return target->rudp()->receive(target->sockets()[0], target->nonblocking(), data,
+				     data_len, target->address_info()->ai_addr,
+				     target->address_info()->ai_addrlen);
+    return target->rudp()->receive(target->sockets()[0], target->nonblocking(), data,
+				   data_len);
   } else {
     // Unknown endpoint protocol.
     return -1;
@@ -304,46 +929,1193 @@ int32_t Endpoint::receive_data(void *data, size_t data_len, Endpoint *client) {
 }
 
 /**
- * @name receive_timeout - Timeout receive.
- * @param sock: Socket descriptor.
- * @param sec: Seconds.
- * @param usec: Microseconds.
+ * @name receive_data - Receive data into a vector of buffers.
+ * @param iov: The buffers.
+ * @param iovcnt: The number of buffers.
+ * @param client: The endpoint from which the data will be recceived. By default
+ *                this is NULL and must be used only by the Server side to receive
+ *                data from a client.
  *
- * This function checks whether there is data to the  endpoint ready to
- * be received. It uses select to wait until the socket descriptor has
- * data.
+ * This function receives data into the buffers in order with recvmsg, e.g. a header
+ * and a body, without a copy from one buffer. It works like receive_data: buffered
+ * data are returned first, a blocking endpoint returns what one read brings and a
+ * non-blocking endpoint is drained until the buffers are full, continuing inside a
+ * buffer that was filled in part. The caller's table is not modified. From a UDP
+ * endpoint one datagram is received. A RUDP message, and a datagram that a session
+ * table or a read buffer holds, is received like the data of the other receive_data
+ * and copied across the buffers.
  *
- * @return The number of socket descriptors.
+ * @return Total number of bytes received or -1 on error.
  */
-int32_t Endpoint::receive_timeout(int32_t sock, long sec, long usec) {
-  struct timeval timeout;
-  
-  // Setup timeval variable.
-  timeout.tv_sec = sec;
-  timeout.tv_usec = usec;
-  
-  // Setup fd_set structure.
-  fd_set fds;
-  FD_ZERO(&fds);
-  FD_SET(sock, &fds);
-  
-  return select((sock + 1), &fds, 0, 0, &timeout);
+int32_t Endpoint::receive_data(const struct iovec *iov, const int32_t iovcnt,
+			       Endpoint *client) {
+  Endpoint *target = client ? client : this;
+  struct iovec local[VECTOR_LOCAL], *vec, *cur;
+  struct msghdr msg;
+  size_t len;
+  ssize_t bytes;
+  int32_t i, left, total = 0;
+  char *data;
+
+  if (!iov || iovcnt < 0) {
+    errno = EINVAL;
+    return -1;
+  }
+  memset(&msg, 0, sizeof(msg));
+
+  if (target->protocol() == Endpoint::TCP) {
+    // Return the buffered data first.
+    if (target->m_read_end > target->m_read_start) {
+      for (i = 0; i < iovcnt && target->m_read_end > target->m_read_start; i++) {
+	len = target->m_read_end - target->m_read_start;
+	if (len > iov[i].iov_len)
+	  len = iov[i].iov_len;
+	memcpy(iov[i].iov_base, target->m_read + target->m_read_start, len);
+	target->consume(len);
+	total += len;
+      }
+      return total;
+    }
+    vec = copy_vector(iov, iovcnt, local);
+    if (!vec)
+      return -1;
+    cur = vec;
+    left = iovcnt;
+    while (left > 0) {
+      msg.msg_iov = cur;
+      msg.msg_iovlen = left;
+      bytes = recvmsg(target->sockets()[0], &msg, 0);
+      if (bytes == -1) {
+	if (target->nonblocking() && total > 0 &&
+	    (errno == EAGAIN || errno == EWOULDBLOCK))
+	  break;
+	if (!target->nonblocking() && !fiber_wait(target->sockets()[0], EPOLLIN))
+	  continue;
+	total = -1;
+	break;
+      }
+      if (bytes == 0)
+	break;
+      total += bytes;
+      if (!target->nonblocking())
+	break;
+      left = skip_vector(&cur, left, bytes);
+    }
+    if (vec != local)
+      free(vec);
+    return total;
+  } else if (target->protocol() == Endpoint::RUDP ||
+	     (target->protocol() == Endpoint::UDP &&
+	      (m_sessions || target->m_read_end > target->m_read_start))) {
+    // Messages, and datagrams read already, are received in one buffer.
+    len = vector_length(iov, iovcnt);
+    data = (char *)malloc(len ? len : 1);
+    if (!data) {
+      fprintf(stderr, "(receive_data) Error: No free memory left.\n");
+      return -1;
+    }
+    total = receive_data(data, len, client);
+    if (total > 0)
+      scatter_vector(iov, iovcnt, data, total);
+    free(data);
+    return total;
+  } else if (target->protocol() == Endpoint::UDP) {
+    // Check if there are data to read.
+    switch (receive_timeout(target->sockets()[0], 0, 0)) {
+    case 0:
+      return 0;
+    case -1:
+      return -1;
+    default:
+      msg.msg_iov = (struct iovec *)iov;
+      msg.msg_iovlen = iovcnt;
+      return recvmsg(target->sockets()[0], &msg, 0);
+    }
+  }
+  // Unknown endpoint protocol.
+  errno = EPROTONOSUPPORT;
+  return -1;
 }
 
 /**
- * @name cleanup - Clean enpoint.
+ * @name send_batch - Send a batch of datagrams.
+ * @param dgrams: The datagrams.
+ * @param count: The number of datagrams.
+ * @param client: The endpoint where the datagrams will be sent. By default this is
+ *                NULL and must be used only by the Server side to send data to a client.
  *
- * This closes an open connections and properly cleans the endpoint.
+ * This function sends up to UDP_BATCH datagrams per system call with sendmmsg. Each
+ * datagram goes to its own address, so a batch can reply to many peers; a datagram
+ * with an addr_len of 0 goes to the address of the endpoint. If the endpoint is in
+ * non-blocking mode and the socket buffer fills up, the datagrams sent so far are
+ * counted.
  *
- * @return 0 on success, 1 on error.
+ * @return The number of datagrams sent or -1 on error.
  */
-int32_t Endpoint::cleanup() {
-  int32_t result = 0;
-  
-  // Close sockets of TCP connections.  
-  if (m_protocol == Endpoint::TCP) {
-    if (m_sockets) {
-      for (int32_t i = 0; i < m_sockets_len; i++) { 
+int32_t Endpoint::send_batch(struct datagram *dgrams, const int32_t count, Endpoint *client) {
+  Endpoint *target = client ? client : this;
+  struct mmsghdr msgs[UDP_BATCH];
+  struct iovec iov[UDP_BATCH];
+  int32_t i, n, sent, total = 0;
+
+  if (target->protocol() != Endpoint::UDP || !dgrams || count < 0)
+    return -1;
+  while (total < count) {
+    n = count - total < UDP_BATCH ? count - total : UDP_BATCH;
+    memset(msgs, 0, n * sizeof(struct mmsghdr));
+    for (i = 0; i < n; i++) {
+      iov[i].iov_base = dgrams[total + i].data;
+      iov[i].iov_len = dgrams[total + i].data_len;
+      msgs[i].msg_hdr.msg_iov = &iov[i];
+      msgs[i].msg_hdr.msg_iovlen = 1;
+      if (dgrams[total + i].addr_len) {
+	msgs[i].msg_hdr.msg_name = &dgrams[total + i].addr;
+	msgs[i].msg_hdr.msg_namelen = dgrams[total + i].addr_len;
+      } else if (target->address_info()) {
+	msgs[i].msg_hdr.msg_name = target->address_info()->ai_addr;
+	msgs[i].msg_hdr.msg_namelen = target->address_info()->ai_addrlen;
+      }
+    }
+    sent = sendmmsg(target->sockets()[0], msgs, n, 0);
+    if (sent == -1) {
+      if (target->nonblocking() && total > 0 &&
+	  (errno == EAGAIN || errno == EWOULDBLOCK))
+	break;
+      if (!target->nonblocking() && !fiber_wait(target->sockets()[0], EPOLLOUT))
+	continue;
+      return total ? total : -1;
+    }
+    total += sent;
+  }
+  return total;
+}
+
+/**
+ * @name receive_batch - Receive a batch of datagrams.
+ * @param dgrams: The datagrams. The data and data_len of each give its buffer.
+ * @param count: The number of datagrams.
+ * @param client: The endpoint from which the datagrams will be recceived. By default
+ *                this is NULL and must be used only by the Server side to receive
+ *                data from a client.
+ *
+ * This function receives up to UDP_BATCH datagrams per system call with recvmmsg,
+ * from any peers. It sets the data_len of each datagram received to its length and
+ * its addr to the address of the peer. A blocking endpoint waits for the first
+ * datagram and then takes the ones already queued; a non-blocking endpoint returns
+ * -1 with errno set to EAGAIN if no datagram is queued.
+ *
+ * @return The number of datagrams received or -1 on error.
+ */
+int32_t Endpoint::receive_batch(struct datagram *dgrams, const int32_t count,
+				Endpoint *client) {
+  Endpoint *target = client ? client : this;
+  struct mmsghdr msgs[UDP_BATCH];
+  struct iovec iov[UDP_BATCH];
+  int32_t i, n, received, total = 0;
+
+  if (target->protocol() != Endpoint::UDP || !dgrams || count < 0)
+    return -1;
+  while (total < count) {
+    n = count - total < UDP_BATCH ? count - total : UDP_BATCH;
+    memset(msgs, 0, n * sizeof(struct mmsghdr));
+    for (i = 0; i < n; i++) {
+      iov[i].iov_base = dgrams[total + i].data;
+      iov[i].iov_len = dgrams[total + i].data_len;
+      msgs[i].msg_hdr.msg_iov = &iov[i];
+      msgs[i].msg_hdr.msg_iovlen = 1;
+      msgs[i].msg_hdr.msg_name = &dgrams[total + i].addr;
+      msgs[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_storage);
+    }
+    // Only the first call of a batch waits.
+    received = recvmmsg(target->sockets()[0], msgs, n, total ? MSG_DONTWAIT : MSG_WAITFORONE,
+			NULL);
+    if (received == -1) {
+      if (total > 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+	break;
+      if (!target->nonblocking() && !fiber_wait(target->sockets()[0], EPOLLIN))
+	continue;
+      return total ? total : -1;
+    }
+    for (i = 0; i < received; i++) {
+      dgrams[total + i].data_len = msgs[i].msg_len;
+      dgrams[total + i].addr_len = msgs[i].msg_hdr.msg_namelen;
+    }
+    total += received;
+    if (received < n)
+      break;
+  }
+  return total;
+}
+
+/**
+ * @name set_receive_offload - Set UDP receive offload.
+ * @param on: True to receive coalesced datagrams.
+ *
+ * This function sets UDP_GRO on the sockets of a UDP endpoint. The kernel then
+ * coalesces the datagrams of a peer that arrive together, and of the same size
+ * except the last, into one buffer, which receive_segments splits again. Use
+ * receive_segments, with a buffer of GRO_BUFFER_SIZE bytes, while it is on.
+ *
+ * @return 0: success, 1: error.
+ */
+int32_t Endpoint::set_receive_offload(const bool on) {
+  int32_t i, value = on ? 1 : 0;
+
+  if (m_protocol != Endpoint::UDP || !m_sockets)
+    return 1;
+  for (i = 0; i < m_sockets_len; i++) {
+    if (setsockopt(m_sockets[i], SOL_UDP, UDP_GRO, &value, sizeof(value)) < 0) {
+      fprintf(stderr, "(set_receive_offload) Error: UDP_GRO is not supported.\n");
+      return 1;
+    }
+  }
+  return 0;
+}
+
+/**
+ * @name path_mtu - Get the path MTU payload.
+ * @param info: The address of the peer.
+ *
+ * This function connects a temporary UDP socket to the peer and asks the kernel
+ * for the MTU of the path, which it knows from the route and the ICMP messages
+ * received so far.
+ *
+ * @return The largest UDP payload that fits in a packet or 0 on error.
+ */
+static size_t path_mtu(const struct addrinfo *info) {
+  int32_t sock, mtu = 0;
+  socklen_t len = sizeof(mtu);
+  size_t size = 0;
+
+  if (!info)
+    return 0;
+  sock = socket(info->ai_family, SOCK_DGRAM, 0);
+  if (sock < 0)
+    return 0;
+  if (connect(sock, info->ai_addr, info->ai_addrlen) == 0) {
+    if (info->ai_family == AF_INET6) {
+      if (getsockopt(sock, IPPROTO_IPV6, IPV6_MTU, &mtu, &len) == 0 && mtu > 48)
+	size = mtu - 48;
+    } else if (getsockopt(sock, IPPROTO_IP, IP_MTU, &mtu, &len) == 0 && mtu > 28) {
+      size = mtu - 28;
+    }
+  }
+  close(sock);
+  return size > UDP_PAYLOAD_MAX ? UDP_PAYLOAD_MAX : size;
+}
+
+/**
+ * @name set_path_mtu_discovery - Set path MTU discovery.
+ * @param on: True to size the packets after the path MTU.
+ *
+ * This function forbids the fragmentation of the packets of a UDP endpoint, so
+ * that the routers report the MTU of the path, and sets the packet size to the
+ * MTU that the kernel knows for the address of the endpoint. A send that fails
+ * with EMSGSIZE afterwards makes the endpoint ask the kernel again and send with
+ * the smaller size. Use it on the endpoint whose address is the peer, i.e. a
+ * UDP client, or a client returned by Server::get_client, which shares the
+ * socket of the server. Turning it off lets the kernel fragment the packets
+ * again and restores UDPPACKETSIZE.
+ *
+ * @return 0: success, 1: error.
+ */
+int32_t Endpoint::set_path_mtu_discovery(const bool on) {
+  int32_t i, domain, level, option, value;
+  socklen_t len = sizeof(domain);
+  size_t size;
+
+  if (m_protocol != Endpoint::UDP || !m_sockets)
+    return 1;
+  for (i = 0; i < m_sockets_len; i++) {
+    if (getsockopt(m_sockets[i], SOL_SOCKET, SO_DOMAIN, &domain, &len) < 0)
+      return 1;
+    if (domain == AF_INET6) {
+      level = IPPROTO_IPV6;
+      option = IPV6_MTU_DISCOVER;
+      value = on ? IPV6_PMTUDISC_DO : IPV6_PMTUDISC_WANT;
+    } else {
+      level = IPPROTO_IP;
+      option = IP_MTU_DISCOVER;
+      value = on ? IP_PMTUDISC_DO : IP_PMTUDISC_WANT;
+    }
+    if (setsockopt(m_sockets[i], level, option, &value, sizeof(value)) < 0) {
+      fprintf(stderr, "(set_path_mtu_discovery) Error: Can not set path MTU discovery.\n");
+      return 1;
+    }
+  }
+  m_mtu_discovery = on;
+  if (!on) {
+    m_packet_size = UDPPACKETSIZE;
+    return 0;
+  }
+  size = path_mtu(m_address_info);
+  if (size)
+    m_packet_size = size;
+  return 0;
+}
+
+/**
+ * @name set_packet_size - Set the packet size.
+ * @param size: The largest UDP payload to send in a packet.
+ *
+ * Use this method to override the size of the packets that send_data splits
+ * UDP data into. The default is UDPPACKETSIZE. Path MTU discovery may shrink
+ * it later.
+ *
+ * @return 0: success, 1: error.
+ */
+int32_t Endpoint::set_packet_size(const size_t size) {
+  if (!size || size > UDP_PAYLOAD_MAX)
+    return 1;
+  m_packet_size = size;
+  return 0;
+}
+
+/**
+ * @name packet_size - Get the packet size.
+ *
+ * @return The largest UDP payload that the endpoint sends in a packet.
+ */
+size_t Endpoint::packet_size() {
+  return m_packet_size;
+}
+
+/**
+ * @name probe_packet_size - Shrink the packet size.
+ *
+ * This function asks the kernel again for the path MTU after a send failed
+ * with EMSGSIZE, and uses it if it is smaller than the packet size.
+ *
+ * @return 0 if the packet size shrank, 1 otherwise.
+ */
+int32_t Endpoint::probe_packet_size() {
+  size_t size;
+
+  if (!m_mtu_discovery)
+    return 1;
+  size = path_mtu(m_address_info);
+  if (!size || size >= m_packet_size)
+    return 1;
+  m_packet_size = size;
+  return 0;
+}
+
+/**
+ * @name receive_segments - Receive coalesced datagrams.
+ * @param data: Pointer to the data buffer.
+ * @param data_len: Size of the data buffer. GRO_BUFFER_SIZE holds any coalesced buffer.
+ * @param segs: Set to the received datagrams.
+ * @param client: The endpoint from which the data will be recceived. By default
+ *                this is NULL and must be used only by the Server side to receive
+ *                data from a client.
+ *
+ * This function receives a buffer of datagrams, coalesced by the kernel in receive
+ * offload mode, from one peer with one recvmsg. The size of the datagrams comes from
+ * the UDP_GRO control message; a datagram that was not coalesced is a single
+ * segment. A blocking endpoint waits for data; a non-blocking endpoint returns -1
+ * with errno set to EAGAIN if none is queued. For example:
+ * ------------------------------------
+ * while (server->receive_segments(buf, GRO_BUFFER_SIZE, &segs) > 0)
+ *   while ((len = Endpoint::next_segment(&segs, &datagram)) > 0)
+ *     ...
+ * ------------------------------------
+ *
+ * @return Total number of bytes received or -1 on error.
+ */
+int32_t Endpoint::receive_segments(void *data, const size_t data_len, struct segments *segs,
+				   Endpoint *client) {
+  Endpoint *target = client ? client : this;
+  char control[CMSG_SPACE(sizeof(int32_t))];
+  struct cmsghdr *cmsg;
+  struct msghdr msg;
+  struct iovec iov;
+  int32_t bytes;
+
+  if (target->protocol() != Endpoint::UDP || !segs)
+    return -1;
+  iov.iov_base = data;
+  iov.iov_len = data_len;
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_name = &segs->addr;
+  msg.msg_namelen = sizeof(segs->addr);
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control;
+  msg.msg_controllen = sizeof(control);
+  do {
+    bytes = recvmsg(target->sockets()[0], &msg, 0);
+  } while (bytes == -1 && !target->nonblocking() &&
+	   !fiber_wait(target->sockets()[0], EPOLLIN));
+  if (bytes < 0)
+    return -1;
+
+  segs->data = (char *)data;
+  segs->data_len = bytes;
+  segs->segment_size = bytes;
+  segs->offset = 0;
+  segs->addr_len = msg.msg_namelen;
+  for (cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+    if (cmsg->cmsg_level == SOL_UDP && cmsg->cmsg_type == UDP_GRO)
+      segs->segment_size = *(int32_t *)CMSG_DATA(cmsg);
+  }
+  if (!segs->segment_size)
+    segs->segment_size = 1;
+  return bytes;
+}
+
+/**
+ * @name next_segment - Get the next datagram.
+ * @param segs: The datagrams returned by receive_segments.
+ * @param segment: Set to the next datagram.
+ *
+ * This function iterates over the datagrams of a coalesced buffer, in the order
+ * they were received.
+ *
+ * @return The size of the datagram or 0 if there are no more.
+ */
+int32_t Endpoint::next_segment(struct segments *segs, const void **segment) {
+  size_t len;
+
+  if (!segs || segs->offset >= segs->data_len)
+    return 0;
+  len = segs->data_len - segs->offset;
+  if (len > segs->segment_size)
+    len = segs->segment_size;
+  if (segment)
+    *segment = segs->data + segs->offset;
+  segs->offset += len;
+  return len;
+}
+
+/**
+ * @name set_read_buffer - Set the read buffer.
+ * @param size: The size of the buffer in bytes, 0 to remove it.
+ *
+ * This function gives a TCP endpoint a read buffer. fill reads from the socket
+ * into the buffer in large chunks, and a parser can look at the buffered bytes
+ * with peek and read_until and drop them with consume, without a system call or
+ * a copy per message. receive_data returns the buffered bytes first. A size of
+ * READ_BUFFER_SIZE suits most protocols; a message must fit in the buffer.
+ *
+ * @return 0: success, 1: error.
+ */
+int32_t Endpoint::set_read_buffer(const size_t size) {
+  char *buffer;
+
+  if (size < m_read_end - m_read_start) {
+    fprintf(stderr, "(set_read_buffer) Error: The buffered data do not fit.\n");
+    return 1;
+  }
+  if (!size) {
+    if (m_read)
+      free(m_read);
+    m_read = NULL;
+    m_read_size = m_read_start = m_read_end = 0;
+    return 0;
+  }
+
+  // Keep the buffered data at the front of the new buffer.
+  if (m_read_start) {
+    memmove(m_read, m_read + m_read_start, m_read_end - m_read_start);
+    m_read_end -= m_read_start;
+    m_read_start = 0;
+  }
+  buffer = (char *)realloc(m_read, size);
+  if (!buffer) {
+    fprintf(stderr, "(set_read_buffer) Error: No free memory left.\n");
+    return 1;
+  }
+  m_read = buffer;
+  m_read_size = size;
+  return 0;
+}
+
+/**
+ * @name set_message_max - Set the maximum message size.
+ * @param size: The size in bytes.
+ *
+ * This function sets the size of the largest message that receive_message takes.
+ * A larger message fails with EMSGSIZE before any memory is allocated for it, and
+ * the endpoint should then be detached, since the message stays unread. The
+ * default is MESSAGE_MAX. The server side uses the size of the server for all its
+ * clients.
+ *
+ * @return Void.
+ */
+void Endpoint::set_message_max(const size_t size) {
+  m_message_max = size;
+}
+
+/**
+ * @name buffered - Get the number of buffered bytes.
+ *
+ * This function returns the number of bytes in the read buffer.
+ *
+ * @return The number of buffered bytes.
+ */
+size_t Endpoint::buffered() {
+  return m_read_end - m_read_start;
+}
+
+/**
+ * @name fill - Fill the read buffer.
+ *
+ * This function moves the buffered bytes to the front of the read buffer and
+ * reads from the socket into the free space after them. A blocking endpoint
+ * calls recv once; a non-blocking one reads until recv fails with EAGAIN or the
+ * buffer is full. The pointers returned by peek and read_until are no longer
+ * valid afterwards.
+ *
+ * @return The number of bytes read, 0 on end of stream or -1 on error. errno is
+ *         ENOBUFS if the buffer is full.
+ */
+int32_t Endpoint::fill() {
+  size_t total = 0;
+  ssize_t bytes;
+
+  if (!m_read || m_protocol != Endpoint::TCP || !m_sockets)
+    return -1;
+  if (m_read_start) {
+    memmove(m_read, m_read + m_read_start, m_read_end - m_read_start);
+    m_read_end -= m_read_start;
+    m_read_start = 0;
+  }
+  if (m_read_end == m_read_size) {
+    errno = ENOBUFS;
+    return -1;
+  }
+
+  while (m_read_end < m_read_size) {
+    bytes = recv(m_sockets[0], m_read + m_read_end, m_read_size - m_read_end, 0);
+    if (bytes == -1) {
+      if (m_nonblocking && total > 0 &&
+	  (errno == EAGAIN || errno == EWOULDBLOCK))
+	break;
+      if (!m_nonblocking && !fiber_wait(m_sockets[0], EPOLLIN))
+	continue;
+      return -1;
+    }
+    if (bytes == 0)
+      break;
+    m_read_end += bytes;
+    total += bytes;
+    if (!m_nonblocking)
+      break;
+  }
+  return total;
+}
+
+/**
+ * @name peek - Look at the buffered bytes.
+ * @param data: Set to the first buffered byte.
+ *
+ * This function returns the bytes of the read buffer without consuming them.
+ *
+ * @return The number of buffered bytes.
+ */
+int32_t Endpoint::peek(const void **data) {
+  if (data)
+    *data = m_read + m_read_start;
+  return m_read_end - m_read_start;
+}
+
+/**
+ * @name consume - Drop buffered bytes.
+ * @param data_len: The number of bytes to drop.
+ *
+ * This function removes bytes from the front of the read buffer.
+ *
+ * @return 0: success, 1: error.
+ */
+int32_t Endpoint::consume(const size_t data_len) {
+  if (data_len > m_read_end - m_read_start)
+    return 1;
+  m_read_start += data_len;
+  if (m_read_start == m_read_end)
+    m_read_start = m_read_end = 0;
+  return 0;
+}
+
+/**
+ * @name read_until - Read up to a delimiter.
+ * @param delim: The delimiter.
+ * @param delim_len: The size of the delimiter.
+ * @param data: Set to the first byte of the message.
+ *
+ * This function fills the read buffer until it holds the delimiter and consumes
+ * the bytes up to and including the delimiter. The message is not copied; it
+ * stays valid until the next call that reads from the socket.
+ *
+ * @return The size of the message including the delimiter, 0 on end of stream
+ *         or -1 on error. errno is ENOBUFS if the message does not fit.
+ */
+int32_t Endpoint::read_until(const void *delim, const size_t delim_len, const void **data) {
+  size_t scanned = 0, len;
+  char *found;
+  int32_t bytes;
+
+  if (!delim || !delim_len || !data || !m_read)
+    return -1;
+  while (1) {
+    found = (char *)memmem(m_read + m_read_start + scanned,
+			   m_read_end - m_read_start - scanned, delim, delim_len);
+    if (found) {
+      len = found - (m_read + m_read_start) + delim_len;
+      *data = m_read + m_read_start;
+      consume(len);
+      return len;
+    }
+
+    // Do not scan the same bytes again.
+    if (m_read_end - m_read_start >= delim_len)
+      scanned = m_read_end - m_read_start - delim_len + 1;
+    bytes = fill();
+    if (bytes <= 0)
+      return bytes;
+  }
+}
+
+/**
+ * @name send_file - Send a file.
+ * @param fd: The file descriptor.
+ * @param offset: The file offset to send from. It is advanced by the bytes sent.
+ * @param length: The number of bytes to send.
+ * @param client: The endpoint where the file will be sent. By default this is NULL
+ *                and must be used only by the Server side to send data to a client.
+ *
+ * This function sends a part of a file. To a TCP endpoint the kernel sends the file
+ * with sendfile, without copying it to user memory; to a UDP endpoint, or if the
+ * file does not support sendfile, the file is read and sent with send_data. The
+ * transfer stops early at the end of the file, and also if the endpoint is in
+ * non-blocking mode and the socket buffer fills up; the offset then shows the
+ * progress and the call can be repeated to send the rest.
+ *
+ * @return Total number of bytes sent or -1 on error.
+ */
+int64_t Endpoint::send_file(const int32_t fd, off_t *offset, const size_t length,
+			    Endpoint *client) {
+  Endpoint *target = client ? client : this;
+  char data[UDPPACKETSIZE];
+  size_t total = 0;
+  ssize_t bytes, sent;
+  bool copy;
+
+  if (!offset)
+    return -1;
+  copy = target->protocol() != Endpoint::TCP;
+
+  // Keep the gathered data in front of the file.
+  if (!copy && target->m_gather_len && target->flush() < 0)
+    return -1;
+
+  while (total < length) {
+    if (copy) {
+      bytes = pread(fd, data, length - total < sizeof(data) ? length - total : sizeof(data),
+		    *offset);
+      if (bytes <= 0)
+	return bytes < 0 && !total ? -1 : total;
+      sent = send_data(data, bytes, target);
+      if (sent <= 0)
+	return total ? total : -1;
+      *offset += sent;
+      total += sent;
+      if (sent < bytes)
+	break;
+      continue;
+    }
+    bytes = sendfile(target->sockets()[0], fd, offset, length - total);
+    if (bytes == 0)
+      break;
+    if (bytes == -1) {
+      if ((errno == EINVAL || errno == ENOSYS) && !total) {
+	copy = true;
+	continue;
+      }
+      if (target->nonblocking() && total > 0 &&
+	  (errno == EAGAIN || errno == EWOULDBLOCK))
+	break;
+      if (!target->nonblocking() && !fiber_wait(target->sockets()[0], EPOLLOUT))
+	continue;
+      return -1;
+    }
+    total += bytes;
+  }
+  return total;
+}
+
+/**
+ * @name send_message - Send a message.
+ * @param data: Pointer to the message.
+ * @param data_len: Size of the message.
+ * @param client: The endpoint where the message will be sent. By default this is NULL
+ *                and must be used only by the Server side to send data to a client.
+ *
+ * This function sends a message over a TCP endpoint, with a header that holds its
+ * length in 7-bit groups, at most MESSAGE_HEADER_MAX bytes, so that receive_message
+ * can tell where it ends. The header and the message go out with one system call. If
+ * the endpoint is in non-blocking mode, the part of the message that the socket can
+ * not take, or the whole message if the socket buffer is full, is gathered and sent
+ * by flush.
+ *
+ * @return The size of the message or -1 on error.
+ */
+int32_t Endpoint::send_message(const void *data, const size_t data_len, Endpoint *client) {
+  Endpoint *target = client ? client : this;
+  unsigned char header[MESSAGE_HEADER_MAX];
+  struct iovec iov[2], *vec = iov;
+  size_t len = data_len;
+  int32_t i, left, header_len = 0;
+  ssize_t bytes;
+
+  if (target->protocol() != Endpoint::TCP || data_len > INT32_MAX)
+    return -1;
+  do {
+    header[header_len++] = (len & 0x7f) | (len > 0x7f ? 0x80 : 0);
+    len >>= 7;
+  } while (len);
+  iov[0].iov_base = header;
+  iov[0].iov_len = header_len;
+  iov[1].iov_base = (void *)data;
+  iov[1].iov_len = data_len;
+
+  // Keep the message behind the data that are still gathered.
+  if (!target->m_gather_on && target->m_gather_len && target->flush() < 0 &&
+      errno != EAGAIN && errno != EWOULDBLOCK)
+    return -1;
+  if (target->m_gather_len) {
+    bytes = 0;
+  } else if ((bytes = send_data(iov, 2, target)) < 0) {
+    if (!target->nonblocking() || (errno != EAGAIN && errno != EWOULDBLOCK))
+      return -1;
+    bytes = 0;
+  }
+  left = skip_vector(&vec, 2, bytes);
+  for (i = 0; i < left; i++)
+    if (target->gather_data(vec[i].iov_base, vec[i].iov_len) < 0)
+      return -1;
+  return data_len;
+}
+
+/**
+ * @name grow_message - Grow a message buffer.
+ * @param data: Pointer to the buffer.
+ * @param data_size: Pointer to the size of the buffer.
+ * @param need: The number of bytes that the buffer must hold.
+ * @param len: The size of the message.
+ *
+ * This function doubles the buffer until it holds need bytes, up to the size of
+ * the message, so that the memory grows with the bytes that have arrived rather
+ * than with the length that the peer claims.
+ *
+ * @return 0: success, 1: error.
+ */
+static int32_t grow_message(char **data, size_t *data_size, const size_t need,
+			    const size_t len) {
+  size_t size;
+  char *buffer;
+
+  if (*data && *data_size >= need)
+    return 0;
+  size = *data ? *data_size : 0;
+  if (size < READ_BUFFER_SIZE)
+    size = READ_BUFFER_SIZE;
+  while (size < need)
+    size *= 2;
+  if (size > len)
+    size = len;
+  if (size < need)
+    size = need;
+  buffer = (char *)realloc(*data, size ? size : 1);
+  if (!buffer) {
+    fprintf(stderr, "(receive_message) Error: No free memory left.\n");
+    return 1;
+  }
+  *data = buffer;
+  *data_size = size ? size : 1;
+  return 0;
+}
+
+/**
+ * @name receive_message - Receive a message.
+ * @param data: Pointer to a buffer allocated with malloc, or to NULL. The buffer is
+ *              reallocated if the message does not fit.
+ * @param data_size: Pointer to the size of the buffer. It is updated if the buffer
+ *                   is reallocated.
+ * @param client: The endpoint from which the message will be recceived. By default
+ *                this is NULL and must be used only by the Server side to receive
+ *                data from a client.
+ *
+ * This function receives one message sent with send_message. The endpoint gets a
+ * read buffer of READ_BUFFER_SIZE bytes if it has none, so the header and small
+ * messages come with one recv together with the messages that follow. A blocking
+ * endpoint receives the rest of a large message directly into the caller's buffer.
+ * A non-blocking endpoint returns a message only when it is complete; otherwise it
+ * keeps the bytes read so far in the read buffer and returns -1 with errno set to
+ * EAGAIN. Both buffers grow as the message arrives, and a message larger than the
+ * size set with set_message_max fails with EMSGSIZE.
+ *
+ * @return The size of the message, or -1 on error or end of stream, when errno is 0.
+ */
+int32_t Endpoint::receive_message(char **data, size_t *data_size, Endpoint *client) {
+  Endpoint *target = client ? client : this;
+  const unsigned char *header;
+  size_t i, have, header_len, len, total, size;
+  uint64_t message_len;
+  ssize_t bytes;
+
+  if (target->protocol() != Endpoint::TCP || !data || !data_size)
+    return -1;
+  if (!target->m_read && target->set_read_buffer(READ_BUFFER_SIZE))
+    return -1;
+
+  // Decode the header.
+  while (1) {
+    header = (const unsigned char *)target->m_read + target->m_read_start;
+    have = target->m_read_end - target->m_read_start;
+    message_len = header_len = 0;
+    for (i = 0; i < have && i < MESSAGE_HEADER_MAX; i++) {
+      message_len |= (uint64_t)(header[i] & 0x7f) << (7 * i);
+      if (!(header[i] & 0x80)) {
+	header_len = i + 1;
+	break;
+      }
+    }
+    if (header_len)
+      break;
+    if (i == MESSAGE_HEADER_MAX) {
+      errno = EPROTO;
+      return -1;
+    }
+    if ((bytes = target->fill()) <= 0) {
+      if (!bytes)
+	errno = 0;
+      return -1;
+    }
+  }
+  if (message_len > INT32_MAX || message_len > m_message_max) {
+    errno = EMSGSIZE;
+    return -1;
+  }
+  len = message_len;
+
+  // A non-blocking endpoint buffers the whole message first.
+  if (target->nonblocking()) {
+    while (target->m_read_end - target->m_read_start < header_len + len) {
+      if (target->m_read_end - target->m_read_start == target->m_read_size) {
+	size = target->m_read_size * 2;
+	if (size > header_len + len)
+	  size = header_len + len;
+	if (target->set_read_buffer(size))
+	  return -1;
+      }
+      if ((bytes = target->fill()) <= 0) {
+	if (!bytes)
+	  errno = 0;
+	return -1;
+      }
+    }
+  }
+
+  target->consume(header_len);
+  total = target->m_read_end - target->m_read_start;
+  if (total > len)
+    total = len;
+  if (grow_message(data, data_size, target->nonblocking() ? len : total, len))
+    return -1;
+  memcpy(*data, target->m_read + target->m_read_start, total);
+  target->consume(total);
+  while (total < len) {
+    if (grow_message(data, data_size, total + 1, len))
+      return -1;
+    size = (*data_size < len ? *data_size : len) - total;
+    bytes = recv(target->sockets()[0], *data + total, size, MSG_WAITALL);
+    if (bytes == -1) {
+      if (errno == EINTR || !fiber_wait(target->sockets()[0], EPOLLIN))
+	continue;
+      return -1;
+    }
+    if (bytes == 0) {
+      errno = EPIPE;
+      return -1;
+    }
+    total += bytes;
+  }
+  return len;
+}
+
+/**
+ * @name set_zerocopy - Set the zero-copy transmit mode.
+ * @param on: True to send large buffers without copying them.
+ *
+ * This function sets SO_ZEROCOPY on a connected TCP socket. In zero-copy mode
+ * send_zerocopy sends the buffers of at least ZEROCOPY_THRESHOLD bytes with
+ * MSG_ZEROCOPY, so the kernel transmits them from the caller's memory.
+ *
+ * @return 0: success, 1: error.
+ */
+int32_t Endpoint::set_zerocopy(const bool on) {
+  int32_t value = on ? 1 : 0;
+
+  if (m_protocol != Endpoint::TCP || !m_sockets || m_sockets[0] < 0)
+    return 1;
+  if (on && !m_zerocopy) {
+    m_zerocopy = (struct zerocopy *)malloc(sizeof(struct zerocopy));
+    if (!m_zerocopy) {
+      fprintf(stderr, "(set_zerocopy) Error: No free memory left.\n");
+      return 1;
+    }
+    memset(m_zerocopy, 0, sizeof(struct zerocopy));
+  }
+  if (setsockopt(m_sockets[0], SOL_SOCKET, SO_ZEROCOPY, &value, sizeof(value)) < 0) {
+    fprintf(stderr, "(set_zerocopy) Error: SO_ZEROCOPY is not supported.\n");
+    return 1;
+  }
+  if (m_zerocopy)
+    m_zerocopy->enabled = on;
+  return 0;
+}
+
+/**
+ * @name zerocopy - Check the zero-copy transmit mode.
+ *
+ * This function returns true if large buffers are sent without being copied.
+ * It becomes false if the kernel reports that it had to copy the data anyway,
+ * e.g. on the loopback interface.
+ *
+ * @return The zero-copy mode.
+ */
+bool Endpoint::zerocopy() {
+  return m_zerocopy && m_zerocopy->enabled && !m_zerocopy->copied;
+}
+
+/**
+ * @name send_zerocopy - Send data without copying them.
+ * @param data: Pointer to the data buffer.
+ * @param data_len: Size of the data buffer.
+ * @param ticket: Set to the ticket of the buffer.
+ * @param client: The endpoint where the data will be sent. By default this is NULL
+ *                and must be used only by the Server side to send data to a client.
+ *
+ * This function sends data like send_data, but in zero-copy mode the kernel reads
+ * a buffer of at least ZEROCOPY_THRESHOLD bytes from the caller's memory after the
+ * call returns. The buffer must not be modified or freed until zerocopy_done
+ * returns true for its ticket. Smaller buffers, and all the buffers once the kernel
+ * reports that it copies the data, are copied as by send_data.
+ *
+ * @return Total number of bytes sent or -1 on error.
+ */
+int32_t Endpoint::send_zerocopy(const void *data, const size_t data_len, uint32_t *ticket,
+				Endpoint *client) {
+  Endpoint *target = client ? client : this;
+  struct zerocopy *z = target->m_zerocopy;
+  int32_t flags = MSG_ZEROCOPY;
+  size_t total = 0;
+  ssize_t bytes;
+
+  if (ticket)
+    *ticket = z ? z->done : 0;
+  if (target->protocol() != Endpoint::TCP || !target->zerocopy() ||
+      data_len < ZEROCOPY_THRESHOLD)
+    return send_data(data, data_len, target);
+
+  // Keep the gathered data in front of the buffer.
+  if (target->m_gather_len && target->flush() < 0)
+    return -1;
+
+  while (total < data_len) {
+    bytes = send(target->sockets()[0], (const char *)data + total, data_len - total, flags);
+    if (bytes == -1) {
+      // Out of socket option memory for the notifications; copy the rest.
+      if (errno == ENOBUFS && flags) {
+	flags = 0;
+	continue;
+      }
+      if (target->nonblocking() && total > 0 &&
+	  (errno == EAGAIN || errno == EWOULDBLOCK))
+	break;
+      if (!target->nonblocking() && !fiber_wait(target->sockets()[0], EPOLLOUT))
+	continue;
+      return -1;
+    }
+    if (flags)
+      z->issued++;
+    total += bytes;
+  }
+  if (ticket)
+    *ticket = z->issued;
+  return total;
+}
+
+/**
+ * @name reap_zerocopy - Read the zero-copy completions.
+ * @param client: The endpoint whose completions will be read. By default this is
+ *                NULL and must be used only by the Server side for a client.
+ *
+ * This function reads the completion notifications of the zero-copy sends from
+ * the error queue of the socket without blocking. The error queue is readable
+ * when the socket reports EPOLLERR.
+ *
+ * @return The number of completed sends or -1 on error.
+ */
+int32_t Endpoint::reap_zerocopy(Endpoint *client) {
+  Endpoint *target = client ? client : this;
+  struct zerocopy *z = target->m_zerocopy;
+  struct sock_extended_err *serr;
+  struct cmsghdr *cmsg;
+  struct msghdr msg;
+  char control[128];
+  uint32_t *ranges;
+  int32_t i, completed = 0;
+
+  if (!z || !target->sockets())
+    return 0;
+  while (1) {
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    if (recvmsg(target->sockets()[0], &msg, MSG_ERRQUEUE | MSG_DONTWAIT) < 0) {
+      if (errno == EAGAIN || errno == EWOULDBLOCK)
+	break;
+      return -1;
+    }
+    for (cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+      if (!((cmsg->cmsg_level == SOL_IP && cmsg->cmsg_type == IP_RECVERR) ||
+	    (cmsg->cmsg_level == SOL_IPV6 && cmsg->cmsg_type == IPV6_RECVERR)))
+	continue;
+      serr = (struct sock_extended_err *)CMSG_DATA(cmsg);
+      if (serr->ee_origin != SO_EE_ORIGIN_ZEROCOPY || serr->ee_errno)
+	continue;
+
+      // Fall back to copying if the kernel copies anyway.
+      if (serr->ee_code & SO_EE_CODE_ZEROCOPY_COPIED)
+	z->copied = true;
+      completed += serr->ee_data - serr->ee_info + 1;
+
+      // Sends ee_info to ee_data are done; keep the range if it is early.
+      if (serr->ee_info != z->done) {
+	if (z->ranges_len == z->ranges_size) {
+	  z->ranges_size = z->ranges_size ? z->ranges_size * 2 : 8;
+	  ranges = (uint32_t *)realloc(z->ranges, 2 * z->ranges_size * sizeof(uint32_t));
+	  if (!ranges)
+	    return -1;
+	  z->ranges = ranges;
+	}
+	z->ranges[2 * z->ranges_len] = serr->ee_info;
+	z->ranges[2 * z->ranges_len + 1] = serr->ee_data;
+	z->ranges_len++;
+	continue;
+      }
+      z->done = serr->ee_data + 1;
+      for (i = 0; i < z->ranges_len; i++) {
+	if (z->ranges[2 * i] != z->done)
+	  continue;
+	z->done = z->ranges[2 * i + 1] + 1;
+	z->ranges_len--;
+	z->ranges[2 * i] = z->ranges[2 * z->ranges_len];
+	z->ranges[2 * i + 1] = z->ranges[2 * z->ranges_len + 1];
+	i = -1;
+      }
+    }
+  }
+  return completed;
+}
+
+/**
+ * @name zerocopy_done - Check if a buffer can be reused.
+ * @param ticket: The ticket returned by send_zerocopy.
+ * @param client: The endpoint where the buffer was sent. By default this is NULL
+ *                and must be used only by the Server side for a client.
+ *
+ * This function reads the pending completions and checks if the kernel has
+ * released the buffer of a ticket, and every buffer sent before it.
+ *
+ * @return True if the buffer can be modified or freed.
+ */
+bool Endpoint::zerocopy_done(const uint32_t ticket, Endpoint *client) {
+  Endpoint *target = client ? client : this;
+  struct zerocopy *z = target->m_zerocopy;
+
+  if (!z || (int32_t)(ticket - z->done) <= 0)
+    return true;
+  reap_zerocopy(target);
+  return (int32_t)(ticket - z->done) <= 0;
+}
+
+/**
+ * @name rudp - Get the RUDP state.
+ *
+ * This function returns the RUDP protocol state of the socket of the endpoint,
+ * which belongs to the server for the clients that get_client returns, so that
+ * they do not read the packets of the other clients. The state is created on
+ * first use.
+ *
+ * @return The protocol state.
+ */
+Rudp *Endpoint::rudp() {
+  Endpoint *owner = m_owner ? m_owner : this;
+
+  if (!owner->m_rudp)
+    owner->m_rudp = new Rudp;
+  return owner->m_rudp;
+}
+
+/**
+ * @name free_zerocopy - Free the zero-copy state.
+ *
+ * This function releases the zero-copy transmit state of the endpoint.
+ *
+ * @return Void.
+ */
+void Endpoint::free_zerocopy() {
+  if (m_zerocopy) {
+    if (m_zerocopy->ranges)
+      free(m_zerocopy->ranges);
+    free(m_zerocopy);
+  }
+  m_zerocopy = NULL;
+}
+
+/**
+ * @name receive_timeout - Timeout receive.
+ * @param sock: Socket descriptor.
+ * @param sec: Seconds.
+ * @param usec: Microseconds.
+ *
+ * This function checks whether there is data to the  endpoint ready to
+ * be received. It uses select to wait until the socket descriptor has
+ * data.
+ *
+ * @return The number of socket descriptors.
+ */
+int32_t Endpoint::receive_timeout(int32_t sock, long sec, long usec) {
+  struct timeval timeout;
+  
+  // Setup timeval variable.
+  timeout.tv_sec = sec;
+  timeout.tv_usec = usec;
+  
+  // Setup fd_set structure.
+  fd_set fds;
+  FD_ZERO(&fds);
+  FD_SET(sock, &fds);
+  
+  return select((sock + 1), &fds, 0, 0, &timeout);
+}
+
+/**
+ * @name cleanup - Clean enpoint.
+ *
+ * This closes an open connections and properly cleans the endpoint.
+ *
+ * @return 0 on success, 1 on error.
+ */
+int32_t Endpoint::cleanup() {
+  int32_t result = 0;
+  
+  // Close sockets of TCP connections and of connected UDP peers.
+  if (m_protocol == Endpoint::TCP || m_peer_socket) {
+    if (m_sockets) {
+      for (int32_t i = 0; i < m_sockets_len; i++) { 
 	if (m_sockets[i] >= 0)
 	  result = close(m_sockets[i]);
 	
@@ -351,16 +2123,52 @@ int32_t Endpoint::cleanup() {
       }
     }
   }  
-  if (m_address_info)
-    freeaddrinfo(m_address_info);
-  
-  m_address_info = NULL;
+  free_address_info();
+  m_peer_socket = false;
+  m_owner = NULL;
+
+  // Drop the data that were not flushed or consumed.
+  m_gather_len = 0;
+  m_read_start = m_read_end = 0;
+
+  //
+  // The kernel keeps the pages of the pending zero-copy sends, so their
+  // buffers can be freed once the socket is closed.
+  //
+  free_zerocopy();
+
+  // Drop the messages that were not delivered.
+  if (m_rudp)
+    delete m_rudp;
+  m_rudp = NULL;
+  if (m_sessions)
+    delete m_sessions;
+  m_sessions = NULL;
   if (result < 0)
     return 1;
   else
     return 0;
 }
 
+/**
+ * @name free_address_info - Free the address information.
+ *
+ * This function releases the address information of the endpoint. A record
+ * of the connection record pool is given back to the pool.
+ *
+ * @return Void.
+ */
+void Endpoint::free_address_info() {
+  if (m_address_info) {
+    if (m_address_pooled)
+      RecordPool::release(RecordPool::from_info(m_address_info));
+    else
+      freeaddrinfo(m_address_info);
+  }
+  m_address_info = NULL;
+  m_address_pooled = false;
+}
+
 /**
  * @name set_canon_null - Set canonname to NULL
  * @param head: An addrinfo node.
@@ -416,8 +2224,8 @@ Client::Client() {
   m_protocol = Endpoint::TCP;        // TCP is the default.
   m_type = Endpoint::ClientEndpoint;
 
-  // Allocate memory for the socket descriptor. 
-  m_sockets = (int32_t *) malloc(sizeof(int32_t));
+  // The socket descriptor is kept in the object.
+  m_sockets = &m_socket;
   m_sockets[0] = UNUSED;
   m_sockets_len = 1;
   m_address_info = NULL;
@@ -432,8 +2240,8 @@ Client::Client(const Endpoint::Protocol proto) {
   m_protocol = proto;
   m_type = Endpoint::ClientEndpoint;
 
-  // allocate memory for the socket descriptor. 
-  m_sockets = (int32_t *) malloc(sizeof(int32_t));
+  // The socket descriptor is kept in the object.
+  m_sockets = &m_socket;
   m_sockets[0] = UNUSED;
   m_sockets_len = 1;
   m_address_info = NULL;
@@ -445,15 +2253,11 @@ Client::Client(const Endpoint::Protocol proto) {
  * Desrtoys a client object.
  */
 Client::~Client() {
-  if (m_sockets)
-    free(m_sockets);
   m_sockets = NULL;
   m_sockets_len = 0;
   
   // Safely delete m_addr
-  if (m_address_info)
-    freeaddrinfo(m_address_info);
-  m_address_info  = NULL;
+  free_address_info();
 }
 
 /**
@@ -466,11 +2270,26 @@ Client::~Client() {
  */
 void Client::set_socket(int32_t sock) {
   if (!m_sockets)
-    m_sockets = (int32_t *) malloc(sizeof(int32_t));
+    m_sockets = &m_socket;
   
   m_sockets[0] = sock;
 }
 
+/**
+ * @name set_socket - Set the socket.
+ * @param sock: Socket descriptor.
+ * @param nonblocking: True if the descriptor is already in non-blocking mode.
+ *
+ * This function sets the socket descriptor and records its blocking mode
+ * without changing the descriptor's flags.
+ *
+ * @return Void.
+ */
+void Client::set_socket(int32_t sock, const bool nonblocking) {
+  set_socket(sock);
+  m_nonblocking = nonblocking;
+}
+
 /**
  * @name get_socket - Get the socket.
  *
@@ -485,6 +2304,25 @@ int32_t Client::get_socket() {
     return UNUSED;
 }
 
+/**
+ * @name set_nonblocking - Set the blocking mode.
+ * @param on: True for non-blocking mode, false for blocking mode.
+ *
+ * This function sets the blocking mode of the client's socket. In non-blocking
+ * mode receive_data drains the socket until EAGAIN, as required by an edge
+ * triggered epoll set.
+ *
+ * @return 0: success, 1: error.
+ */
+int32_t Client::set_nonblocking(const bool on) {
+  if (!m_sockets || m_sockets[0] < 0)
+    return 1;
+  if (set_fd_nonblocking(m_sockets[0], on))
+    return 1;
+  m_nonblocking = on;
+  return 0;
+}
+
 /**
  * @name set_address_info - Set the address information.
  * @param info: The address ifnormation.
@@ -494,11 +2332,54 @@ int32_t Client::get_socket() {
  * @return Void.
  */
 void Client::set_address_info(struct addrinfo *info) {
-  if (m_address_info)
-    freeaddrinfo(m_address_info);
+  free_address_info();
   m_address_info = info;
 }
 
+/**
+ * @name set_address_info - Set the address information.
+ * @param info: The address information.
+ * @param pooled: True if info is the addrinfo of a RecordPool record.
+ *
+ * This function sets the address information of the client. A pooled record is
+ * given back to the pool when the client is detached.
+ *
+ * @return Void.
+ */
+void Client::set_address_info(struct addrinfo *info, const bool pooled) {
+  set_address_info(info);
+  m_address_pooled = pooled;
+}
+
+/**
+ * @name set_peer_address - Set the peer address.
+ * @param addr: The peer's socket address.
+ * @param addr_len: The length of the peer's socket address.
+ *
+ * This function copies the address of a peer into a connection record and sets
+ * it as the client's address information.
+ *
+ * @return 0: success, 1: error.
+ */
+int32_t Client::set_peer_address(const struct sockaddr *addr, socklen_t addr_len) {
+  struct RecordPool::record *r;
+  
+  if (!addr || addr_len > sizeof(struct sockaddr_storage)) {
+    fprintf(stderr, "(set_peer_address) Error: Invalid peer address.\n");
+    return 1;
+  }
+  
+  r = RecordPool::acquire();
+  if (!r)
+    return 1;
+  r->info.ai_family = addr->sa_family;
+  r->info.ai_socktype = (m_protocol == Endpoint::TCP) ? SOCK_STREAM : SOCK_DGRAM;
+  r->info.ai_addrlen = addr_len;
+  memcpy(&r->addr, addr, addr_len);
+  set_address_info(&r->info, true);
+  return 0;
+}
+
 /**
  * attach - Connects to a server host.
  * @param host: The hostname or ip address of the server host.
@@ -512,7 +2393,7 @@ void Client::set_address_info(struct addrinfo *info) {
  */
 int32_t Client::attach(const char *host, const char *service) {
   struct addrinfo hints, *res;
-  int32_t connected = 0;
+  int32_t connected = 0, flags = 0;
   
   // Check the arguments.
   if (!host) {
@@ -540,11 +2421,16 @@ int32_t Client::attach(const char *host, const char *service) {
     return 1;
   }    
   
+  // On a fiber the socket must not block the thread.
+  if (FiberScheduler::current())
+    flags = SOCK_NONBLOCK;
+
   // Create the UDP/ TCP sockets and call connect for each one. 
   res = m_address_info;
   while (res) {
-    if (m_protocol == Endpoint::UDP || m_protocol == Endpoint::TCP)  
-      m_sockets[0] = socket(res->ai_family, res->ai_socktype, res->ai_protocol);
+    if (m_protocol == Endpoint::UDP || m_protocol == Endpoint::TCP ||
+	m_protocol == Endpoint::RUDP)
+      m_sockets[0] = socket(res->ai_family, res->ai_socktype | flags, res->ai_protocol);
     
     if (m_sockets[0] < 0) {
       deleteGAINode(&(m_address_info), &res, NULL);
@@ -553,7 +2439,7 @@ int32_t Client::attach(const char *host, const char *service) {
     
     // Now try to connect if the protocol is TCP.
     if (m_protocol == TCP) {
-      if (connect(m_sockets[0], res->ai_addr, res->ai_addrlen) < 0) {
+      if (fiber_connect(m_sockets[0], res->ai_addr, res->ai_addrlen) < 0) {
 	// Can not connect in this address.
 	close(m_sockets[0]);
 	deleteGAINode(&(m_address_info), &res, NULL);
@@ -597,6 +2483,18 @@ Server::Server() {
   m_epfd = UNUSED;
   m_sockets = NULL;
   m_server_address = NULL;
+  m_events = NULL;
+  m_events_len = 0;
+  m_events_next = 0;
+  m_edge_triggered = false;
+  m_reuse_port = false;
+  m_keep_alive = false;
+  m_accept_batch = 1;
+  m_sessions_on = false;
+  m_session_timeout = SESSION_TIMEOUT;
+  m_peer_sockets = false;
+  m_buffered = NULL;
+  m_fiber_listen = false;
 }
 
 /**
@@ -611,6 +2509,18 @@ Server ::Server(const Endpoint::Protocol proto) {
   m_epfd = UNUSED;
   m_sockets = NULL;
   m_server_address = NULL;
+  m_events = NULL;
+  m_events_len = 0;
+  m_events_next = 0;
+  m_edge_triggered = false;
+  m_reuse_port = false;
+  m_keep_alive = false;
+  m_accept_batch = 1;
+  m_sessions_on = false;
+  m_session_timeout = SESSION_TIMEOUT;
+  m_peer_sockets = false;
+  m_buffered = NULL;
+  m_fiber_listen = false;
 }
 
 /**
@@ -625,13 +2535,224 @@ Server::~Server() {
   m_sockets_len = 0;
   
   // Safely delete m_addr
-  if (m_address_info)
-    freeaddrinfo(m_address_info);
-  m_address_info = NULL;
+  free_address_info();
 
   if (m_server_address)
     free(m_server_address);
   m_server_address = NULL;
+
+  if (m_events)
+    free(m_events);
+  m_events = NULL;
+}
+
+/**
+ * @name set_edge_triggered - Set the epoll triggering mode.
+ * @param on: True for edge-triggered mode, false for level-triggered mode.
+ *
+ * Use this method before start to select the epoll triggering mode. In edge
+ * triggered mode the listening and the accepted sockets are non-blocking, every
+ * notification drains accept until EAGAIN and the receivers must drain the
+ * client sockets until receive_data fails with EAGAIN. The default is level
+ * triggered mode.
+ *
+ * @return Void.
+ */
+void Server::set_edge_triggered(const bool on) {
+  m_edge_triggered = on;
+}
+
+/**
+ * @name edge_triggered - Get the epoll triggering mode.
+ *
+ * This function returns true if the server uses edge-triggered mode.
+ *
+ * @return The triggering mode.
+ */
+bool Server::edge_triggered() {
+  return m_edge_triggered;
+}
+
+/**
+ * @name set_reuse_port - Share the server address.
+ * @param on: True to set SO_REUSEPORT on the server sockets.
+ *
+ * Use this method before start to let several server endpoints bind to the
+ * same address. The kernel then balances the incoming connections, or the
+ * datagrams for UDP, across the endpoints.
+ *
+ * @return Void.
+ */
+void Server::set_reuse_port(const bool on) {
+  m_reuse_port = on;
+}
+
+/**
+ * @name reuse_port - Check if the server address is shared.
+ *
+ * This function returns true if the server sockets use SO_REUSEPORT.
+ *
+ * @return The SO_REUSEPORT option.
+ */
+bool Server::reuse_port() {
+  return m_reuse_port;
+}
+
+/**
+ * @name set_accept_batch - Set the accept batch size.
+ * @param batch: The maximum number of connections accepted per wakeup.
+ *
+ * Use this method before start to set how many pending connections a TCP server
+ * accepts for each event of a listening socket, so that a burst of connections
+ * is drained in one pass instead of one per epoll_wait call. If batch is greater
+ * than 1 the listening sockets are non-blocking. An edge triggered server always
+ * drains the whole backlog. The default is 1, which keeps the listening sockets
+ * blocking; ACCEPT_BATCH suits servers that receive bursts of connections.
+ *
+ * @return Void.
+ */
+void Server::set_accept_batch(const int32_t batch) {
+  m_accept_batch = (batch < 1) ? 1 : batch;
+}
+
+/**
+ * @name accept_batch - Get the accept batch size.
+ *
+ * This function returns the maximum number of connections accepted per wakeup.
+ *
+ * @return The accept batch size.
+ */
+int32_t Server::accept_batch() {
+  return m_accept_batch;
+}
+
+/**
+ * @name set_keep_alive - Set the keep-alive mode.
+ * @param on: True to keep the TCP connections in the epoll set.
+ *
+ * Use this method before start to let a TCP connection carry many requests. In
+ * keep-alive mode the accepted sockets are monitored as one shot events, and a
+ * connection returned by get_client stays in the epoll set, disarmed. After the
+ * request has been served, rearm hands the connection back to the server, which
+ * returns it from get_client again when the next request arrives. A connection
+ * that is not rearmed must be detached.
+ *
+ * @return Void.
+ */
+void Server::set_keep_alive(const bool on) {
+  m_keep_alive = on;
+}
+
+/**
+ * @name keep_alive - Check the keep-alive mode.
+ *
+ * This function returns true if the server keeps its connections.
+ *
+ * @return The keep-alive mode.
+ */
+bool Server::keep_alive() {
+  return m_keep_alive;
+}
+
+/**
+ * @name set_sessions - Set the UDP session mode.
+ * @param on: True to demultiplex the datagrams into per-client sessions.
+ *
+ * Use this method before start to let a UDP server read every datagram once.
+ * In session mode get_client reads the datagrams that are waiting, up to
+ * UDP_BATCH per system call, and queues them in the sessions of their senders,
+ * which are kept in a hash table. It returns a client for a session that has
+ * datagrams, and receive_data with that client takes the next datagram of the
+ * session from memory. The other receive methods bypass the sessions and must
+ * not be used with the clients of the server.
+ *
+ * @return Void.
+ */
+void Server::set_sessions(const bool on) {
+  m_sessions_on = on;
+}
+
+/**
+ * @name sessions - Check the UDP session mode.
+ *
+ * This function returns true if the server demultiplexes its datagrams into
+ * sessions.
+ *
+ * @return The session mode.
+ */
+bool Server::sessions() {
+  return m_sessions_on;
+}
+
+/**
+ * @name set_session_timeout - Set the session idle timeout.
+ * @param sec: The idle time in seconds, or 0 to keep the sessions forever.
+ *
+ * Use this method before start to set after how long a session that receives no
+ * datagrams, and has none queued, is removed. The default is SESSION_TIMEOUT.
+ *
+ * @return Void.
+ */
+void Server::set_session_timeout(const int32_t sec) {
+  m_session_timeout = sec;
+}
+
+/**
+ * @name set_peer_sockets - Set the connected UDP peer mode.
+ * @param on: True to give every UDP client a socket of its own.
+ *
+ * Use this method before start to let a UDP server spread its clients over
+ * several sockets. The server sockets are bound with SO_REUSEADDR and
+ * SO_REUSEPORT, and their datagrams are read into a session table, which keeps
+ * one session per peer. The first time get_client serves the session of a peer
+ * it creates a socket bound to the same address and connected to the peer. The
+ * kernel then delivers the next datagrams of the peer to that socket, which the
+ * client owns and closes when it is detached, so it can be monitored by another
+ * epoll set, e.g. of a worker thread. The datagrams that the peer sent before
+ * its socket was connected are moved to the client's read buffer, and
+ * receive_data returns them first. The datagrams of other peers that reached the
+ * new socket before it was connected are queued in their sessions. A datagram
+ * of a peer that arrives at the server socket while the peer has a connected
+ * socket is served from the server socket. The mode has no effect on TCP or
+ * RUDP servers.
+ *
+ * @return Void.
+ */
+void Server::set_peer_sockets(const bool on) {
+  m_peer_sockets = on;
+}
+
+/**
+ * @name peer_sockets - Check the connected UDP peer mode.
+ *
+ * This function returns true if the server connects a socket to every peer.
+ *
+ * @return The connected peer mode.
+ */
+bool Server::peer_sockets() {
+  return m_peer_sockets;
+}
+
+/**
+ * @name set_nonblocking - Set the blocking mode.
+ * @param on: True for non-blocking mode, false for blocking mode.
+ *
+ * This function sets the blocking mode of the started server's sockets. Server
+ * sockets that are monitored by several threads must be non-blocking, so that
+ * a thread that loses the race for a connection does not block in accept.
+ *
+ * @return 0: success, 1: error.
+ */
+int32_t Server::set_nonblocking(const bool on) {
+  if (!m_sockets)
+    return 1;
+  for (int32_t i = 0; i < m_sockets_len; i++) {
+    if (set_fd_nonblocking(m_sockets[i], on))
+      return 1;
+  }
+  m_nonblocking = on;
+  m_fiber_listen = false;
+  return 0;
 }
 
 /**
@@ -650,9 +2771,13 @@ int32_t Server::start(const char *host, const char *service, int32_t backlog) {
   int32_t len, i = 0, created = 0, error, epres;
   struct epoll_event ev;
   struct address_storage *server_address;
+  int32_t on = 1;
+  bool nonblocking;
   
   // Set epoll events.
   ev.events  = EPOLLIN;
+  if (m_edge_triggered)
+    ev.events |= EPOLLET;
   
   // Service should not be NULL. 
   if (!service) {
@@ -666,6 +2791,8 @@ int32_t Server::start(const char *host, const char *service, int32_t backlog) {
     return 1;
   }
   m_backlog = backlog;
+  nonblocking = m_edge_triggered ||
+    (m_protocol == Endpoint::TCP && m_accept_batch > 1);
   
   // Specify the hints for the getaddrinfo().
   memset(&hints, 0, sizeof(hints));
@@ -712,6 +2839,23 @@ int32_t Server::start(const char *host, const char *service, int32_t backlog) {
       continue;
     }
     
+    // Share the address with the other server endpoints if requested.
+    if (m_reuse_port &&
+	setsockopt(m_sockets[i], SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on)) < 0) {
+      close(m_sockets[i]);
+      deleteGAINode(&(m_address_info), &res, prev);
+      continue;
+    }
+
+    // Share the address with the sockets of the connected UDP peers.
+    if (m_peer_sockets && m_protocol == Endpoint::UDP &&
+	(setsockopt(m_sockets[i], SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on)) < 0 ||
+	 setsockopt(m_sockets[i], SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on)) < 0)) {
+      close(m_sockets[i]);
+      deleteGAINode(&(m_address_info), &res, prev);
+      continue;
+    }
+    
     // Now bind the socket.
     if (bind(m_sockets[i], res->ai_addr, res->ai_addrlen) < 0) {
       close(m_sockets[i]);
@@ -719,6 +2863,13 @@ int32_t Server::start(const char *host, const char *service, int32_t backlog) {
       continue;
     }
     
+    // An edge triggered or a batching socket must never block.
+    if (nonblocking && set_fd_nonblocking(m_sockets[i], true)) {
+      close(m_sockets[i]);
+      deleteGAINode(&(m_address_info), &res, prev);
+      continue;
+    }
+    
     // Check if we use a TCP socket and call listen.
     if (m_protocol == Endpoint::TCP) {
       if (listen(m_sockets[i], m_backlog) < 0) {
@@ -737,6 +2888,7 @@ int32_t Server::start(const char *host, const char *service, int32_t backlog) {
   
   if (created) {
     created = 0;
+    m_nonblocking = nonblocking;
     server_address = (struct address_storage *)malloc(m_sockets_len * sizeof(address_storage));
     if (!server_address) {
       fprintf(stderr, "(start) ERROR: malloc: No free memory left.\n");
@@ -744,6 +2896,15 @@ int32_t Server::start(const char *host, const char *service, int32_t backlog) {
     }
     // Keep a pointer in order to free the memory later.
     m_server_address = server_address;
+
+    // Ready events that get_client has not consumed yet are kept here.
+    m_events = (struct epoll_event *)malloc(MAX_EPOLL_EVENTS_PER_RUN * sizeof(struct epoll_event));
+    if (!m_events) {
+      fprintf(stderr, "(start) ERROR: malloc: No free memory left.\n");
+      return 1;
+    }
+    m_events_len = 0;
+    m_events_next = 0;
     
     for (i = 0; i < m_sockets_len; i++) {
       // Add the created socket to epoll for monitor. 
@@ -761,6 +2922,10 @@ int32_t Server::start(const char *host, const char *service, int32_t backlog) {
     
     // If at least one server socket added to the epoll set we are ok.
     if (created) {
+      if ((m_sessions_on || m_peer_sockets) && m_protocol == Endpoint::UDP) {
+	m_sessions = new SessionTable;
+	m_sessions->set_timeout(m_session_timeout);
+      }
       return 0;
     } else {
       return 1;
@@ -771,6 +2936,121 @@ int32_t Server::start(const char *host, const char *service, int32_t backlog) {
   }
 }
 
+/**
+ * @name connect_peer - Connect a socket to a UDP peer.
+ * @param sock: The server socket that received from the peer.
+ * @param addr: The address of the peer.
+ * @param addr_len: The size of the address.
+ * @param flags: Flags for the socket, e.g. SOCK_NONBLOCK.
+ *
+ * This function creates a UDP socket bound to the address of the server socket
+ * and connected to the peer, so that the kernel delivers the datagrams of the
+ * peer to it instead of the server socket. The datagrams of other peers may
+ * reach the socket before it is connected.
+ *
+ * @return The socket or -1 on error.
+ */
+static int32_t connect_peer(int32_t sock, const struct sockaddr_storage *addr,
+			    socklen_t addr_len, int32_t flags) {
+  struct sockaddr_storage local;
+  socklen_t local_len = sizeof(local);
+  int32_t sd, on = 1;
+
+  if (getsockname(sock, (struct sockaddr *)&local, &local_len) < 0)
+    return -1;
+  sd = socket(local.ss_family, SOCK_DGRAM | flags, 0);
+  if (sd < 0)
+    return -1;
+  if (setsockopt(sd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on)) < 0 ||
+      setsockopt(sd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on)) < 0 ||
+      bind(sd, (struct sockaddr *)&local, local_len) < 0 ||
+      connect(sd, (const struct sockaddr *)addr, addr_len) < 0) {
+    close(sd);
+    return -1;
+  }
+  return sd;
+}
+
+/**
+ * @name peer_connected - Check a socket connected to a peer.
+ * @param sd: The socket.
+ * @param addr: The address of the peer.
+ * @param addr_len: The size of the address.
+ *
+ * @return True if the socket is still connected to the peer.
+ */
+static bool peer_connected(int32_t sd, const struct sockaddr_storage *addr,
+			   socklen_t addr_len) {
+  struct sockaddr_storage peer;
+  socklen_t peer_len = sizeof(peer);
+
+  return getpeername(sd, (struct sockaddr *)&peer, &peer_len) == 0 &&
+    peer_len == addr_len && !memcmp(&peer, addr, addr_len);
+}
+
+/**
+ * @name set_session_socket - Set the socket of a session client.
+ * @param client: The client of the session.
+ * @param fd: The server socket of the session.
+ * @param addr: The address of the peer.
+ * @param addr_len: The size of the address.
+ * @param flags: Flags for a connected socket, e.g. SOCK_NONBLOCK.
+ *
+ * This function gives the client of a session the server socket, or in the
+ * connected peer mode a socket connected to the peer, which is created only if
+ * the peer has none. The datagrams of the peer that reached the server socket
+ * are then moved to the read buffer of the client, each after its length, and
+ * the datagrams of the other peers that reached the new socket before it was
+ * connected are queued in their sessions, to be served from the server socket.
+ *
+ * @return Void.
+ */
+void Server::set_session_socket(Client *client, int32_t fd,
+				const struct sockaddr_storage *addr, socklen_t addr_len,
+				int32_t flags) {
+  uint32_t len;
+  size_t size;
+  int32_t sd, bytes;
+
+  client->set_socket(fd, m_nonblocking);
+  if (!m_peer_sockets)
+    return;
+  sd = m_sessions->peer_socket(addr, addr_len);
+  if (sd >= 0 && peer_connected(sd, addr, addr_len))
+    return;
+  sd = connect_peer(fd, addr, addr_len, flags);
+  if (sd < 0)
+    return;
+  m_sessions->set_peer_socket(addr, addr_len, sd);
+
+  //
+  // Read the datagrams that came before the socket was connected, one batch
+  // from each socket, so that a busy socket does not hold up the client.
+  //
+  m_sessions->fill(fd);
+  m_sessions->fill(sd, fd);
+
+  client->m_read_start = client->m_read_end = 0;
+  while (1) {
+    size = client->m_read_end + sizeof(len) + SESSION_SLOT_SIZE;
+    if (size > client->m_read_size) {
+      if (size < 2 * client->m_read_size)
+	size = 2 * client->m_read_size;
+      if (client->set_read_buffer(size))
+	break;
+    }
+    bytes = m_sessions->take(addr, addr_len, client->m_read + client->m_read_end +
+			     sizeof(len), SESSION_SLOT_SIZE);
+    if (bytes < 0)
+      break;
+    len = bytes;
+    memcpy(client->m_read + client->m_read_end, &len, sizeof(len));
+    client->m_read_end += sizeof(len) + len;
+  }
+  client->set_socket(sd, flags & SOCK_NONBLOCK);
+  client->m_peer_socket = true;
+}
+
 /*
  * @name get_client - Returns the next ready client.
  * @param client: A pointer to a validclient object.
@@ -779,20 +3059,23 @@ int32_t Server::start(const char *host, const char *service, int32_t backlog) {
  * client that is ready to send data. It also attaches the client to the server
  * endpoint. Note, that after receiving data from the client, the server side 
  * must properly detach the client by calling its detach function.
+ * The events returned by one epoll_wait call are kept in the server and are
+ * consumed by the following calls before epoll_wait is called again. The
+ * address of every client is kept in a record of the connection record pool,
+ * which the client gives back when it is detached.
  *
  * Return value: 0: success, 1: error.
  *    
  */
 int32_t Server::get_client(Client *client) {
-  struct address_storage *client_address, *client_address_ptr, *server_address_ptr;
-  struct addrinfo *res;
-  int32_t i, fd, j, nfds, error;
+  struct address_storage *server_address_ptr;
+  struct RecordPool::record *record = NULL, *client_record;
+  int32_t i, fd, j, nfds;
   char data[200];
   int32_t data_len = sizeof(data);
-  int32_t bytes, epres, accept_sd, new_client_done = 0;
-  struct epoll_event ev, events[MAX_EPOLL_EVENTS_PER_RUN];
+  int32_t bytes, epres, accept_sd, accepted, accept_flags, new_client_done = 0;
+  struct epoll_event ev, *events = m_events;
   
-  struct sockaddr_storage *client_addr;
   socklen_t client_sin_size;
 
   // Check the arguments. Client must point to a valid client object. 
@@ -803,36 +3086,109 @@ int32_t Server::get_client(Client *client) {
 
   // Set client's protocol the same as server's
   client->set_protocol(m_protocol);
+
+  // A RUDP client shares the protocol state of the server's socket.
+  client->m_owner = m_protocol == Endpoint::RUDP ? this : NULL;
   
   // Set the epoll events. 
   ev.events = EPOLLIN;
-  
-  client_addr = (struct sockaddr_storage *)malloc(sizeof(struct sockaddr_storage));
-  if (!client_addr) {
-    fprintf(stderr,"(get_client) Error: No free memory left.\n");
-    return 1;
+  if (m_edge_triggered)
+    ev.events |= EPOLLET;
+  if (m_keep_alive)
+    ev.events |= EPOLLONESHOT;
+
+  // The accepted sockets of an edge triggered server or a fiber never block.
+  accept_flags = SOCK_CLOEXEC;
+  if (m_edge_triggered || FiberScheduler::current())
+    accept_flags |= SOCK_NONBLOCK;
+
+  //
+  // Neither does accept on a fiber, which would block the whole scheduler if
+  // the connection were reset or taken by another thread before it.
+  //
+  if (FiberScheduler::current() && m_protocol == Endpoint::TCP && !m_nonblocking &&
+      !m_fiber_listen) {
+    for (j = 0; j < m_sockets_len; j++)
+      if (set_fd_nonblocking(m_sockets[j], true))
+	return 1;
+    m_fiber_listen = true;
+  }
+
+  // A kept connection with buffered data is returned first.
+  if (m_buffered) {
+    client_record = RecordPool::from_storage(m_buffered);
+    m_buffered = client_record->next ? &client_record->next->storage : NULL;
+    client_record->next = NULL;
+    client->set_socket(client_record->storage.fd, m_edge_triggered);
+    client_record->info.ai_family = client_record->addr.ss_family;
+    client_record->info.ai_socktype = SOCK_STREAM;
+    client_record->info.ai_addrlen = (socklen_t)client_record->storage.size;
+    client->set_address_info(&client_record->info, true);
+    free(client->m_read);
+    client->m_read = client_record->read;
+    client->m_read_size = client_record->read_size;
+    client->m_read_start = client_record->read_start;
+    client->m_read_end = client_record->read_end;
+    client_record->read = NULL;
+    return 0;
+  }
+
+  // The datagrams already read into sessions are delivered first.
+  if (m_sessions) {
+    if (!(record = RecordPool::acquire()))
+      return 1;
+    fd = m_sessions->next_ready(&record->addr, &client_sin_size);
+    if (fd >= 0) {
+      set_session_socket(client, fd, &record->addr, client_sin_size, accept_flags);
+      record->info.ai_family = record->addr.ss_family;
+      record->info.ai_socktype = SOCK_DGRAM;
+      record->info.ai_addrlen = client_sin_size;
+      client->set_address_info(&record->info, true);
+      return 0;
+    }
+  }
+
+  // A reliable message may have been completed while the server was sending.
+  if (m_protocol == Endpoint::RUDP && m_rudp) {
+    if (!(record = RecordPool::acquire()))
+      return 1;
+    if (m_rudp->pending(&record->addr, &client_sin_size, &fd)) {
+      client->set_socket(fd, m_nonblocking);
+      record->info.ai_family = record->addr.ss_family;
+      record->info.ai_socktype = SOCK_DGRAM;
+      record->info.ai_addrlen = client_sin_size;
+      client->set_address_info(&record->info, true);
+      return 0;
+    }
   }
-  memset(client_addr,0,sizeof(struct sockaddr_storage));
-  client_sin_size = sizeof(struct sockaddr_storage);
   
   while (1) {   
-    // Call epoll wait.
-    nfds = epoll_wait(m_epfd, events, MAX_EPOLL_EVENTS_PER_RUN, -1);
-    error = errno;
-    if (nfds < 0) {
-      if (error == EINTR) {
-	if (client_addr)
-	  free(client_addr);
-	return 1;
+    // Consume the events of the previous epoll_wait call first.
+    if (m_events_next < m_events_len) {
+      nfds = m_events_len;
+    } else {
+      // Call epoll wait. A fiber yields until the epoll set is ready.
+      m_events_len = m_events_next = 0;
+      if (FiberScheduler::current()) {
+	if (FiberScheduler::current()->wait(m_epfd, EPOLLIN)) {
+	  RecordPool::release(record);
+	  return 1;
+	}
+	nfds = epoll_wait(m_epfd, events, MAX_EPOLL_EVENTS_PER_RUN, 0);
       } else {
-	if (client_addr)
-	  free(client_addr);
-	return 1;
+	nfds = epoll_wait(m_epfd, events, MAX_EPOLL_EVENTS_PER_RUN, -1);
       }
+      if (nfds > 0)
+	m_events_len = nfds;
+    }
+    if (nfds < 0) {
+      RecordPool::release(record);
+      return 1;
     }
     
     // Check the event.
-    for (i = 0; i < nfds; i++) {
+    while (m_events_next < m_events_len) {
+      i = m_events_next++;
       server_address_ptr = (struct address_storage *)events[i].data.ptr;
       fd = server_address_ptr->fd;
       
@@ -841,63 +3197,107 @@ int32_t Server::get_client(Client *client) {
       for (j = 0; j < m_sockets_len; j++) {
 	// If the event is on a server socket.
 	if (fd == m_sockets[j]) {
+	  //
+	  // The client's address is received into a connection record, which
+	  // is reused from the pool.
+	  //
+	  if (!record && !(record = RecordPool::acquire()))
+	    return 1;
+	  client_sin_size = sizeof(struct sockaddr_storage);
+	  
 	  if (m_protocol == Endpoint::TCP) {
-	    // Call accept and save the new socket descriptor.
-	    accept_sd = accept(m_sockets[j],(struct sockaddr *)client_addr,
-			       &client_sin_size);
-	    if (accept_sd < 0) {
-	      continue;
-	    }
-            
-	    // 
-	    // We have to keep the client's address 
-	    // to do this we 'll use address_storage. 
 	    //
-	    client_address = (struct address_storage *) malloc(sizeof(struct address_storage));
-	    if (!client_address) {
-	      fprintf(stderr,"(get_client) Error: No free memory left.\n");
-	      if (client_addr)
-		free(client_addr);
-	      return 1;
-	    }
-	    client_address->fd = accept_sd;
-	    client_address->size = client_sin_size;
-	    client_address->addr = client_addr;
-	    
-	    ev.data.ptr = (void *)client_address;
-	    client_address = NULL;
-            
-	    // Add accepted socket to epoll. 
-	    epres = epoll_ctl(m_epfd, EPOLL_CTL_ADD, accept_sd, &ev);
-	    if (epres < 0) {
-	      continue;
-	    } 
+	    // The event is consumed here even if accept fails. Accept up to
+	    // m_accept_batch pending connections in one pass; in edge
+	    // triggered mode drain the backlog until accept fails with EAGAIN.
+	    //
 	    new_client_done = 1;
+	    accepted = 0;
+	    do {
+	      // Call accept and save the new socket descriptor.
+	      accept_sd = accept4(m_sockets[j], (struct sockaddr *)&record->addr,
+				  &client_sin_size, accept_flags);
+	      if (accept_sd < 0) {
+		break;
+	      }
+            
+	      // 
+	      // The record keeps the client's address while the
+	      // accepted socket waits in the epoll queue.
+	      //
+	      record->storage.fd = accept_sd;
+	      record->storage.size = client_sin_size;
+	      ev.data.ptr = (void *)&record->storage;
+            
+	      // Add accepted socket to epoll. 
+	      epres = epoll_ctl(m_epfd, EPOLL_CTL_ADD, accept_sd, &ev);
+	      if (epres < 0) {
+		close(accept_sd);
+		continue;
+	      } 
+
+	      // The record now belongs to the accepted client.
+	      record = RecordPool::acquire();
+	      if (!record)
+		return 1;
+	      client_sin_size = sizeof(struct sockaddr_storage);
+	    } while (m_edge_triggered || (m_nonblocking && ++accepted < m_accept_batch));
 	    break;
+	  } else if (m_sessions) {
+	    //
+	    // Read the waiting datagrams once into the sessions of their
+	    // senders. An edge triggered socket is revisited until it is drained.
+	    //
+	    new_client_done = 1;
+	    if (m_sessions->fill(fd) > 0 && m_edge_triggered)
+	      m_events_next--;
+	    fd = m_sessions->next_ready(&record->addr, &client_sin_size);
+	    if (fd < 0)
+	      break;
+	    set_session_socket(client, fd, &record->addr, client_sin_size, accept_flags);
+	    record->info.ai_family = record->addr.ss_family;
+	    record->info.ai_socktype = SOCK_DGRAM;
+	    record->info.ai_addrlen = client_sin_size;
+	    client->set_address_info(&record->info, true);
+	    return 0;
+	  } else if (m_protocol == Endpoint::RUDP) {
+	    //
+	    // Read the fragments and acknowledgements that arrived. A client is
+	    // returned for the peer of a message once the message is complete.
+	    //
+	    new_client_done = 1;
+	    if (rudp()->input(fd, 0) < 0 ||
+		!rudp()->pending(&record->addr, &client_sin_size, &fd))
+	      break;
+	    client->set_socket(fd, m_nonblocking);
+	    record->info.ai_family = record->addr.ss_family;
+	    record->info.ai_socktype = SOCK_DGRAM;
+	    record->info.ai_addrlen = client_sin_size;
+	    client->set_address_info(&record->info, true);
+	    return 0;
 	  } else {
 	    // Set the client's socket descriptor the same as the server's.
-	    client->set_socket(m_sockets[j]);
+	    client->set_socket(m_sockets[j], m_nonblocking);
 	    
 	    // We have a UDP Endpoint. lets block and wait for data.
 	    bytes = recvfrom(client->sockets()[0], data, data_len, MSG_PEEK,
-			     (struct sockaddr *)client_addr, &client_sin_size);
+			     (struct sockaddr *)&record->addr, &client_sin_size);
 	    if (bytes < 0) {
 	      continue;
 	    }
 
 	    // a client with data has come. Initialize the node. 
-	    res = (struct addrinfo *)malloc(sizeof(struct addrinfo));
-	    if (!res) {
-	      fprintf(stderr,"(get_client) Error: No free memory left.\n");
-	      if (client_addr)
-		free(client_addr);
-	      return 1;
-	    }                     
-	    res->ai_next = NULL;
-	    res->ai_addr =(struct sockaddr *)client_addr;             
-	    res->ai_addrlen = client_sin_size;
-	    res->ai_canonname = NULL;
-	    client->set_address_info(res);
+	    record->info.ai_family = record->addr.ss_family;
+	    record->info.ai_socktype = SOCK_DGRAM;
+	    record->info.ai_addrlen = client_sin_size;
+	    client->set_address_info(&record->info, true);
+
+	    //
+	    // An edge triggered socket is not reported again while it has
+	    // datagrams, so revisit this event until the peek fails with EAGAIN.
+	    //
+	    if (m_edge_triggered)
+	      m_events_next--;
 	    return 0;
 	  }
 	}			                   
@@ -905,43 +3305,90 @@ int32_t Server::get_client(Client *client) {
       if ((events[i].events & EPOLLIN) && new_client_done == 0) {    
 	if (m_protocol == Endpoint::TCP) {
 	  
-	  // Initialize the node. 
-	  client_address_ptr =  (struct address_storage *)events[i].data.ptr;
-	  client->set_socket(client_address_ptr->fd);
+	  // Initialize the node from the record of the accepted socket. 
+	  client_record = (struct RecordPool::record *)events[i].data.ptr;
+	  client->set_socket(client_record->storage.fd, m_edge_triggered);
+	  client_record->info.ai_family = client_record->addr.ss_family;
+	  client_record->info.ai_socktype = SOCK_STREAM;
+	  client_record->info.ai_addrlen = (socklen_t)client_record->storage.size;
+	  client->set_address_info(&client_record->info, true);
           
-	  res = (struct addrinfo *)malloc(sizeof(struct addrinfo));
-	  if (!res) {
-	    fprintf(stderr,"(get_client) Error No free memory left.\n");
-	    if (client_addr)
-	      free(client_addr);
-	    if (client_address)
-	      free(client_address);
-	    return 1;
-	  }                    
-	  res->ai_next = NULL;
-	  if (events[i].data.ptr)
-	    res->ai_addr = (struct sockaddr *)(client_address_ptr->addr);
-	  if (events[i].data.ptr!= NULL) 
-	    res->ai_addrlen = (socklen_t)client_address_ptr->size;
-	  res->ai_canonname = NULL;
-	  client->set_address_info(res);
-          
-	  // Delete descriptor from epoll.
-	  epoll_ctl(m_epfd, EPOLL_CTL_DEL, client->get_socket(), &ev);
+	  // Delete descriptor from epoll, unless it is kept for rearm.
+	  if (!m_keep_alive)
+	    epoll_ctl(m_epfd, EPOLL_CTL_DEL, client->get_socket(), &ev);
+	  RecordPool::release(record);
 	  return 0;
 	}
       } else if (!new_client_done) {
 	if (m_protocol == Endpoint::TCP) {
-	  client_address_ptr = (struct address_storage *)(events[i].data.ptr);
-	  fd = client_address_ptr->fd;
+	  // The connection failed before sending data. Drop it.
+	  client_record = (struct RecordPool::record *)events[i].data.ptr;
+	  fd = client_record->storage.fd;
 	  // Delete descriptor from epoll.
 	  epoll_ctl(m_epfd, EPOLL_CTL_DEL, fd, &ev);     
+	  close(fd);
+	  RecordPool::release(client_record);
 	}
       }
     }                   
   }
 }
 
+/**
+ * @name rearm - Keep a connection.
+ * @param client: A client returned by get_client in keep-alive mode.
+ *
+ * This function arms the connection of a client again, so that get_client
+ * returns it when more data arrive. The server takes the connection back from
+ * the client object, which may then be deleted or passed to get_client. If the
+ * client's read buffer holds data, e.g. a request that the peer pipelined behind
+ * the one served, the buffer is kept with the connection, and get_client returns
+ * the connection with the buffer at once, without waiting for the socket.
+ *
+ * @return 0: success, 1: error.
+ */
+int32_t Server::rearm(Client *client) {
+  struct RecordPool::record *record;
+  struct epoll_event ev;
+
+  // Only a connection kept by get_client can be rearmed.
+  if (!m_keep_alive || m_protocol != Endpoint::TCP || !client ||
+      !client->m_address_pooled || client->get_socket() < 0) {
+    fprintf(stderr, "(rearm) Error: The client is not a kept connection.\n");
+    return 1;
+  }
+  record = RecordPool::from_info(client->m_address_info);
+  if (record->storage.fd != client->get_socket()) {
+    fprintf(stderr, "(rearm) Error: The client is not a kept connection.\n");
+    return 1;
+  }
+
+  if (client->m_read_end > client->m_read_start) {
+    // The data read already would not wake epoll up.
+    record->read = client->m_read;
+    record->read_size = client->m_read_size;
+    record->read_start = client->m_read_start;
+    record->read_end = client->m_read_end;
+    client->m_read = NULL;
+    client->m_read_size = client->m_read_start = client->m_read_end = 0;
+    record->next = m_buffered ? RecordPool::from_storage(m_buffered) : NULL;
+    m_buffered = &record->storage;
+  } else {
+    ev.events = EPOLLIN | EPOLLONESHOT;
+    if (m_edge_triggered)
+      ev.events |= EPOLLET;
+    ev.data.ptr = (void *)&record->storage;
+    if (epoll_ctl(m_epfd, EPOLL_CTL_MOD, record->storage.fd, &ev) < 0)
+      return 1;
+  }
+
+  // The record and the socket belong to the epoll set again.
+  client->m_address_info = NULL;
+  client->m_address_pooled = false;
+  client->m_sockets[0] = UNUSED;
+  return 0;
+}
+
 /**
  * @name stop - Stop the server endpoint.
  *
@@ -951,6 +3398,16 @@ int32_t Server::get_client(Client *client) {
  * @return 0 on success, 1 on error
  */
 int32_t Server::stop() {
+  struct RecordPool::record *record;
+
+  // Close the kept connections that wait with buffered data.
+  while (m_buffered) {
+    record = RecordPool::from_storage(m_buffered);
+    m_buffered = record->next ? &record->next->storage : NULL;
+    close(record->storage.fd);
+    RecordPool::release(record);
+  }
+
   //
   // Close the epoll descriptor and then call the general cleanup
   // method from the base Endpoint object.
@@ -960,5 +3417,6 @@ int32_t Server::stop() {
       return 1;
     }
   }
+  m_fiber_listen = false;
   return this->cleanup();
 };
@@ -17,6 +17,9 @@
 
 #include <stdint.h>
 #include <stdlib.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/uio.h>
 
 namespace iris {
 
@@ -26,6 +29,19 @@ namespace iris {
 #define MAX_EPOLL_EVENTS_PER_RUN 1000
 #define EPOLL_RUN_TIMEOUT	 -1
 #define UNUSED                   -999
+#define ACCEPT_BATCH             64
+#define GATHER_BUFFER_SIZE       16384
+#define READ_BUFFER_SIZE         65536
+#define ZEROCOPY_THRESHOLD       16384
+#define UDP_BATCH                64
+#define GRO_BUFFER_SIZE          65536
+#define MESSAGE_HEADER_MAX       5
+#define MESSAGE_MAX              (16 * 1024 * 1024)
+#define SESSION_TIMEOUT          60
+
+struct zerocopy;
+class Rudp;
+class SessionTable;
 
 /** 
  * @name Endpoint - The endpoint object.
@@ -39,13 +55,42 @@ class Endpoint {
  public:
   enum Protocol{
     TCP, 
-    UDP
+    UDP,
+    RUDP
   };  
   enum Type {
     ServerEndpoint,
     ClientEndpoint,
     Unused
   };
+
+  /**
+   * datagram - Datagram information.
+   *
+   * The datagram struct describes one datagram of a batch: its buffer, its
+   * length and the address of the peer it is sent to or received from.
+   */
+  struct datagram {
+    void *data;
+    size_t data_len;
+    struct sockaddr_storage addr;
+    socklen_t addr_len;
+  };
+
+  /**
+   * segments - Coalesced datagram information.
+   *
+   * The segments struct describes the datagrams that the kernel coalesced into
+   * one buffer, and iterates over them with next_segment.
+   */
+  struct segments {
+    char *data;
+    size_t data_len;
+    size_t segment_size;
+    size_t offset;
+    struct sockaddr_storage addr;
+    socklen_t addr_len;
+  };
   
  protected:
   Protocol m_protocol;
@@ -53,6 +98,26 @@ class Endpoint {
   int32_t *m_sockets;
   int32_t m_sockets_len;
   struct addrinfo *m_address_info;
+  bool m_address_pooled;
+  bool m_nonblocking;
+  bool m_gather_on;
+  char *m_gather;
+  size_t m_gather_len;
+  size_t m_gather_size;
+  char *m_read;
+  size_t m_read_size;
+  size_t m_read_start;
+  size_t m_read_end;
+  size_t m_message_max;
+  struct zerocopy *m_zerocopy;
+  bool m_segment_off;
+  bool m_segment_on;
+  size_t m_packet_size;
+  bool m_mtu_discovery;
+  Rudp *m_rudp;
+  Endpoint *m_owner;
+  SessionTable *m_sessions;
+  bool m_peer_socket;
   
  public:
   Endpoint();
@@ -64,11 +129,52 @@ class Endpoint {
   
   Protocol protocol();
   Type type();
+  bool nonblocking();
+  void set_gather(const bool on);
+  bool gather();
 
   int32_t send_data(const void *data, const size_t data_len,
 		    Endpoint *client = NULL);
+  int32_t send_data(const struct iovec *iov, const int32_t iovcnt,
+		    Endpoint *client = NULL);
+  int32_t flush(Endpoint *client = NULL);
+
+  int32_t set_read_buffer(const size_t size);
+  void set_message_max(const size_t size);
+  size_t buffered();
+  int32_t fill();
+  int32_t peek(const void **data);
+  int32_t consume(const size_t data_len);
+  int32_t read_until(const void *delim, const size_t delim_len, const void **data);
+
+  int32_t send_message(const void *data, const size_t data_len, Endpoint *client = NULL);
+  int32_t receive_message(char **data, size_t *data_size, Endpoint *client = NULL);
+
+  int32_t set_zerocopy(const bool on);
+  bool zerocopy();
+  int32_t send_zerocopy(const void *data, const size_t data_len, uint32_t *ticket,
+			Endpoint *client = NULL);
+  int32_t reap_zerocopy(Endpoint *client = NULL);
+  bool zerocopy_done(const uint32_t ticket, Endpoint *client = NULL);
+
+  int64_t send_file(const int32_t fd, off_t *offset, const size_t length,
+		    Endpoint *client = NULL);
   int32_t receive_data(void *data, size_t data_len,
 		       Endpoint *client = NULL);
+  int32_t receive_data(const struct iovec *iov, const int32_t iovcnt,
+		       Endpoint *client = NULL);
+
+  int32_t send_batch(struct datagram *dgrams, const int32_t count,
+		     Endpoint *client = NULL);
+  int32_t receive_batch(struct datagram *dgrams, const int32_t count,
+			Endpoint *client = NULL);
+  int32_t set_receive_offload(const bool on);
+  int32_t receive_segments(void *data, const size_t data_len, struct segments *segs,
+			   Endpoint *client = NULL);
+  static int32_t next_segment(struct segments *segs, const void **segment);
+  int32_t set_path_mtu_discovery(const bool on);
+  int32_t set_packet_size(const size_t size);
+  size_t packet_size();
 
   int32_t *sockets();
   int32_t sockets_len();
@@ -80,6 +186,11 @@ class Endpoint {
   void deleteGAINode(struct addrinfo **head, struct addrinfo **res,
 		     struct addrinfo *prev);
   int32_t cleanup();
+  void free_address_info();
+  int32_t gather_data(const void *data, const size_t data_len);
+  void free_zerocopy();
+  int32_t probe_packet_size();
+  Rudp *rudp();
 };
 
 /** 
@@ -118,9 +229,19 @@ class Client : public Endpoint {
   int32_t detach();
 
   void set_socket(int32_t sock);
+  void set_socket(int32_t sock, const bool nonblocking);
   void set_address_info(struct addrinfo *info);  
+  void set_address_info(struct addrinfo *info, const bool pooled);
+  int32_t set_peer_address(const struct sockaddr *addr, socklen_t addr_len);
 
   int32_t get_socket();
+  int32_t set_nonblocking(const bool on);
+
+  friend class Server;
+  friend class Reactor;
+
+ private:
+  int32_t m_socket;
 };
 
 /** 
@@ -163,16 +284,47 @@ class Server : public Endpoint {
   int32_t m_backlog;
   int32_t m_epfd;
   struct address_storage *m_server_address;
+  struct epoll_event *m_events;
+  int32_t m_events_len;
+  int32_t m_events_next;
+  bool m_edge_triggered;
+  bool m_reuse_port;
+  bool m_keep_alive;
+  int32_t m_accept_batch;
+  bool m_sessions_on;
+  int32_t m_session_timeout;
+  bool m_peer_sockets;
+  struct address_storage *m_buffered;
+  bool m_fiber_listen;
   
  public:
   Server();
   Server(const Endpoint::Protocol proto);
   ~Server();
 
+  void set_edge_triggered(const bool on);
+  bool edge_triggered();
+  void set_reuse_port(const bool on);
+  bool reuse_port();
+  void set_accept_batch(const int32_t batch);
+  int32_t accept_batch();
+  void set_keep_alive(const bool on);
+  bool keep_alive();
+  void set_sessions(const bool on);
+  bool sessions();
+  void set_session_timeout(const int32_t sec);
+  void set_peer_sockets(const bool on);
+  bool peer_sockets();
+  int32_t set_nonblocking(const bool on);
+
   int32_t start(const char *host, const char *service, int32_t backlog);
   int32_t stop();
   int32_t get_client(Client *client);
-  
+  int32_t rearm(Client *client);
+
+ private:
+  void set_session_socket(Client *client, int32_t fd, const struct sockaddr_storage *addr,
+			  socklen_t addr_len, int32_t flags);
 };
 
 } // End of namespace
@@ -0,0 +1,885 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * libIris - A simple and scalable networking library for Linux.
+ *
+ * Copyright (C) 2014 Giorgos Kappes <geokapp@gmail.com>
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file LICENSE.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <netdb.h>
+#include <unistd.h>
+#include <errno.h>
+#include "reactor.h"
+
+using namespace iris;
+
+/**
+ * @name Reactor - Constructor.
+ *
+ * Initializes a reactor object that uses epoll. The reactor must be attached
+ * to a started server before it can run.
+ */
+Reactor::Reactor() {
+  m_backend = Reactor::Epoll; // epoll is the default.
+  m_ring = NULL;
+  m_epfd = UNUSED;
+  m_wakefd = UNUSED;
+  m_server = NULL;
+  m_handler = NULL;
+  m_watches = NULL;
+  m_watches_len = 0;
+  m_closed = NULL;
+  m_corked = NULL;
+  m_events = NULL;
+  m_running = 0;
+  m_exclusive = false;
+}
+
+/**
+ * @name Reactor - Constructor.
+ * @param backend: The event notification backend (Epoll or IoUring).
+ *
+ * Initializes a reactor object that uses the given backend. The reactor must
+ * be attached to a started server before it can run.
+ */
+Reactor::Reactor(const Reactor::Backend backend) {
+  m_backend = backend;
+  m_ring = NULL;
+  m_epfd = UNUSED;
+  m_wakefd = UNUSED;
+  m_server = NULL;
+  m_handler = NULL;
+  m_watches = NULL;
+  m_watches_len = 0;
+  m_closed = NULL;
+  m_corked = NULL;
+  m_events = NULL;
+  m_running = 0;
+  m_exclusive = false;
+}
+
+/**
+ * @name Reactor - Destructor.
+ *
+ * Destroys a reactor object. Any connection that is still registered is
+ * closed.
+ */
+Reactor::~Reactor() {
+  detach();
+}
+
+/**
+ * @name backend - Get the backend.
+ *
+ * This function returns the event notification backend of the reactor.
+ *
+ * @return The backend.
+ */
+Reactor::Backend Reactor::backend() {
+  return m_backend;
+}
+
+/**
+ * @name server - Get the server.
+ *
+ * This function returns the server endpoint the reactor is attached to.
+ *
+ * @return The server endpoint or NULL.
+ */
+Server *Reactor::server() {
+  return m_server;
+}
+
+/**
+ * @name handler - Get the handler.
+ *
+ * This function returns the handler of the reactor.
+ *
+ * @return The handler or NULL.
+ */
+Reactor::Handler *Reactor::handler() {
+  return m_handler;
+}
+
+/**
+ * @name set_exclusive - Set exclusive wake ups.
+ * @param on: True to register the listening sockets with EPOLLEXCLUSIVE.
+ *
+ * Use this method before attach when several reactors, each in its own
+ * thread, attach to the same server endpoint. A new connection then wakes up
+ * one of the waiting reactors instead of all of them. The server's sockets
+ * must be non-blocking.
+ *
+ * @return Void.
+ */
+void Reactor::set_exclusive(const bool on) {
+  m_exclusive = on;
+}
+
+/**
+ * @name attach - Attach to a server endpoint.
+ * @param server: A started server endpoint.
+ * @param handler: The handler whose callbacks receive the events.
+ *
+ * This function creates the epoll set, or the io_uring instance, of the reactor
+ * and registers the listening sockets of the server into it. On error the
+ * reactor releases what it has set up and stays detached, so it can be attached
+ * again.
+ *
+ * @return 0: success, 1: error.
+ */
+int32_t Reactor::attach(Server *server, Handler *handler) {
+  struct epoll_event ev;
+  struct watch *w;
+  Client *listener;
+  uint32_t events;
+  int32_t i, created = 0;
+
+  // Check the arguments.
+  if (!server || !handler) {
+    fprintf(stderr, "(attach) Error: server and handler must not be NULL.\n");
+    return 1;
+  }
+  if (m_handler) {
+    fprintf(stderr, "(attach) Error: The reactor is already attached.\n");
+    return 1;
+  }
+  if (!server->sockets() || server->sockets_len() <= 0) {
+    fprintf(stderr, "(attach) Error: The server endpoint is not started.\n");
+    return 1;
+  }
+  m_server = server;
+  m_handler = handler;
+
+  m_events = (struct epoll_event *)malloc(MAX_EPOLL_EVENTS_PER_RUN * sizeof(struct epoll_event));
+  if (!m_events) {
+    fprintf(stderr, "(attach) Error: No free memory left.\n");
+    detach();
+    return 1;
+  }
+
+  // Create the descriptor used to wake the loop.
+  m_wakefd = eventfd(0, EFD_NONBLOCK);
+  if (m_wakefd < 0) {
+    m_wakefd = UNUSED;
+    fprintf(stderr, "(attach) Error: eventfd failed.\n");
+    detach();
+    return 1;
+  }
+
+  if (m_backend == Reactor::IoUring) {
+    if (uring_attach()) {
+      detach();
+      return 1;
+    }
+  } else {
+    // Create the epoll descriptor.
+    m_epfd = epoll_create(EPOLL_QUEUE_LEN);
+    if (m_epfd < 0) {
+      m_epfd = UNUSED;
+      fprintf(stderr, "(attach) Error: epoll_create failed.\n");
+      detach();
+      return 1;
+    }
+    ev.events = EPOLLIN;
+    ev.data.ptr = NULL;
+    if (epoll_ctl(m_epfd, EPOLL_CTL_ADD, m_wakefd, &ev) < 0) {
+      fprintf(stderr, "(attach) Error: epoll_ctl failed.\n");
+      detach();
+      return 1;
+    }
+  }
+
+  //
+  // Register the listening sockets. A UDP socket has no connections to
+  // accept, so the datagrams are reported as readable events on a client
+  // that shares the server's socket.
+  //
+  events = EPOLLIN;
+  if (server->edge_triggered())
+    events |= EPOLLET;
+  if (m_exclusive)
+    events |= EPOLLEXCLUSIVE;
+  for (i = 0; i < server->sockets_len(); i++) {
+    listener = NULL;
+    if (server->protocol() == Endpoint::UDP) {
+      listener = new Client(Endpoint::UDP);
+      listener->set_socket(server->sockets()[i], server->nonblocking());
+    }
+    w = add_watch(server->sockets()[i], listener, 1, events);
+    if (!w) {
+      if (listener)
+	delete listener;
+      continue;
+    }
+    created = 1;
+  }
+
+  // If at least one server socket added to the epoll set we are ok.
+  if (created) {
+    return 0;
+  } else {
+    fprintf(stderr, "(attach) Error: Can not monitor the server sockets.\n");
+    detach();
+    return 1;
+  }
+}
+
+/**
+ * @name detach - Detach from the server endpoint.
+ *
+ * This function closes every connection that is still registered, calling
+ * the on_close callback for each one, and destroys the epoll set. The server
+ * endpoint itself is not stopped.
+ *
+ * @return 0 on success, 1 on error.
+ */
+int32_t Reactor::detach() {
+  int32_t i, result = 0;
+  struct watch *w;
+
+  for (i = 0; i < m_watches_len; i++) {
+    w = m_watches[i];
+    if (!w)
+      continue;
+    if (w->listener) {
+      if (m_epfd != UNUSED)
+	epoll_ctl(m_epfd, EPOLL_CTL_DEL, w->fd, NULL);
+      m_watches[i] = NULL;
+      if (w->client)
+	delete w->client;
+      free(w);
+    } else {
+      close_client(w->client);
+    }
+  }
+
+  // Closing the ring cancels its requests, so nothing refers to the watches.
+  if (m_ring)
+    uring_detach();
+  for (w = m_closed; w; w = w->next)
+    w->inflight = 0;
+  release();
+
+  if (m_watches)
+    free(m_watches);
+  m_watches = NULL;
+  m_watches_len = 0;
+
+  if (m_events)
+    free(m_events);
+  m_events = NULL;
+
+  if (m_wakefd != UNUSED)
+    close(m_wakefd);
+  m_wakefd = UNUSED;
+
+  if (m_epfd != UNUSED) {
+    if (close(m_epfd) < 0)
+      result = 1;
+  }
+  m_epfd = UNUSED;
+  m_server = NULL;
+  m_handler = NULL;
+  return result;
+}
+
+/**
+ * @name add - Register a connection.
+ * @param client: A connected TCP client endpoint.
+ *
+ * This function registers a connection that was not accepted by the reactor,
+ * e.g. one created with Client::attach. The reactor takes the ownership of
+ * the client object. If the server is edge triggered the client is switched
+ * to non-blocking mode.
+ *
+ * @return 0: success, 1: error.
+ */
+int32_t Reactor::add(Client *client) {
+  if (!client || client->get_socket() < 0 || !m_handler) {
+    fprintf(stderr, "(add) Error: Invalid client or detached reactor.\n");
+    return 1;
+  }
+  if (m_server->edge_triggered() && client->set_nonblocking(true))
+    return 1;
+  if (!add_watch(client->get_socket(), client, 0, connection_events()))
+    return 1;
+  return 0;
+}
+
+/**
+ * @name close_client - Close a connection.
+ * @param client: A client that is registered in the reactor.
+ *
+ * This function removes the client from the epoll set, calls the on_close
+ * callback and detaches the client. The client object is deleted after the
+ * current batch of events has been dispatched, so it remains valid until the
+ * running callback returns.
+ *
+ * @return 0: success, 1: error.
+ */
+int32_t Reactor::close_client(Client *client) {
+  struct watch *w;
+
+  w = find_watch(client);
+  if (!w || w->listener)
+    return 1;
+
+  if (m_ring)
+    uring_disarm(w);
+  else
+    epoll_ctl(m_epfd, EPOLL_CTL_DEL, w->fd, NULL);
+  m_watches[w->fd] = NULL;
+  w->fd = UNUSED;
+  m_handler->on_close(this, client);
+  client->detach();
+
+  //
+  // Defer the deletion; later events of this batch, or the io_uring requests
+  // that are still in flight, may point here.
+  //
+  w->next = m_closed;
+  m_closed = w;
+  return 0;
+}
+
+/**
+ * @name watch_writable - Monitor a connection for writing.
+ * @param client: A client that is registered in the reactor.
+ * @param on: True to receive on_writable callbacks, false to stop them.
+ *
+ * This function enables or disables the on_writable callbacks of a client.
+ *
+ * @return 0: success, 1: error.
+ */
+int32_t Reactor::watch_writable(Client *client, const bool on) {
+  struct watch *w;
+
+  w = find_watch(client);
+  if (!w)
+    return 1;
+  w->notify_writable = on;
+  return update_writable(w);
+}
+
+/**
+ * @name send_data - Send data without blocking.
+ * @param client: A client that is registered in the reactor.
+ * @param data: Pointer to the data buffer.
+ * @param data_len: Size of the data buffer.
+ *
+ * This function sends data to a TCP connection without blocking the reactor. The
+ * data that the socket can not take now are copied to the output queue of the
+ * connection, which is written when the socket becomes writable; the connection
+ * is monitored for writing only while its queue is not empty. When the queue has
+ * been written, the on_drain callback is called. The data are sent in order, and
+ * the queued data are dropped if the connection is closed. A handler that wants
+ * to slow down a fast producer can check the queue with queued. The data sent to
+ * a connection from its own on_readable or on_data callback are gathered and
+ * written with one system call when the callback returns, with either backend.
+ *
+ * @return data_len on success or -1 on error.
+ */
+int32_t Reactor::send_data(Client *client, const void *data, const size_t data_len) {
+  struct watch *w;
+  ssize_t bytes = 0;
+  size_t size;
+  char *out;
+
+  w = find_watch(client);
+  if (!w || w->listener || (!data && data_len))
+    return -1;
+
+  // Write directly while nothing is queued, unless the connection is corked.
+  if (!w->out_len && w != m_corked) {
+    bytes = send(w->fd, data, data_len, MSG_DONTWAIT | MSG_NOSIGNAL);
+    if (bytes < 0) {
+      if (errno != EAGAIN && errno != EWOULDBLOCK)
+	return -1;
+      bytes = 0;
+    }
+    if ((size_t)bytes == data_len)
+      return data_len;
+  }
+
+  // Queue the rest, moving the queued data to the front first.
+  if (w->out_off) {
+    memmove(w->out, w->out + w->out_off, w->out_len);
+    w->out_off = 0;
+  }
+  if (w->out_len + data_len - bytes > w->out_size) {
+    size = w->out_size ? w->out_size : 4096;
+    while (size < w->out_len + data_len - bytes)
+      size *= 2;
+    out = (char *)realloc(w->out, size);
+    if (!out) {
+      fprintf(stderr, "(send_data) Error: No free memory left.\n");
+      return -1;
+    }
+    w->out = out;
+    w->out_size = size;
+  }
+  memcpy(w->out + w->out_len, (const char *)data + bytes, data_len - bytes);
+  w->out_len += data_len - bytes;
+  if (w != m_corked && update_writable(w))
+    return -1;
+  return data_len;
+}
+
+/**
+ * @name queued - Get the size of the output queue.
+ * @param client: A client that is registered in the reactor.
+ *
+ * This function returns the number of bytes that send_data has queued for a
+ * client and that are not written yet.
+ *
+ * @return The number of queued bytes.
+ */
+size_t Reactor::queued(Client *client) {
+  struct watch *w;
+
+  w = find_watch(client);
+  if (!w)
+    return 0;
+  return w->out_len;
+}
+
+/**
+ * @name run_once - Dispatch one batch of events.
+ * @param timeout: The epoll_wait timeout in milliseconds, -1 to block.
+ *
+ * This function calls epoll_wait once and dispatches every ready event it
+ * returns to the handler. With the IoUring backend it submits the queued
+ * requests, waits for completions and dispatches every completion.
+ *
+ * @return The number of ready events or -1 on error.
+ */
+int32_t Reactor::run_once(int32_t timeout) {
+  struct watch *w;
+  uint64_t value;
+  int32_t i, nfds;
+
+  if (!m_handler)
+    return -1;
+  if (m_ring)
+    return uring_run_once(timeout);
+
+  nfds = epoll_wait(m_epfd, m_events, MAX_EPOLL_EVENTS_PER_RUN, timeout);
+  if (nfds < 0) {
+    if (errno == EINTR)
+      return 0;
+    return -1;
+  }
+
+  for (i = 0; i < nfds; i++) {
+    w = (struct watch *)m_events[i].data.ptr;
+    if (!w) {
+      // Somebody called stop.
+      while (read(m_wakefd, &value, sizeof(value)) > 0);
+      m_running = 0;
+      continue;
+    }
+    // Skip the connections closed by an earlier callback of this batch.
+    if (w->fd == UNUSED)
+      continue;
+    dispatch(w, m_events[i].events);
+  }
+  release();
+  return nfds;
+}
+
+/**
+ * @name run - Run the event loop.
+ *
+ * This function dispatches events until stop is called.
+ *
+ * @return 0 on success, 1 on error.
+ */
+int32_t Reactor::run() {
+  m_running = 1;
+  while (m_running) {
+    if (run_once(EPOLL_RUN_TIMEOUT) < 0) {
+      m_running = 0;
+      return 1;
+    }
+  }
+  return 0;
+}
+
+/**
+ * @name stop - Stop the event loop.
+ *
+ * This function makes run return after the current batch of events. It can
+ * be called from a callback or from another thread, even before run starts,
+ * since the request is kept in the wake up descriptor until the loop reads it.
+ *
+ * @return Void.
+ */
+void Reactor::stop() {
+  uint64_t value = 1;
+
+  if (m_wakefd != UNUSED)
+    write(m_wakefd, &value, sizeof(value));
+}
+
+/**
+ * @name add_watch - Register a descriptor.
+ * @param fd: The socket descriptor.
+ * @param client: The client that owns the descriptor or NULL.
+ * @param listener: 1 for a listening socket, 0 for a connection.
+ * @param events: The epoll events.
+ *
+ * This function adds a descriptor to the epoll set and to the table of
+ * watches, which is indexed by the descriptor. With the IoUring backend the
+ * requests that monitor the descriptor are queued instead.
+ *
+ * @return The new watch or NULL on error.
+ */
+struct Reactor::watch *Reactor::add_watch(int32_t fd, Client *client, int32_t listener,
+					  uint32_t events) {
+  struct epoll_event ev;
+  struct watch *w, **watches;
+  int32_t len;
+
+  // Grow the table so that it can be indexed by fd.
+  if (fd >= m_watches_len) {
+    len = m_watches_len ? m_watches_len : 64;
+    while (len <= fd)
+      len *= 2;
+    watches = (struct watch **)realloc(m_watches, len * sizeof(struct watch *));
+    if (!watches) {
+      fprintf(stderr, "(add_watch) Error: No free memory left.\n");
+      return NULL;
+    }
+    memset(watches + m_watches_len, 0, (len - m_watches_len) * sizeof(struct watch *));
+    m_watches = watches;
+    m_watches_len = len;
+  }
+
+  w = (struct watch *)malloc(sizeof(struct watch));
+  if (!w) {
+    fprintf(stderr, "(add_watch) Error: No free memory left.\n");
+    return NULL;
+  }
+  w->fd = fd;
+  w->listener = listener;
+  w->events = events;
+  w->client = client;
+  w->next = NULL;
+  w->inflight = 0;
+  w->armed = 0;
+  w->notify_writable = false;
+  w->out = NULL;
+  w->out_off = 0;
+  w->out_len = 0;
+  w->out_size = 0;
+
+  if (m_ring) {
+    m_watches[fd] = w;
+    uring_arm(w);
+    return w;
+  }
+
+  ev.events = events;
+  ev.data.ptr = (void *)w;
+  if (epoll_ctl(m_epfd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+    free(w);
+    return NULL;
+  }
+  m_watches[fd] = w;
+  return w;
+}
+
+/**
+ * @name find_watch - Find the watch of a client.
+ * @param client: A client endpoint.
+ *
+ * This function looks up the watch of a registered client.
+ *
+ * @return The watch or NULL if the client is not registered.
+ */
+struct Reactor::watch *Reactor::find_watch(Client *client) {
+  int32_t fd;
+
+  if (!client)
+    return NULL;
+  fd = client->get_socket();
+  if (fd < 0 || fd >= m_watches_len || !m_watches[fd] || m_watches[fd]->client != client)
+    return NULL;
+  return m_watches[fd];
+}
+
+/**
+ * @name connection_events - Get the events of a connection.
+ *
+ * This function returns the epoll events a new connection is registered with.
+ *
+ * @return The epoll events.
+ */
+uint32_t Reactor::connection_events() {
+  if (m_server->edge_triggered())
+    return EPOLLIN | EPOLLET;
+  return EPOLLIN;
+}
+
+/**
+ * @name accept_client - Accept new connections.
+ * @param w: The watch of a listening socket.
+ *
+ * This function accepts a connection on a listening socket, registers it
+ * and calls the on_accept callback. It repeats for up to the server's accept
+ * batch connections, or in edge triggered mode until accept fails with EAGAIN,
+ * and then the accepted sockets are non-blocking.
+ *
+ * @return Void.
+ */
+void Reactor::accept_client(struct watch *w) {
+  struct sockaddr_storage client_addr;
+  socklen_t client_sin_size;
+  Client *client;
+  int32_t accept_sd, accepted = 0;
+  bool edge_triggered = m_server->edge_triggered();
+
+  do {
+    client_sin_size = sizeof(client_addr);
+    accept_sd = accept4(w->fd, (struct sockaddr *)&client_addr, &client_sin_size,
+			SOCK_CLOEXEC | (edge_triggered ? SOCK_NONBLOCK : 0));
+    if (accept_sd < 0)
+      return;
+
+    client = new Client(m_server->protocol());
+    client->set_socket(accept_sd, edge_triggered);
+    if (client->set_peer_address((struct sockaddr *)&client_addr, client_sin_size) ||
+	!add_watch(accept_sd, client, 0, connection_events())) {
+      client->detach();
+      delete client;
+      continue;
+    }
+    m_handler->on_accept(this, client);
+  } while (edge_triggered ||
+	   (m_server->nonblocking() && ++accepted < m_server->accept_batch()));
+}
+
+/**
+ * @name on_data - Handle received data.
+ * @param reactor: The reactor.
+ * @param client: The client that sent the data.
+ * @param data: The data.
+ * @param data_len: The size of the data.
+ *
+ * The default implementation makes the data readable with receive_data and
+ * calls on_readable, so a handler written for the Epoll backend works with
+ * the IoUring backend as well.
+ *
+ * @return Void.
+ */
+void Reactor::Handler::on_data(Reactor *reactor, Client *client, const void *data,
+			       size_t data_len) {
+  reactor->readable_data(client, data, data_len);
+}
+
+/**
+ * @name readable_data - Offer received data to on_readable.
+ * @param client: The client that sent the data.
+ * @param data: The data.
+ * @param data_len: The size of the data.
+ *
+ * This function appends the data to the read buffer of the client and calls
+ * on_readable while the handler consumes the buffered data, e.g. with
+ * receive_data. The data that it leaves are offered again with the next data
+ * of the client. on_readable must not read past the buffered data, since the
+ * io_uring receive of the connection reads the socket.
+ *
+ * @return Void.
+ */
+void Reactor::readable_data(Client *client, const void *data, const size_t data_len) {
+  size_t buffered = client->m_read_end - client->m_read_start;
+  size_t size;
+
+  if (!client->m_read || client->m_read_size < buffered + data_len) {
+    size = buffered + data_len < READ_BUFFER_SIZE ? READ_BUFFER_SIZE : buffered + data_len;
+    if (client->set_read_buffer(size)) {
+      close_client(client);
+      return;
+    }
+  } else if (client->m_read_end + data_len > client->m_read_size) {
+    memmove(client->m_read, client->m_read + client->m_read_start, buffered);
+    client->m_read_start = 0;
+    client->m_read_end = buffered;
+  }
+  memcpy(client->m_read + client->m_read_end, data, data_len);
+  client->m_read_end += data_len;
+
+  do {
+    buffered = client->buffered();
+    m_handler->on_readable(this, client);
+  } while (find_watch(client) && client->buffered() && client->buffered() < buffered);
+}
+
+/**
+ * @name dispatch - Dispatch an event.
+ * @param w: The watch of the ready descriptor.
+ * @param events: The ready epoll events.
+ *
+ * This function calls the handler's callbacks for the ready events of a
+ * descriptor. A hang up or an error closes the connection after its pending
+ * data have been offered to on_readable.
+ *
+ * @return Void.
+ */
+void Reactor::dispatch(struct watch *w, uint32_t events) {
+  if (w->listener) {
+    if (m_server->protocol() == Endpoint::TCP)
+      accept_client(w);
+    else
+      m_handler->on_readable(this, w->client);
+    return;
+  }
+
+  if (events & EPOLLIN) {
+    m_corked = w;
+    m_handler->on_readable(this, w->client);
+    uncork(w);
+  }
+  if (w->fd != UNUSED && (events & EPOLLOUT))
+    writable(w);
+  if (w->fd != UNUSED && (events & (EPOLLERR | EPOLLHUP)))
+    close_client(w->client);
+}
+
+/**
+ * @name update_writable - Update the write monitoring.
+ * @param w: The watch of a connection.
+ *
+ * This function monitors a connection for writing while its output queue is
+ * not empty or the handler has asked for on_writable callbacks.
+ *
+ * @return 0: success, 1: error.
+ */
+int32_t Reactor::update_writable(struct watch *w) {
+  struct epoll_event ev;
+  uint32_t events;
+
+  if (w->notify_writable || w->out_len)
+    events = w->events | EPOLLOUT;
+  else
+    events = w->events & ~EPOLLOUT;
+  if (events == w->events)
+    return 0;
+  if (m_ring)
+    return uring_watch_writable(w, events);
+  ev.events = events;
+  ev.data.ptr = (void *)w;
+  if (epoll_ctl(m_epfd, EPOLL_CTL_MOD, w->fd, &ev) < 0)
+    return 1;
+  w->events = events;
+  return 0;
+}
+
+/**
+ * @name write_queue - Write the output queue.
+ * @param w: The watch of a connection.
+ *
+ * This function writes the output queue of a connection until the socket is
+ * full, and monitors the connection for writing only if data are left. If the
+ * queue is written, on_drain is called. A write error closes the connection.
+ *
+ * @return 0: success, 1: the connection was closed.
+ */
+int32_t Reactor::write_queue(struct watch *w) {
+  ssize_t bytes;
+
+  if (!w->out_len)
+    return 0;
+  while (w->out_len) {
+    bytes = send(w->fd, w->out + w->out_off, w->out_len, MSG_DONTWAIT | MSG_NOSIGNAL);
+    if (bytes < 0) {
+      if (errno == EAGAIN || errno == EWOULDBLOCK)
+	break;
+      close_client(w->client);
+      return 1;
+    }
+    w->out_off += bytes;
+    w->out_len -= bytes;
+  }
+  if (!w->out_len)
+    w->out_off = 0;
+  update_writable(w);
+  if (!w->out_len) {
+    m_handler->on_drain(this, w->client);
+    if (w->fd == UNUSED)
+      return 1;
+  }
+  return 0;
+}
+
+/**
+ * @name writable - Handle a writable connection.
+ * @param w: The watch of a connection.
+ *
+ * This function writes the output queue of a connection, and calls on_writable
+ * once the queue is empty if the handler has asked for it.
+ *
+ * @return Void.
+ */
+void Reactor::writable(struct watch *w) {
+  if (w->out_len && (write_queue(w) || w->out_len))
+    return;
+  if (w->notify_writable)
+    m_handler->on_writable(this, w->client);
+}
+
+/**
+ * @name uncork - Write the data gathered by a callback.
+ * @param w: The watch whose callback returned.
+ *
+ * This function ends the gathering of the data that a callback sent to its own
+ * connection and writes them with one system call. Both backends cork the
+ * connection around on_readable and on_data.
+ *
+ * @return Void.
+ */
+void Reactor::uncork(struct watch *w) {
+  m_corked = NULL;
+  if (w->fd != UNUSED && w->out_len && !(w->events & EPOLLOUT))
+    write_queue(w);
+}
+
+/**
+ * @name release - Release the closed connections.
+ *
+ * This function deletes the clients and the watches of the connections that
+ * were closed during the last batch of events. Watches that io_uring requests
+ * still refer to are kept until those requests complete.
+ *
+ * @return Void.
+ */
+void Reactor::release() {
+  struct watch *w, **prev = &m_closed;
+
+  while (*prev) {
+    w = *prev;
+    if (w->inflight > 0) {
+      prev = &w->next;
+      continue;
+    }
+    *prev = w->next;
+    delete w->client;
+    if (w->out)
+      free(w->out);
+    free(w);
+  }
+}
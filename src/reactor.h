@@ -0,0 +1,180 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * libIris - A simple and scalable networking library for Linux.
+ *
+ * Copyright (C) 2014 Giorgos Kappes <geokapp@gmail.com>
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file LICENSE.
+ *
+ */
+
+#ifndef LIBIRIS_REACTOR_H
+#define LIBIRIS_REACTOR_H
+
+#include "libiris.h"
+
+namespace iris {
+
+#define URING_QUEUE_LEN          256
+#define URING_COMPLETION_LEN     4096
+#define URING_BUFFERS            256
+#define URING_BUFFER_SIZE        4096
+
+struct uring;
+
+/**
+ * @name Reactor - The event loop object.
+ *
+ * This class defines a callback driven event loop on top of a started server
+ * endpoint. The reactor owns its own epoll set, keeps the accepted connections
+ * registered in it and dispatches every ready event returned by one epoll_wait
+ * call to the callbacks of a user supplied handler. The reactor owns the Client
+ * objects of the connections it accepts and deletes them after they are closed.
+ *
+ * The reactor can be built on io_uring instead of epoll. The IoUring backend keeps
+ * a multishot accept armed on every listening socket and a multishot recv on every
+ * connection, with the data received into a ring of provided buffers, registers the
+ * sockets as fixed files and submits all the queued requests with the same system
+ * call that waits for completions. The received data are passed to on_data, which
+ * by default buffers them in the client and calls on_readable until the handler
+ * stops consuming them, so receive_data returns the buffered data. on_readable of
+ * a UDP server must drain the socket, which is made non-blocking. The backend needs
+ * Linux 6.0 or newer, and attach fails on older kernels.
+ * For example:
+ * ------------------------------------
+ * class Echo : public Reactor::Handler {
+ *   void on_readable(Reactor *reactor, Client *client) {
+ *     int32_t bytes = client->receive_data(buf, buf_len);
+ *     if (bytes <= 0)
+ *       reactor->close_client(client);
+ *     else
+ *       client->send_data(buf, bytes);
+ *   }
+ * };
+ *
+ * Echo echo;
+ * Reactor *reactor = new Reactor;
+ * status = server->start(NULL, "8000", 10);
+ * if (!status && !reactor->attach(server, &echo))
+ *   reactor->run();
+ * reactor->detach();
+ * delete reactor;
+ * ------------------------------------
+ */
+class Reactor {
+ public:
+  enum Backend {
+    Epoll,
+    IoUring
+  };
+
+  /**
+   * Handler - Event callbacks.
+   *
+   * The reactor calls the handler's methods for the events of its connections.
+   * The default implementations do nothing. If the server is edge triggered,
+   * on_readable must drain the client until receive_data fails with EAGAIN.
+   * on_drain is called when the output queue of a client has been written.
+   * With the IoUring backend on_data receives the data of a connection; its
+   * default implementation offers them to on_readable.
+   */
+  class Handler {
+   public:
+    virtual ~Handler() {}
+    virtual void on_accept(Reactor *, Client *) {}
+    virtual void on_readable(Reactor *, Client *) {}
+    virtual void on_data(Reactor *reactor, Client *client, const void *data,
+			 size_t data_len);
+    virtual void on_writable(Reactor *, Client *) {}
+    virtual void on_drain(Reactor *, Client *) {}
+    virtual void on_close(Reactor *, Client *) {}
+  };
+
+  /**
+   * watch - Registered descriptor.
+   *
+   * The watch struct is kept in the epoll set for every descriptor that
+   * the reactor monitors.
+   */
+  struct watch {
+    int32_t fd;
+    int32_t listener;
+    uint32_t events;
+    Client *client;
+    struct watch *next;
+    int32_t inflight;
+    uint32_t armed;
+    bool notify_writable;
+    char *out;
+    size_t out_off;
+    size_t out_len;
+    size_t out_size;
+  };
+
+ private:
+  Backend m_backend;
+  struct uring *m_ring;
+  int32_t m_epfd;
+  int32_t m_wakefd;
+  Server *m_server;
+  Handler *m_handler;
+  struct watch **m_watches;
+  int32_t m_watches_len;
+  struct watch *m_closed;
+  struct watch *m_corked;
+  struct epoll_event *m_events;
+  int32_t m_running;
+  bool m_exclusive;
+
+ public:
+  Reactor();
+  Reactor(const Backend backend);
+  ~Reactor();
+
+  void set_exclusive(const bool on);
+  int32_t attach(Server *server, Handler *handler);
+  int32_t detach();
+
+  int32_t add(Client *client);
+  int32_t close_client(Client *client);
+  int32_t watch_writable(Client *client, const bool on);
+  int32_t send_data(Client *client, const void *data, const size_t data_len);
+  size_t queued(Client *client);
+
+  int32_t run_once(int32_t timeout);
+  int32_t run();
+  void stop();
+
+  Backend backend();
+  Server *server();
+  Handler *handler();
+
+ private:
+  struct watch *add_watch(int32_t fd, Client *client, int32_t listener, uint32_t events);
+  struct watch *find_watch(Client *client);
+  uint32_t connection_events();
+  void accept_client(struct watch *w);
+  void dispatch(struct watch *w, uint32_t events);
+  int32_t update_writable(struct watch *w);
+  int32_t write_queue(struct watch *w);
+  void writable(struct watch *w);
+  void uncork(struct watch *w);
+  void readable_data(Client *client, const void *data, const size_t data_len);
+  void release();
+
+  int32_t uring_attach();
+  void uring_detach();
+  void uring_arm(struct watch *w);
+  void uring_disarm(struct watch *w);
+  int32_t uring_watch_writable(struct watch *w, uint32_t events);
+  int32_t uring_run_once(int32_t timeout);
+  void uring_complete(uint64_t user_data, int32_t res, uint32_t flags);
+};
+
+} // End of namespace
+
+#endif
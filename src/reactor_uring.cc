@@ -0,0 +1,781 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * libIris - A simple and scalable networking library for Linux.
+ *
+ * Copyright (C) 2014 Giorgos Kappes <geokapp@gmail.com>
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file LICENSE.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <poll.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <errno.h>
+#include <linux/io_uring.h>
+#include "reactor.h"
+
+using namespace iris;
+
+//
+// The low bits of a request's user data hold the operation, the rest the
+// address of its watch. Requests with user data 0 are not reported.
+//
+#define URING_OP_MASK            7
+#define URING_OP_ACCEPT          1
+#define URING_OP_RECV            2
+#define URING_OP_POLL            3
+#define URING_OP_WAKE            4
+#define URING_OP_FILES           5
+#define URING_OP_BACKOFF         6
+
+#define URING_ARMED_ACCEPT       1
+#define URING_ARMED_RECV         2
+#define URING_ARMED_POLL         4
+#define URING_ARMED_FIXED        8
+#define URING_ARMED_BACKOFF      16
+
+#define URING_MAX_FILES          65536
+
+namespace iris {
+
+/**
+ * uring - An io_uring instance.
+ *
+ * The uring struct holds the mapped submission and completion rings, the
+ * ring of provided receive buffers and the size of the fixed file table.
+ */
+struct uring {
+  int32_t fd;
+  void *sq_ptr;
+  size_t sq_len;
+  void *cq_ptr;
+  size_t cq_len;
+  struct io_uring_sqe *sqes;
+  size_t sqes_len;
+  uint32_t *sq_head;
+  uint32_t *sq_tail;
+  uint32_t *sq_array;
+  uint32_t sq_mask;
+  uint32_t sq_entries;
+  uint32_t sq_local_tail;
+  uint32_t to_submit;
+  uint32_t *cq_head;
+  uint32_t *cq_tail;
+  uint32_t cq_mask;
+  struct io_uring_cqe *cqes;
+  struct io_uring_buf_ring *buf_ring;
+  size_t buf_ring_len;
+  uint16_t buf_tail;
+  char *bufs;
+  int32_t files_len;
+};
+
+} // End of namespace
+
+// The value used to clear a slot of the fixed file table.
+static const int32_t uring_no_file = -1;
+
+// The time a listening socket waits after accept has run out of resources.
+static struct __kernel_timespec uring_backoff = {0, 100000000};
+
+/**
+ * @name uring_setup - Create an io_uring instance.
+ * @param r: The instance.
+ *
+ * This function creates the instance and maps its rings.
+ *
+ * @return 0: success, 1: error.
+ */
+static int32_t uring_setup(struct uring *r) {
+  struct io_uring_params p;
+
+  memset(&p, 0, sizeof(p));
+  p.flags = IORING_SETUP_CQSIZE | IORING_SETUP_SUBMIT_ALL | IORING_SETUP_COOP_TASKRUN;
+  p.cq_entries = URING_COMPLETION_LEN;
+  r->fd = syscall(__NR_io_uring_setup, URING_QUEUE_LEN, &p);
+  if (r->fd < 0 && errno == EINVAL) {
+    // Older kernels do not know the optional flags.
+    memset(&p, 0, sizeof(p));
+    p.flags = IORING_SETUP_CQSIZE;
+    p.cq_entries = URING_COMPLETION_LEN;
+    r->fd = syscall(__NR_io_uring_setup, URING_QUEUE_LEN, &p);
+  }
+  if (r->fd < 0)
+    return 1;
+
+  r->sq_len = p.sq_off.array + p.sq_entries * sizeof(uint32_t);
+  r->cq_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+  if (p.features & IORING_FEAT_SINGLE_MMAP) {
+    if (r->cq_len > r->sq_len)
+      r->sq_len = r->cq_len;
+    r->cq_len = r->sq_len;
+  }
+  r->sq_ptr = mmap(NULL, r->sq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+		   r->fd, IORING_OFF_SQ_RING);
+  if (r->sq_ptr == MAP_FAILED) {
+    r->sq_ptr = NULL;
+    return 1;
+  }
+  if (p.features & IORING_FEAT_SINGLE_MMAP) {
+    r->cq_ptr = r->sq_ptr;
+  } else {
+    r->cq_ptr = mmap(NULL, r->cq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+		     r->fd, IORING_OFF_CQ_RING);
+    if (r->cq_ptr == MAP_FAILED) {
+      r->cq_ptr = NULL;
+      return 1;
+    }
+  }
+  r->sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+  r->sqes = (struct io_uring_sqe *)mmap(NULL, r->sqes_len, PROT_READ | PROT_WRITE,
+					MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQES);
+  if (r->sqes == MAP_FAILED) {
+    r->sqes = NULL;
+    return 1;
+  }
+
+  r->sq_head = (uint32_t *)((char *)r->sq_ptr + p.sq_off.head);
+  r->sq_tail = (uint32_t *)((char *)r->sq_ptr + p.sq_off.tail);
+  r->sq_array = (uint32_t *)((char *)r->sq_ptr + p.sq_off.array);
+  r->sq_mask = *(uint32_t *)((char *)r->sq_ptr + p.sq_off.ring_mask);
+  r->sq_entries = p.sq_entries;
+  r->sq_local_tail = *r->sq_tail;
+  r->cq_head = (uint32_t *)((char *)r->cq_ptr + p.cq_off.head);
+  r->cq_tail = (uint32_t *)((char *)r->cq_ptr + p.cq_off.tail);
+  r->cq_mask = *(uint32_t *)((char *)r->cq_ptr + p.cq_off.ring_mask);
+  r->cqes = (struct io_uring_cqe *)((char *)r->cq_ptr + p.cq_off.cqes);
+  return 0;
+}
+
+/**
+ * @name uring_probe - Check the features of the kernel.
+ * @param r: The instance.
+ *
+ * This function checks that the kernel supports the requests that the reactor
+ * queues. The multishot accept and receive and the rings of provided buffers have
+ * no opcodes of their own; multishot receive, the last of them, came with the
+ * same kernel (6.0) as IORING_OP_SEND_ZC, so that opcode stands for them.
+ *
+ * @return 0: success, 1: error.
+ */
+static int32_t uring_probe(struct uring *r) {
+  static const uint8_t ops[] = {IORING_OP_ACCEPT, IORING_OP_RECV, IORING_OP_POLL_ADD,
+				IORING_OP_POLL_REMOVE, IORING_OP_ASYNC_CANCEL,
+				IORING_OP_FILES_UPDATE, IORING_OP_TIMEOUT,
+				IORING_OP_TIMEOUT_REMOVE, IORING_OP_SEND_ZC};
+  struct io_uring_probe *probe;
+  size_t i, len;
+  int32_t result = 0;
+
+  len = sizeof(struct io_uring_probe) + 256 * sizeof(struct io_uring_probe_op);
+  probe = (struct io_uring_probe *)malloc(len);
+  if (!probe)
+    return 1;
+  memset(probe, 0, len);
+  if (syscall(__NR_io_uring_register, r->fd, IORING_REGISTER_PROBE, probe, 256) < 0) {
+    free(probe);
+    return 1;
+  }
+  for (i = 0; i < sizeof(ops); i++) {
+    if (ops[i] > probe->last_op || !(probe->ops[ops[i]].flags & IO_URING_OP_SUPPORTED))
+      result = 1;
+  }
+  free(probe);
+  return result;
+}
+
+/**
+ * @name uring_enter - Submit requests and wait for completions.
+ * @param r: The instance.
+ * @param min_complete: The number of completions to wait for.
+ * @param timeout: The timeout in milliseconds, -1 to block.
+ *
+ * This function submits all the queued requests with one system call, which
+ * also waits for completions if min_complete is positive.
+ *
+ * @return 0: success, -1: error.
+ */
+static int32_t uring_enter(struct uring *r, uint32_t min_complete, int32_t timeout) {
+  struct io_uring_getevents_arg arg;
+  struct __kernel_timespec ts;
+  uint32_t flags = 0;
+  void *argp = NULL;
+  size_t arg_len = 0;
+  int32_t ret;
+
+  __atomic_store_n(r->sq_tail, r->sq_local_tail, __ATOMIC_RELEASE);
+  if (min_complete) {
+    flags |= IORING_ENTER_GETEVENTS;
+    if (timeout >= 0) {
+      ts.tv_sec = timeout / 1000;
+      ts.tv_nsec = (timeout % 1000) * 1000000L;
+      memset(&arg, 0, sizeof(arg));
+      arg.sigmask_sz = _NSIG / 8;
+      arg.ts = (uint64_t)(uintptr_t)&ts;
+      flags |= IORING_ENTER_EXT_ARG;
+      argp = &arg;
+      arg_len = sizeof(arg);
+    }
+  } else if (!r->to_submit) {
+    return 0;
+  }
+
+  ret = syscall(__NR_io_uring_enter, r->fd, r->to_submit, min_complete, flags,
+		argp, arg_len);
+  if (ret < 0) {
+    if (errno == EINTR || errno == ETIME || errno == EBUSY)
+      return 0;
+    return -1;
+  }
+  r->to_submit -= ((uint32_t)ret < r->to_submit) ? ret : r->to_submit;
+  return 0;
+}
+
+/**
+ * @name uring_get_sqe - Get a submission queue entry.
+ * @param r: The instance.
+ *
+ * This function returns a cleared entry of the submission queue. The entry is
+ * submitted by the next uring_enter call. If the queue is full the queued
+ * entries are submitted first.
+ *
+ * @return The entry or NULL on error.
+ */
+static struct io_uring_sqe *uring_get_sqe(struct uring *r) {
+  struct io_uring_sqe *sqe;
+  uint32_t head, index;
+
+  head = __atomic_load_n(r->sq_head, __ATOMIC_ACQUIRE);
+  if (r->sq_local_tail - head >= r->sq_entries) {
+    if (uring_enter(r, 0, 0) < 0)
+      return NULL;
+    head = __atomic_load_n(r->sq_head, __ATOMIC_ACQUIRE);
+    if (r->sq_local_tail - head >= r->sq_entries)
+      return NULL;
+  }
+  index = r->sq_local_tail & r->sq_mask;
+  sqe = &r->sqes[index];
+  memset(sqe, 0, sizeof(*sqe));
+  r->sq_array[index] = index;
+  r->sq_local_tail++;
+  r->to_submit++;
+  return sqe;
+}
+
+/**
+ * @name uring_put_buffer - Return a buffer to the kernel.
+ * @param r: The instance.
+ * @param bid: The buffer id.
+ *
+ * This function adds a receive buffer back to the ring of provided buffers.
+ *
+ * @return Void.
+ */
+static void uring_put_buffer(struct uring *r, uint16_t bid) {
+  struct io_uring_buf *buf;
+
+  //
+  // The ring is an array of io_uring_buf entries whose tail overlays the
+  // first entry. Index it directly, since the flexible array member of
+  // io_uring_buf_ring does not start at offset 0 in C++.
+  //
+  buf = (struct io_uring_buf *)r->buf_ring + (r->buf_tail & (URING_BUFFERS - 1));
+  buf->addr = (uint64_t)(uintptr_t)(r->bufs + (size_t)bid * URING_BUFFER_SIZE);
+  buf->len = URING_BUFFER_SIZE;
+  buf->bid = bid;
+  r->buf_tail++;
+  __atomic_store_n(&r->buf_ring->tail, r->buf_tail, __ATOMIC_RELEASE);
+}
+
+/**
+ * @name uring_free - Destroy an io_uring instance.
+ * @param r: The instance.
+ *
+ * This function closes the instance, which cancels its requests, and releases
+ * its memory.
+ *
+ * @return Void.
+ */
+static void uring_free(struct uring *r) {
+  if (r->fd >= 0)
+    close(r->fd);
+  if (r->sqes)
+    munmap(r->sqes, r->sqes_len);
+  if (r->cq_ptr && r->cq_ptr != r->sq_ptr)
+    munmap(r->cq_ptr, r->cq_len);
+  if (r->sq_ptr)
+    munmap(r->sq_ptr, r->sq_len);
+  if (r->buf_ring)
+    munmap(r->buf_ring, r->buf_ring_len);
+  if (r->bufs)
+    free(r->bufs);
+  free(r);
+}
+
+/**
+ * @name uring_attach - Create the io_uring instance.
+ *
+ * This function creates the io_uring instance of the reactor, checks that the
+ * kernel supports its requests, registers its provided buffers and its sparse
+ * fixed file table, and arms the request that waits for stop. It fails on kernels
+ * older than 6.0.
+ *
+ * @return 0: success, 1: error.
+ */
+int32_t Reactor::uring_attach() {
+  struct io_uring_buf_reg reg;
+  struct io_uring_sqe *sqe;
+  struct rlimit limit;
+  struct uring *r;
+  int32_t *files;
+  int32_t i;
+
+  r = (struct uring *)malloc(sizeof(struct uring));
+  if (!r) {
+    fprintf(stderr, "(attach) Error: No free memory left.\n");
+    return 1;
+  }
+  memset(r, 0, sizeof(struct uring));
+  r->fd = UNUSED;
+  m_ring = r;
+  if (uring_setup(r)) {
+    fprintf(stderr, "(attach) Error: io_uring_setup failed.\n");
+    return 1;
+  }
+  if (uring_probe(r)) {
+    fprintf(stderr, "(attach) Error: The kernel lacks the io_uring features.\n");
+    return 1;
+  }
+
+  // Register the ring of provided buffers for the multishot receives.
+  r->buf_ring_len = URING_BUFFERS * sizeof(struct io_uring_buf);
+  r->buf_ring = (struct io_uring_buf_ring *)mmap(NULL, r->buf_ring_len,
+						 PROT_READ | PROT_WRITE,
+						 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (r->buf_ring == MAP_FAILED) {
+    r->buf_ring = NULL;
+    fprintf(stderr, "(attach) Error: No free memory left.\n");
+    return 1;
+  }
+  r->bufs = (char *)malloc((size_t)URING_BUFFERS * URING_BUFFER_SIZE);
+  if (!r->bufs) {
+    fprintf(stderr, "(attach) Error: No free memory left.\n");
+    return 1;
+  }
+  memset(&reg, 0, sizeof(reg));
+  reg.ring_addr = (uint64_t)(uintptr_t)r->buf_ring;
+  reg.ring_entries = URING_BUFFERS;
+  reg.bgid = 0;
+  if (syscall(__NR_io_uring_register, r->fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+    fprintf(stderr, "(attach) Error: Can not register the io_uring buffers.\n");
+    return 1;
+  }
+  for (i = 0; i < URING_BUFFERS; i++)
+    uring_put_buffer(r, i);
+
+  //
+  // Register a sparse fixed file table indexed by descriptor. Without it the
+  // requests simply use the plain descriptors.
+  //
+  r->files_len = URING_MAX_FILES;
+  if (!getrlimit(RLIMIT_NOFILE, &limit) && limit.rlim_cur < (rlim_t)r->files_len)
+    r->files_len = limit.rlim_cur;
+  files = (int32_t *)malloc(r->files_len * sizeof(int32_t));
+  if (files) {
+    for (i = 0; i < r->files_len; i++)
+      files[i] = -1;
+    if (syscall(__NR_io_uring_register, r->fd, IORING_REGISTER_FILES, files,
+		r->files_len) < 0)
+      r->files_len = 0;
+    free(files);
+  } else {
+    r->files_len = 0;
+  }
+
+  // A UDP server's handler drains the shared socket.
+  if (m_server->protocol() == Endpoint::UDP && m_server->set_nonblocking(true)) {
+    fprintf(stderr, "(attach) Error: Can not set the server sockets non-blocking.\n");
+    return 1;
+  }
+
+  sqe = uring_get_sqe(r);
+  if (!sqe) {
+    fprintf(stderr, "(attach) Error: io_uring submission failed.\n");
+    return 1;
+  }
+  sqe->opcode = IORING_OP_POLL_ADD;
+  sqe->fd = m_wakefd;
+  sqe->len = IORING_POLL_ADD_MULTI;
+  sqe->poll32_events = POLLIN;
+  sqe->user_data = URING_OP_WAKE;
+  return 0;
+}
+
+/**
+ * @name uring_detach - Destroy the io_uring instance.
+ *
+ * This function closes the io_uring instance of the reactor.
+ *
+ * @return Void.
+ */
+void Reactor::uring_detach() {
+  uring_free(m_ring);
+  m_ring = NULL;
+}
+
+/**
+ * @name uring_arm - Queue the requests of a watch.
+ * @param w: The watch of a new descriptor.
+ *
+ * This function installs the descriptor into the fixed file table and queues
+ * a multishot accept for a TCP listening socket, a multishot poll for a UDP
+ * socket, or a multishot recv for a connection.
+ *
+ * @return Void.
+ */
+void Reactor::uring_arm(struct watch *w) {
+  struct io_uring_sqe *sqe;
+  int32_t fixed;
+
+  if (!(w->armed & URING_ARMED_FIXED) && w->fd < m_ring->files_len) {
+    sqe = uring_get_sqe(m_ring);
+    if (sqe) {
+      //
+      // The descriptor is read when the request is submitted. The request
+      // that uses the fixed file is linked to the update, so it starts after
+      // it, and is cancelled if the update fails.
+      //
+      sqe->opcode = IORING_OP_FILES_UPDATE;
+      sqe->fd = -1;
+      sqe->addr = (uint64_t)(uintptr_t)&w->fd;
+      sqe->len = 1;
+      sqe->off = w->fd;
+      sqe->flags = IOSQE_CQE_SKIP_SUCCESS | IOSQE_IO_LINK;
+      sqe->user_data = (uint64_t)(uintptr_t)w | URING_OP_FILES;
+      w->armed |= URING_ARMED_FIXED;
+    }
+  }
+  fixed = (w->armed & URING_ARMED_FIXED) ? IOSQE_FIXED_FILE : 0;
+
+  sqe = uring_get_sqe(m_ring);
+  if (!sqe)
+    return;
+  sqe->fd = w->fd;
+  sqe->flags = fixed;
+  if (w->listener && m_server->protocol() == Endpoint::TCP) {
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->accept_flags = SOCK_CLOEXEC;
+    sqe->user_data = (uint64_t)(uintptr_t)w | URING_OP_ACCEPT;
+    w->armed |= URING_ARMED_ACCEPT;
+  } else if (w->listener) {
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->len = IORING_POLL_ADD_MULTI;
+    sqe->poll32_events = POLLIN;
+    sqe->user_data = (uint64_t)(uintptr_t)w | URING_OP_POLL;
+    w->armed |= URING_ARMED_POLL;
+  } else {
+    sqe->opcode = IORING_OP_RECV;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags |= IOSQE_BUFFER_SELECT;
+    sqe->buf_group = 0;
+    sqe->user_data = (uint64_t)(uintptr_t)w | URING_OP_RECV;
+    w->armed |= URING_ARMED_RECV;
+  }
+  w->inflight++;
+}
+
+/**
+ * @name uring_disarm - Cancel the requests of a watch.
+ * @param w: The watch of a descriptor that is being closed.
+ *
+ * This function queues the cancellation of the requests of a watch and clears
+ * its slot in the fixed file table, which otherwise keeps the socket open.
+ *
+ * @return Void.
+ */
+void Reactor::uring_disarm(struct watch *w) {
+  struct io_uring_sqe *sqe;
+
+  if (w->armed & (URING_ARMED_RECV | URING_ARMED_ACCEPT)) {
+    sqe = uring_get_sqe(m_ring);
+    if (sqe) {
+      sqe->opcode = IORING_OP_ASYNC_CANCEL;
+      sqe->fd = -1;
+      sqe->addr = (uint64_t)(uintptr_t)w |
+	((w->armed & URING_ARMED_RECV) ? URING_OP_RECV : URING_OP_ACCEPT);
+    }
+  }
+  if (w->armed & URING_ARMED_POLL) {
+    sqe = uring_get_sqe(m_ring);
+    if (sqe) {
+      sqe->opcode = IORING_OP_POLL_REMOVE;
+      sqe->fd = -1;
+      sqe->addr = (uint64_t)(uintptr_t)w | URING_OP_POLL;
+    }
+  }
+  if (w->armed & URING_ARMED_BACKOFF) {
+    sqe = uring_get_sqe(m_ring);
+    if (sqe) {
+      sqe->opcode = IORING_OP_TIMEOUT_REMOVE;
+      sqe->fd = -1;
+      sqe->addr = (uint64_t)(uintptr_t)w | URING_OP_BACKOFF;
+    }
+  }
+  if (w->armed & URING_ARMED_FIXED) {
+    sqe = uring_get_sqe(m_ring);
+    if (sqe) {
+      sqe->opcode = IORING_OP_FILES_UPDATE;
+      sqe->fd = -1;
+      sqe->addr = (uint64_t)(uintptr_t)&uring_no_file;
+      sqe->len = 1;
+      sqe->off = w->fd;
+    }
+    w->armed &= ~URING_ARMED_FIXED;
+  }
+}
+
+/**
+ * @name uring_watch_writable - Monitor a connection for writing.
+ * @param w: The watch of a connection.
+ * @param events: The new events of the watch.
+ *
+ * This function queues a multishot poll for POLLOUT, or its removal.
+ *
+ * @return 0: success, 1: error.
+ */
+int32_t Reactor::uring_watch_writable(struct watch *w, uint32_t events) {
+  struct io_uring_sqe *sqe;
+
+  //
+  // A poll that is being removed re-arms itself on completion if the
+  // connection is monitored for writing again by then.
+  //
+  w->events = events;
+  if (!(events & EPOLLOUT) || !(w->armed & URING_ARMED_POLL)) {
+    sqe = uring_get_sqe(m_ring);
+    if (!sqe)
+      return 1;
+    if (events & EPOLLOUT) {
+      sqe->opcode = IORING_OP_POLL_ADD;
+      sqe->fd = w->fd;
+      sqe->flags = (w->armed & URING_ARMED_FIXED) ? IOSQE_FIXED_FILE : 0;
+      sqe->len = IORING_POLL_ADD_MULTI;
+      sqe->poll32_events = POLLOUT;
+      sqe->user_data = (uint64_t)(uintptr_t)w | URING_OP_POLL;
+      w->armed |= URING_ARMED_POLL;
+      w->inflight++;
+    } else {
+      sqe->opcode = IORING_OP_POLL_REMOVE;
+      sqe->fd = -1;
+      sqe->addr = (uint64_t)(uintptr_t)w | URING_OP_POLL;
+    }
+  }
+  return 0;
+}
+
+/**
+ * @name uring_run_once - Dispatch one batch of completions.
+ * @param timeout: The timeout in milliseconds, -1 to block.
+ *
+ * This function submits the queued requests, waits for at least one completion
+ * and dispatches every available completion.
+ *
+ * @return The number of completions or -1 on error.
+ */
+int32_t Reactor::uring_run_once(int32_t timeout) {
+  struct io_uring_cqe *cqe;
+  uint64_t user_data;
+  uint32_t head, tail, flags;
+  int32_t res, count = 0;
+
+  if (uring_enter(m_ring, timeout ? 1 : 0, timeout) < 0)
+    return -1;
+
+  head = *m_ring->cq_head;
+  tail = __atomic_load_n(m_ring->cq_tail, __ATOMIC_ACQUIRE);
+  while (head != tail) {
+    cqe = &m_ring->cqes[head & m_ring->cq_mask];
+    user_data = cqe->user_data;
+    res = cqe->res;
+    flags = cqe->flags;
+    head++;
+    __atomic_store_n(m_ring->cq_head, head, __ATOMIC_RELEASE);
+    if (user_data)
+      uring_complete(user_data, res, flags);
+    count++;
+  }
+  release();
+  return count;
+}
+
+/**
+ * @name uring_complete - Dispatch a completion.
+ * @param user_data: The user data of the request.
+ * @param res: The result of the request.
+ * @param flags: The completion flags.
+ *
+ * This function handles the completion of a request, calls the handler's
+ * callbacks and arms the request again if the kernel has stopped it.
+ *
+ * @return Void.
+ */
+void Reactor::uring_complete(uint64_t user_data, int32_t res, uint32_t flags) {
+  struct watch *w = (struct watch *)(uintptr_t)(user_data & ~(uint64_t)URING_OP_MASK);
+  bool more = flags & IORING_CQE_F_MORE;
+  struct sockaddr_storage addr;
+  struct io_uring_sqe *sqe;
+  socklen_t addr_len;
+  Client *client;
+  uint64_t value;
+  char *data = NULL;
+  uint16_t bid = 0;
+
+  switch (user_data & URING_OP_MASK) {
+  case URING_OP_WAKE:
+    // Somebody called stop.
+    while (read(m_wakefd, &value, sizeof(value)) > 0);
+    m_running = 0;
+    if (!more) {
+      sqe = uring_get_sqe(m_ring);
+      if (sqe) {
+	sqe->opcode = IORING_OP_POLL_ADD;
+	sqe->fd = m_wakefd;
+	sqe->len = IORING_POLL_ADD_MULTI;
+	sqe->poll32_events = POLLIN;
+	sqe->user_data = URING_OP_WAKE;
+      }
+    }
+    return;
+
+  case URING_OP_FILES:
+    // Only a failed update is reported. The linked request is cancelled and
+    // armed again without the fixed file.
+    w->armed &= ~URING_ARMED_FIXED;
+    return;
+
+  case URING_OP_ACCEPT:
+    if (!more) {
+      w->inflight--;
+      w->armed &= ~URING_ARMED_ACCEPT;
+    }
+    if (res >= 0) {
+      if (w->fd == UNUSED) {
+	close(res);
+	return;
+      }
+      client = new Client(m_server->protocol());
+      client->set_socket(res);
+      addr_len = sizeof(addr);
+      if (getpeername(res, (struct sockaddr *)&addr, &addr_len) < 0 ||
+	  client->set_peer_address((struct sockaddr *)&addr, addr_len) ||
+	  !add_watch(res, client, 0, EPOLLIN)) {
+	client->detach();
+	delete client;
+      } else {
+	m_handler->on_accept(this, client);
+      }
+    }
+    if (w->fd == UNUSED || (w->armed & URING_ARMED_ACCEPT))
+      return;
+
+    //
+    // The requests of a watch are only cancelled on purpose when it is closed. An
+    // accept that ran out of descriptors or memory is armed again after a while,
+    // and one that the kernel refuses is not armed again.
+    //
+    if (res == -EMFILE || res == -ENFILE || res == -ENOBUFS || res == -ENOMEM) {
+      sqe = uring_get_sqe(m_ring);
+      if (sqe) {
+	sqe->opcode = IORING_OP_TIMEOUT;
+	sqe->fd = -1;
+	sqe->addr = (uint64_t)(uintptr_t)&uring_backoff;
+	sqe->len = 1;
+	sqe->user_data = (uint64_t)(uintptr_t)w | URING_OP_BACKOFF;
+	w->armed |= URING_ARMED_BACKOFF;
+	w->inflight++;
+      }
+    } else if (res < 0 && res != -ECANCELED && res != -EINTR && res != -EAGAIN &&
+	       res != -ECONNABORTED) {
+      fprintf(stderr, "(run) Error: accept failed: %s.\n", strerror(-res));
+    } else {
+      uring_arm(w);
+    }
+    return;
+
+  case URING_OP_BACKOFF:
+    w->inflight--;
+    w->armed &= ~URING_ARMED_BACKOFF;
+    if (w->fd != UNUSED && !(w->armed & URING_ARMED_ACCEPT))
+      uring_arm(w);
+    return;
+
+  case URING_OP_RECV:
+    if (!more) {
+      w->inflight--;
+      w->armed &= ~URING_ARMED_RECV;
+    }
+    if (flags & IORING_CQE_F_BUFFER) {
+      bid = flags >> IORING_CQE_BUFFER_SHIFT;
+      data = m_ring->bufs + (size_t)bid * URING_BUFFER_SIZE;
+    }
+    if (w->fd != UNUSED) {
+      if (res > 0 && data) {
+	m_corked = w;
+	m_handler->on_data(this, w->client, data, res);
+	uncork(w);
+      }
+      else if (res == 0)
+	close_client(w->client);
+      else if (res < 0 && res != -ENOBUFS && res != -ECANCELED)
+	close_client(w->client);
+    }
+    if (data)
+      uring_put_buffer(m_ring, bid);
+
+    // The buffers are returned, so a receive stopped by ENOBUFS can go on.
+    if (w->fd != UNUSED && !(w->armed & URING_ARMED_RECV))
+      uring_arm(w);
+    return;
+
+  case URING_OP_POLL:
+    if (!more) {
+      w->inflight--;
+      w->armed &= ~URING_ARMED_POLL;
+    }
+    if (w->fd == UNUSED)
+      return;
+    if (w->listener) {
+      if (res < 0 && res != -ECANCELED)
+	return;
+      if (res > 0 && (res & POLLIN))
+	m_handler->on_readable(this, w->client);
+      if (!(w->armed & URING_ARMED_POLL))
+	uring_arm(w);
+      return;
+    }
+    if (res > 0 && (res & POLLOUT))
+      writable(w);
+    if (w->fd != UNUSED && res > 0 && (res & (POLLERR | POLLHUP))) {
+      close_client(w->client);
+      return;
+    }
+    if (w->fd != UNUSED && (w->events & EPOLLOUT) && !(w->armed & URING_ARMED_POLL))
+      uring_watch_writable(w, w->events);
+    return;
+  }
+}
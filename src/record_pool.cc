@@ -0,0 +1,174 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * libIris - A simple and scalable networking library for Linux.
+ *
+ * Copyright (C) 2014 Giorgos Kappes <geokapp@gmail.com>
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file LICENSE.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <pthread.h>
+#include "record_pool.h"
+
+using namespace iris;
+
+/**
+ * free_list - The free records of a thread.
+ *
+ * The free_list struct holds the records that a thread has released.
+ */
+struct free_list {
+  struct RecordPool::record *head;
+  int32_t len;
+};
+
+static __thread struct free_list *records = NULL;
+static pthread_key_t records_key;
+static pthread_once_t records_once = PTHREAD_ONCE_INIT;
+static uint64_t records_allocated = 0;
+
+/**
+ * @name free_records - Free the records of a thread.
+ * @param arg: The free list of the exiting thread.
+ *
+ * This function frees the free records of a thread when the thread exits.
+ *
+ * @return Void.
+ */
+static void free_records(void *arg) {
+  struct free_list *list = (struct free_list *)arg;
+  struct RecordPool::record *r;
+
+  while ((r = list->head)) {
+    list->head = r->next;
+    free(r);
+  }
+  free(list);
+}
+
+/**
+ * @name create_key - Create the thread key.
+ *
+ * This function creates the key whose destructor frees the records of an
+ * exiting thread.
+ *
+ * @return Void.
+ */
+static void create_key() {
+  pthread_key_create(&records_key, free_records);
+}
+
+/**
+ * @name acquire - Get a record.
+ *
+ * This function returns a free record of the calling thread, or allocates a
+ * new one if there is none. The addrinfo and the address_storage of the
+ * record point to its address.
+ *
+ * @return The record or NULL on error.
+ */
+struct RecordPool::record *RecordPool::acquire() {
+  struct RecordPool::record *r;
+
+  if (records && records->head) {
+    r = records->head;
+    records->head = r->next;
+    records->len--;
+  } else {
+    r = (struct RecordPool::record *)malloc(sizeof(struct RecordPool::record));
+    if (!r) {
+      fprintf(stderr, "(acquire) Error: No free memory left.\n");
+      return NULL;
+    }
+    __atomic_add_fetch(&records_allocated, 1, __ATOMIC_RELAXED);
+  }
+  memset(&r->info, 0, sizeof(struct addrinfo));
+  r->info.ai_addr = (struct sockaddr *)&r->addr;
+  r->info.ai_addrlen = sizeof(struct sockaddr_storage);
+  r->storage.fd = UNUSED;
+  r->storage.size = sizeof(struct sockaddr_storage);
+  r->storage.addr = &r->addr;
+  r->read = NULL;
+  r->read_size = r->read_start = r->read_end = 0;
+  r->next = NULL;
+  return r;
+}
+
+/**
+ * @name release - Put a record back.
+ * @param r: The record.
+ *
+ * This function adds a record to the free list of the calling thread, and frees
+ * the read buffer that it kept. If the list is full, the record is freed.
+ *
+ * @return Void.
+ */
+void RecordPool::release(struct RecordPool::record *r) {
+  if (!r)
+    return;
+  free(r->read);
+  r->read = NULL;
+  if (!records) {
+    pthread_once(&records_once, create_key);
+    records = (struct free_list *)malloc(sizeof(struct free_list));
+    if (records) {
+      records->head = NULL;
+      records->len = 0;
+      pthread_setspecific(records_key, records);
+    }
+  }
+  if (!records || records->len >= RECORD_POOL_MAX) {
+    free(r);
+    return;
+  }
+  r->next = records->head;
+  records->head = r;
+  records->len++;
+}
+
+/**
+ * @name from_info - Get the record of an addrinfo.
+ * @param info: The addrinfo of a record.
+ *
+ * This function returns the record that holds an addrinfo.
+ *
+ * @return The record.
+ */
+struct RecordPool::record *RecordPool::from_info(struct addrinfo *info) {
+  return (struct RecordPool::record *)((char *)info - offsetof(struct RecordPool::record, info));
+}
+
+/**
+ * @name from_storage - Get the record of an address_storage.
+ * @param storage: The address_storage of a record.
+ *
+ * This function returns the record that holds an address_storage.
+ *
+ * @return The record.
+ */
+struct RecordPool::record *RecordPool::from_storage(struct Server::address_storage *storage) {
+  return (struct RecordPool::record *)((char *)storage -
+				       offsetof(struct RecordPool::record, storage));
+}
+
+/**
+ * @name allocations - Get the number of allocations.
+ *
+ * This function returns the number of records that the pool has allocated
+ * since the program started, so that tests can check that get_client does
+ * not allocate memory once the pool is warm.
+ *
+ * @return The number of allocated records.
+ */
+uint64_t RecordPool::allocations() {
+  return __atomic_load_n(&records_allocated, __ATOMIC_RELAXED);
+}
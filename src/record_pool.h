@@ -0,0 +1,64 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * libIris - A simple and scalable networking library for Linux.
+ *
+ * Copyright (C) 2014 Giorgos Kappes <geokapp@gmail.com>
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file LICENSE.
+ *
+ */
+
+#ifndef LIBIRIS_RECORD_POOL_H
+#define LIBIRIS_RECORD_POOL_H
+
+#include <netdb.h>
+#include "libiris.h"
+
+namespace iris {
+
+#define RECORD_POOL_MAX          4096
+
+/**
+ * @name RecordPool - The connection record allocator.
+ *
+ * This class recycles the per-connection records of the server endpoints. A record
+ * holds the address_storage that keeps an accepted socket in the epoll set, the
+ * addrinfo of the client and the client's address, so get_client needs no memory
+ * allocation once the pool is warm. Every thread keeps its own list of free
+ * records, of at most RECORD_POOL_MAX records, so the pool takes no locks; a record
+ * released on another thread joins that thread's list. The records of a client are
+ * released when the client is detached or destroyed. A kept connection that is
+ * rearmed with data in its read buffer keeps the buffer in its record.
+ */
+class RecordPool {
+ public:
+  /**
+   * record - A connection record.
+   *
+   * The record struct holds the address information of one connection.
+   */
+  struct record {
+    struct Server::address_storage storage;
+    struct addrinfo info;
+    struct sockaddr_storage addr;
+    char *read;
+    size_t read_size;
+    size_t read_start;
+    size_t read_end;
+    struct record *next;
+  };
+
+  static struct record *acquire();
+  static void release(struct record *r);
+  static struct record *from_info(struct addrinfo *info);
+  static struct record *from_storage(struct Server::address_storage *storage);
+  static uint64_t allocations();
+};
+
+} // End of namespace
+
+#endif
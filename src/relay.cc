@@ -0,0 +1,313 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * libIris - A simple and scalable networking library for Linux.
+ *
+ * Copyright (C) 2014 Giorgos Kappes <geokapp@gmail.com>
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file LICENSE.
+ *
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include "relay.h"
+#include "fiber.h"
+
+using namespace iris;
+
+/**
+ * @name Relay - Constructor.
+ *
+ * Initializes a relay. The relay must be opened before it can run.
+ */
+Relay::Relay() {
+  m_epfd = UNUSED;
+  memset(m_dirs, 0, sizeof(m_dirs));
+  m_dirs[0].pipe[0] = m_dirs[0].pipe[1] = UNUSED;
+  m_dirs[1].pipe[0] = m_dirs[1].pipe[1] = UNUSED;
+  m_events[0] = m_events[1] = 0;
+  m_flags[0] = m_flags[1] = UNUSED;
+  m_pipe_size = RELAY_PIPE_SIZE;
+}
+
+/**
+ * @name Relay - Destructor.
+ *
+ * Destroys a relay.
+ */
+Relay::~Relay() {
+  close();
+}
+
+/**
+ * @name set_pipe_size - Set the pipe size.
+ * @param size: The capacity of the pipe of each direction in bytes.
+ *
+ * Use this method before the relay is opened to change the number of bytes that
+ * each direction holds for a slow receiver. The default is RELAY_PIPE_SIZE.
+ *
+ * @return Void.
+ */
+void Relay::set_pipe_size(const size_t size) {
+  m_pipe_size = size;
+}
+
+/**
+ * @name open - Open the relay.
+ * @param a: A connected TCP endpoint.
+ * @param b: The other connected TCP endpoint.
+ *
+ * This function prepares two endpoints for relaying. It turns their gather mode
+ * off, sends the data that they have gathered or buffered, switches their sockets
+ * to non-blocking mode until the relay is closed and creates the pipes of the two
+ * directions.
+ *
+ * @return 0: success, 1: error.
+ */
+int32_t Relay::open(Client *a, Client *b) {
+  struct direction *d;
+  const void *data;
+  int32_t i, bytes;
+
+  if (m_epfd != UNUSED)
+    return 1;
+  if (!a || !b || a->protocol() != Endpoint::TCP || b->protocol() != Endpoint::TCP ||
+      !a->sockets() || !b->sockets()) {
+    fprintf(stderr, "(open) Error: The relay needs two connected TCP endpoints.\n");
+    return 1;
+  }
+  m_dirs[0].from = m_dirs[1].to = a;
+  m_dirs[0].to = m_dirs[1].from = b;
+
+  // The buffered data must leave before the spliced data.
+  a->set_gather(false);
+  b->set_gather(false);
+
+  for (i = 0; i < 2; i++) {
+    d = &m_dirs[i];
+
+    // Send what the endpoints hold in user memory.
+    if (d->to->flush() < 0) {
+      close();
+      return 1;
+    }
+    while ((bytes = d->from->peek(&data)) > 0) {
+      if (d->to->send_data(data, bytes) != bytes) {
+	close();
+	return 1;
+      }
+      d->from->consume(bytes);
+      d->bytes += bytes;
+    }
+
+    m_flags[i] = fcntl(d->from->sockets()[0], F_GETFL);
+    if (m_flags[i] < 0 ||
+	fcntl(d->from->sockets()[0], F_SETFL, m_flags[i] | O_NONBLOCK) < 0) {
+      m_flags[i] = UNUSED;
+      close();
+      return 1;
+    }
+    if (pipe2(d->pipe, O_NONBLOCK | O_CLOEXEC) < 0) {
+      fprintf(stderr, "(open) Error: Can not create a pipe.\n");
+      d->pipe[0] = d->pipe[1] = UNUSED;
+      close();
+      return 1;
+    }
+    fcntl(d->pipe[1], F_SETPIPE_SZ, (int)m_pipe_size);
+    bytes = fcntl(d->pipe[1], F_GETPIPE_SZ);
+    d->pipe_size = bytes > 0 ? bytes : m_pipe_size;
+  }
+
+  m_epfd = epoll_create(2);
+  if (m_epfd < 0) {
+    m_epfd = UNUSED;
+    fprintf(stderr, "(open) Error: epoll_create failed.\n");
+    close();
+    return 1;
+  }
+  return 0;
+}
+
+/**
+ * @name run - Run the relay.
+ *
+ * This function forwards the data of the two endpoints until both have closed
+ * their sides of the connections. On a fiber, only the current fiber waits.
+ *
+ * @return 0 on success, 1 on error.
+ */
+int32_t Relay::run() {
+  FiberScheduler *scheduler = FiberScheduler::current();
+  struct epoll_event events[2];
+  int32_t i, nfds, error;
+  socklen_t len = sizeof(error);
+
+  if (m_epfd == UNUSED)
+    return 1;
+  while (!m_dirs[0].shut || !m_dirs[1].shut) {
+    for (i = 0; i < 2; i++)
+      if (pump(&m_dirs[i]))
+	return 1;
+    if (m_dirs[0].shut && m_dirs[1].shut)
+      break;
+    if (update(0) || update(1))
+      return 1;
+
+    if (scheduler && scheduler->wait(m_epfd, EPOLLIN))
+      return 1;
+    nfds = epoll_wait(m_epfd, events, 2, scheduler ? 0 : -1);
+    if (nfds < 0 && errno != EINTR)
+      return 1;
+    for (i = 0; i < nfds; i++) {
+      if (!(events[i].events & EPOLLERR))
+	continue;
+      getsockopt(m_dirs[events[i].data.u32].from->sockets()[0], SOL_SOCKET, SO_ERROR,
+		 &error, &len);
+      errno = error;
+      return 1;
+    }
+  }
+  return 0;
+}
+
+/**
+ * @name close - Close the relay.
+ *
+ * This function destroys the pipes of the relay and restores the mode of the
+ * sockets. The data left in the pipes are dropped. The endpoints stay connected.
+ *
+ * @return 0 on success, 1 on error.
+ */
+int32_t Relay::close() {
+  int32_t i, result = 0;
+
+  for (i = 0; i < 2; i++) {
+    if (m_flags[i] != UNUSED &&
+	fcntl(m_dirs[i].from->sockets()[0], F_SETFL, m_flags[i]) < 0)
+      result = 1;
+    m_flags[i] = UNUSED;
+    if (m_dirs[i].pipe[0] != UNUSED)
+      ::close(m_dirs[i].pipe[0]);
+    if (m_dirs[i].pipe[1] != UNUSED)
+      ::close(m_dirs[i].pipe[1]);
+    m_dirs[i].pipe[0] = m_dirs[i].pipe[1] = UNUSED;
+    m_dirs[i].piped = 0;
+    m_events[i] = 0;
+  }
+  if (m_epfd != UNUSED && ::close(m_epfd) < 0)
+    result = 1;
+  m_epfd = UNUSED;
+  return result;
+}
+
+/**
+ * @name forwarded - Get the forwarded bytes.
+ * @param from: One of the endpoints of the relay.
+ *
+ * This function returns the number of bytes that the relay has delivered from an
+ * endpoint to the other.
+ *
+ * @return The number of bytes.
+ */
+uint64_t Relay::forwarded(const Client *from) {
+  if (m_dirs[0].from == from)
+    return m_dirs[0].bytes;
+  if (m_dirs[1].from == from)
+    return m_dirs[1].bytes;
+  return 0;
+}
+
+/**
+ * @name pump - Move the data of a direction.
+ * @param d: The direction.
+ *
+ * This function splices data from the source into the pipe and from the pipe
+ * to the destination, until neither makes progress. A source that can not
+ * fill a pipe that still holds data marks the pipe full, and is not read again
+ * before the destination takes some data. When the source has closed and the
+ * pipe is empty, the writing side of the destination is shut down.
+ *
+ * @return 0: success, 1: error.
+ */
+int32_t Relay::pump(struct direction *d) {
+  ssize_t bytes;
+  int32_t progress;
+
+  while (1) {
+    progress = 0;
+    if (!d->eof && !d->full && d->piped < d->pipe_size) {
+      bytes = splice(d->from->sockets()[0], NULL, d->pipe[1], NULL, d->pipe_size - d->piped,
+		     SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+      if (bytes > 0) {
+	d->piped += bytes;
+	progress = 1;
+      } else if (bytes == 0) {
+	d->eof = 1;
+	progress = 1;
+      } else if (errno == EAGAIN) {
+	if (d->piped)
+	  d->full = 1;
+      } else if (errno != EINTR) {
+	return 1;
+      }
+    }
+    if (d->piped) {
+      bytes = splice(d->pipe[0], NULL, d->to->sockets()[0], NULL, d->piped,
+		     SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+      if (bytes > 0) {
+	d->piped -= bytes;
+	d->bytes += bytes;
+	d->full = 0;
+	progress = 1;
+      } else if (bytes < 0 && errno != EAGAIN && errno != EINTR) {
+	return 1;
+      }
+    }
+    if (d->eof && !d->piped && !d->shut) {
+      shutdown(d->to->sockets()[0], SHUT_WR);
+      d->shut = 1;
+    }
+    if (!progress)
+      return 0;
+  }
+}
+
+/**
+ * @name update - Update the events of a socket.
+ * @param i: The index of the endpoint.
+ *
+ * This function monitors the socket of an endpoint for reading while its
+ * direction's pipe has room, and for writing while the other direction's
+ * pipe holds data. A socket that is monitored for neither is removed from
+ * the epoll set, so that a hang up does not wake the relay.
+ *
+ * @return 0: success, 1: error.
+ */
+int32_t Relay::update(int32_t i) {
+  struct direction *in = &m_dirs[i];
+  struct direction *out = &m_dirs[1 - i];
+  struct epoll_event ev;
+
+  ev.events = 0;
+  if (!in->eof && !in->full && in->piped < in->pipe_size)
+    ev.events |= EPOLLIN;
+  if (out->piped)
+    ev.events |= EPOLLOUT;
+  if (ev.events == m_events[i])
+    return 0;
+  ev.data.u32 = i;
+  if (epoll_ctl(m_epfd, !ev.events ? EPOLL_CTL_DEL : m_events[i] ? EPOLL_CTL_MOD :
+		EPOLL_CTL_ADD, in->from->sockets()[0], &ev) < 0)
+    return 1;
+  m_events[i] = ev.events;
+  return 0;
+}
@@ -0,0 +1,88 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * libIris - A simple and scalable networking library for Linux.
+ *
+ * Copyright (C) 2014 Giorgos Kappes <geokapp@gmail.com>
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file LICENSE.
+ *
+ */
+
+#ifndef LIBIRIS_RELAY_H
+#define LIBIRIS_RELAY_H
+
+#include "libiris.h"
+
+namespace iris {
+
+#define RELAY_PIPE_SIZE          (64 * 1024)
+
+/**
+ * @name Relay - The TCP relay object.
+ *
+ * This class forwards the bytes of two connected TCP endpoints to each other, e.g.
+ * a client returned by Server::get_client and a client attached to a backend. Each
+ * direction moves the data through a pipe with splice, so the payload is never
+ * copied to user memory. A direction reads from its source only while its pipe has
+ * room, so a slow receiver slows down the sender instead of filling memory. When a
+ * source closes its side, the relay shuts down the writing side of the other
+ * endpoint once the pipe is empty, and the other direction keeps working until
+ * it is closed as well. For example:
+ * ------------------------------------
+ * Relay relay;
+ * if (!relay.open(client, backend))
+ *   relay.run();
+ * relay.close();
+ * client->detach();
+ * backend->detach();
+ * ------------------------------------
+ */
+class Relay {
+ public:
+  /**
+   * direction - Relay direction information.
+   *
+   * The direction struct holds the pipe and the state of one direction.
+   */
+  struct direction {
+    Client *from;
+    Client *to;
+    int32_t pipe[2];
+    size_t pipe_size;
+    size_t piped;
+    int32_t full;
+    int32_t eof;
+    int32_t shut;
+    uint64_t bytes;
+  };
+
+ private:
+  int32_t m_epfd;
+  struct direction m_dirs[2];
+  uint32_t m_events[2];
+  int32_t m_flags[2];
+  size_t m_pipe_size;
+
+ public:
+  Relay();
+  ~Relay();
+
+  void set_pipe_size(const size_t size);
+  int32_t open(Client *a, Client *b);
+  int32_t run();
+  int32_t close();
+
+  uint64_t forwarded(const Client *from);
+
+ private:
+  int32_t pump(struct direction *d);
+  int32_t update(int32_t i);
+};
+
+} // End of namespace
+
+#endif
@@ -0,0 +1,687 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * libIris - A simple and scalable networking library for Linux.
+ *
+ * Copyright (C) 2014 Giorgos Kappes <geokapp@gmail.com>
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file LICENSE.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <poll.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/random.h>
+#include <arpa/inet.h>
+#include "rudp.h"
+
+using namespace iris;
+
+// The packet types.
+#define RUDP_DATA                1
+#define RUDP_ACK                 2
+
+/**
+ * header - Packet header.
+ *
+ * The header struct is the first RUDP_HEADER_SIZE bytes of every packet, in
+ * network byte order. A data packet carries the fragment index of the message
+ * and the length of its payload; an acknowledgement carries the bitmap of the
+ * fragments received, of length bytes.
+ */
+struct header {
+  uint8_t type;
+  uint8_t flags;
+  uint16_t count;
+  uint32_t message;
+  uint16_t index;
+  uint16_t length;
+} __attribute__((packed));
+
+/**
+ * @name same_address - Compare two addresses.
+ * @param a: The first address.
+ * @param a_len: The size of the first address.
+ * @param b: The second address.
+ * @param b_len: The size of the second address.
+ *
+ * @return True if the addresses are the same.
+ */
+static bool same_address(const void *a, socklen_t a_len, const void *b, socklen_t b_len) {
+  return a_len == b_len && !memcmp(a, b, a_len);
+}
+
+/**
+ * @name Rudp - Constructor.
+ *
+ * Initializes the protocol state of an endpoint.
+ */
+Rudp::Rudp() {
+  m_next_message = random_id();
+  m_srtt = 0;
+  m_rto = RUDP_RTO_MIN * 20;
+  m_incoming = NULL;
+  m_incoming_len = 0;
+  m_incoming_size = 0;
+  m_complete = NULL;
+  m_complete_tail = NULL;
+  memset(m_recent, 0, sizeof(m_recent));
+  m_recent_next = 0;
+  m_send_id = 0;
+  m_send_count = 0;
+  m_send_acked = 0;
+  m_send_inflight = 0;
+  m_send_have = NULL;
+  m_send_time = NULL;
+  m_send_tries = NULL;
+  m_send_addr = NULL;
+  m_send_addr_len = 0;
+}
+
+/**
+ * @name Rudp - Destructor.
+ *
+ * Destroys the protocol state and drops the messages that were not delivered.
+ */
+Rudp::~Rudp() {
+  struct message *m;
+
+  while ((m = m_incoming)) {
+    m_incoming = m->next;
+    free_message(m);
+  }
+  while ((m = m_complete)) {
+    m_complete = m->next;
+    free_message(m);
+  }
+}
+
+/**
+ * @name send - Send a message.
+ * @param sock: The UDP socket.
+ * @param addr: The address of the peer.
+ * @param addr_len: The size of the address.
+ * @param data: Pointer to the message.
+ * @param data_len: Size of the message.
+ *
+ * This function sends a message and waits until the peer has acknowledged all its
+ * fragments. The fragments that are not acknowledged in time are sent again, and
+ * the message fails with ETIMEDOUT if the peer does not respond to RUDP_RETRIES
+ * retransmissions in a row. The messages that arrive in the meantime are kept for
+ * receive.
+ *
+ * @return The size of the message or -1 on error.
+ */
+int32_t Rudp::send(int32_t sock, const struct sockaddr *addr, socklen_t addr_len,
+		   const void *data, const size_t data_len) {
+  uint32_t count = data_len ? (data_len + RUDP_PAYLOAD - 1) / RUDP_PAYLOAD : 1;
+  uint64_t time, deadline;
+  uint32_t i, next = 0, retries = 0;
+  uint16_t acked;
+  int32_t result = data_len, timeout;
+  bool expired;
+
+  if (count > RUDP_MAX_FRAGMENTS || data_len > INT32_MAX) {
+    errno = EMSGSIZE;
+    return -1;
+  }
+  m_send_have = (uint8_t *)calloc((count + 7) / 8, 1);
+  m_send_time = (uint64_t *)calloc(count, sizeof(uint64_t));
+  m_send_tries = (uint8_t *)calloc(count, 1);
+  if (!m_send_have || !m_send_time || !m_send_tries) {
+    fprintf(stderr, "(send) Error: No free memory left.\n");
+    result = -1;
+    goto out;
+  }
+  // Id 0 means that no message is being sent.
+  if (!++m_next_message)
+    m_next_message++;
+  m_send_id = m_next_message;
+  m_send_count = count;
+  m_send_acked = 0;
+  m_send_inflight = 0;
+  m_send_addr = addr;
+  m_send_addr_len = addr_len;
+
+  while (m_send_acked < count) {
+    time = now();
+
+    // Send the lost fragments again.
+    expired = false;
+    for (i = 0; i < next; i++) {
+      if ((m_send_have[i / 8] & (1 << (i % 8))) || time < m_send_time[i] + m_rto)
+	continue;
+      if (send_fragment(sock, (const char *)data, data_len, i) < 0) {
+	result = -1;
+	goto out;
+      }
+      m_send_time[i] = time;
+      if (m_send_tries[i] < 255)
+	m_send_tries[i]++;
+      expired = true;
+    }
+    if (expired) {
+      if (++retries > RUDP_RETRIES) {
+	errno = ETIMEDOUT;
+	result = -1;
+	goto out;
+      }
+      m_rto = m_rto * 2 > RUDP_RTO_MAX ? RUDP_RTO_MAX : m_rto * 2;
+    }
+
+    // Fill the window with new fragments.
+    while (next < count && m_send_inflight < RUDP_WINDOW) {
+      if (send_fragment(sock, (const char *)data, data_len, next) < 0) {
+	result = -1;
+	goto out;
+      }
+      m_send_time[next] = time;
+      m_send_tries[next] = 1;
+      m_send_inflight++;
+      next++;
+    }
+
+    // Wait for acknowledgements until the first timer expires.
+    deadline = 0;
+    for (i = 0; i < next; i++) {
+      if (!(m_send_have[i / 8] & (1 << (i % 8))) &&
+	  (!deadline || m_send_time[i] + m_rto < deadline))
+	deadline = m_send_time[i] + m_rto;
+    }
+    time = now();
+    timeout = deadline > time ? deadline - time : 0;
+    acked = m_send_acked;
+    if (input(sock, timeout) < 0) {
+      result = -1;
+      goto out;
+    }
+    if (m_send_acked != acked)
+      retries = 0;
+  }
+
+ out:
+  free(m_send_have);
+  free(m_send_time);
+  free(m_send_tries);
+  m_send_have = NULL;
+  m_send_time = NULL;
+  m_send_tries = NULL;
+  m_send_addr = NULL;
+  m_send_id = 0;
+  return result;
+}
+
+/**
+ * @name receive - Receive a message.
+ * @param sock: The UDP socket.
+ * @param nonblocking: True to return at once if no message is complete.
+ * @param data: Pointer to the data buffer.
+ * @param data_len: Size of the data buffer.
+ * @param peer: The address of the peer to receive from, or NULL for any peer.
+ * @param peer_len: The size of the address.
+ *
+ * This function receives the next complete message from the peer, or from any
+ * peer. The messages of the other peers stay queued. A message that does not fit
+ * in the buffer is truncated. A blocking call waits until a message is complete;
+ * a non-blocking one reads the queued packets and returns -1 with errno set to
+ * EAGAIN if none completed a message.
+ *
+ * @return The number of bytes received or -1 on error.
+ */
+int32_t Rudp::receive(int32_t sock, bool nonblocking, void *data, const size_t data_len,
+		      const struct sockaddr *peer, socklen_t peer_len) {
+  struct message *m, *prev;
+  size_t len;
+
+  while (1) {
+    for (prev = NULL, m = m_complete; m; prev = m, m = m->next)
+      if (!peer || same_address(&m->addr, m->addr_len, peer, peer_len))
+	break;
+    if (m)
+      break;
+    if (input(sock, nonblocking ? 0 : -1) < 0)
+      return -1;
+    if (nonblocking) {
+      for (m = m_complete; m; m = m->next)
+	if (!peer || same_address(&m->addr, m->addr_len, peer, peer_len))
+	  break;
+      if (!m) {
+	errno = EAGAIN;
+	return -1;
+      }
+    }
+  }
+  if (prev)
+    prev->next = m->next;
+  else
+    m_complete = m->next;
+  if (m_complete_tail == m)
+    m_complete_tail = prev;
+
+  len = m->data_len < data_len ? m->data_len : data_len;
+  memcpy(data, m->data, len);
+  free_message(m);
+  return len;
+}
+
+/**
+ * @name pending - Check for a complete message.
+ * @param addr: Set to the address of the peer of the message.
+ * @param addr_len: Set to the size of the address.
+ * @param sock: Set to the socket that received the message.
+ *
+ * This function checks if a message was completed while the endpoint was
+ * sending, and can be received without reading the socket.
+ *
+ * @return True if a message is complete.
+ */
+bool Rudp::pending(struct sockaddr_storage *addr, socklen_t *addr_len, int32_t *sock) {
+  if (!m_complete)
+    return false;
+  memcpy(addr, &m_complete->addr, m_complete->addr_len);
+  *addr_len = m_complete->addr_len;
+  *sock = m_complete->sock;
+  return true;
+}
+
+/**
+ * @name input - Read packets.
+ * @param sock: The UDP socket.
+ * @param timeout: The time to wait for the first packet in milliseconds, -1 to
+ *                 wait for ever.
+ *
+ * This function waits for packets and handles all the queued ones. Then it
+ * acknowledges the messages that received fragments.
+ *
+ * @return The number of packets read or -1 on error.
+ */
+int32_t Rudp::input(int32_t sock, int32_t timeout) {
+  char packet[UDPPACKETSIZE];
+  struct sockaddr_storage addr;
+  struct pollfd pfd;
+  struct message *m;
+  socklen_t addr_len;
+  ssize_t bytes;
+  int32_t packets = 0;
+
+  pfd.fd = sock;
+  pfd.events = POLLIN;
+  if (poll(&pfd, 1, timeout) < 0)
+    return errno == EINTR ? 0 : -1;
+
+  while (1) {
+    addr_len = sizeof(addr);
+    bytes = recvfrom(sock, packet, sizeof(packet), MSG_DONTWAIT,
+		     (struct sockaddr *)&addr, &addr_len);
+    if (bytes < 0) {
+      if (errno == EAGAIN || errno == EWOULDBLOCK)
+	break;
+      // A previous packet was refused by the peer.
+      if (errno == ECONNREFUSED)
+	continue;
+      return -1;
+    }
+    packets++;
+    if ((size_t)bytes < RUDP_HEADER_SIZE)
+      continue;
+    if (((struct header *)packet)->type == RUDP_DATA)
+      handle_data(sock, packet, bytes, &addr, addr_len);
+    else if (((struct header *)packet)->type == RUDP_ACK)
+      handle_ack(packet, bytes, &addr, addr_len);
+  }
+
+  // Acknowledge what arrived once the socket is drained.
+  for (m = m_incoming; m; m = m->next)
+    if (m->unacked)
+      send_ack(sock, m);
+  return packets;
+}
+
+/**
+ * @name handle_data - Handle a data packet.
+ * @param sock: The UDP socket.
+ * @param packet: The packet.
+ * @param len: The size of the packet.
+ * @param addr: The address of the peer.
+ * @param addr_len: The size of the address.
+ *
+ * This function stores a fragment in the message it belongs to. A complete
+ * message is moved to the delivery queue and acknowledged at once.
+ *
+ * @return Void.
+ */
+void Rudp::handle_data(int32_t sock, const char *packet, size_t len,
+		       const struct sockaddr_storage *addr, socklen_t addr_len) {
+  const struct header *h = (const struct header *)packet;
+  uint32_t id = ntohl(h->message);
+  uint16_t count = ntohs(h->count);
+  uint16_t index = ntohs(h->index);
+  uint16_t length = ntohs(h->length);
+  struct message *m, *p, *prev;
+  int32_t i;
+
+  if (!count || count > RUDP_MAX_FRAGMENTS || index >= count ||
+      length != len - RUDP_HEADER_SIZE || length > RUDP_PAYLOAD ||
+      (index < count - 1 && length != RUDP_PAYLOAD))
+    return;
+
+  // A late fragment of a delivered message.
+  for (i = 0; i < RUDP_RECENT; i++) {
+    if (m_recent[i].id == id && same_address(&m_recent[i].addr, m_recent[i].addr_len,
+					     addr, addr_len)) {
+      send_full_ack(sock, id, count, addr, addr_len);
+      return;
+    }
+  }
+
+  for (m = m_incoming; m; m = m->next)
+    if (m->id == id && same_address(&m->addr, m->addr_len, addr, addr_len))
+      break;
+  if (!m) {
+    // Make room by dropping the oldest message.
+    if (m_incoming_len == RUDP_MAX_INCOMING)
+      drop_oldest(NULL);
+    m = (struct message *)calloc(1, sizeof(struct message));
+    if (!m)
+      return;
+    m->have = (uint8_t *)calloc((count + 7) / 8, 1);
+    if (!m->have) {
+      free_message(m);
+      return;
+    }
+    memcpy(&m->addr, addr, addr_len);
+    m->addr_len = addr_len;
+    m->sock = sock;
+    m->id = id;
+    m->count = count;
+    m->next = m_incoming;
+    m_incoming = m;
+    m_incoming_len++;
+  }
+  if (m->count != count)
+    return;
+
+  if (m->have[index / 8] & (1 << (index % 8))) {
+    // The sender missed an acknowledgement.
+    m->unacked++;
+    return;
+  }
+  // A fragment that does not fit in the budget is lost and sent again.
+  if (reserve(m, (size_t)index * RUDP_PAYLOAD + length))
+    return;
+  m->have[index / 8] |= 1 << (index % 8);
+  memcpy(m->data + (size_t)index * RUDP_PAYLOAD, packet + RUDP_HEADER_SIZE, length);
+  if (index == count - 1)
+    m->data_len = (size_t)index * RUDP_PAYLOAD + length;
+  m->received++;
+  m->unacked++;
+
+  if (m->received < count) {
+    if (m->unacked >= RUDP_ACK_EVERY)
+      send_ack(sock, m);
+    return;
+  }
+
+  // The message is complete.
+  send_full_ack(sock, id, count, addr, addr_len);
+  m_incoming_size -= m->data_size;
+  memcpy(&m_recent[m_recent_next].addr, addr, addr_len);
+  m_recent[m_recent_next].addr_len = addr_len;
+  m_recent[m_recent_next].id = id;
+  m_recent_next = (m_recent_next + 1) % RUDP_RECENT;
+  for (prev = NULL, p = m_incoming; p != m; prev = p, p = p->next)
+    ;
+  if (prev)
+    prev->next = m->next;
+  else
+    m_incoming = m->next;
+  m_incoming_len--;
+  m->next = NULL;
+  if (m_complete_tail)
+    m_complete_tail->next = m;
+  else
+    m_complete = m;
+  m_complete_tail = m;
+}
+
+/**
+ * @name handle_ack - Handle an acknowledgement.
+ * @param packet: The packet.
+ * @param len: The size of the packet.
+ * @param addr: The address of the peer.
+ * @param addr_len: The size of the address.
+ *
+ * This function marks the fragments of the message being sent that the peer
+ * has received, and updates the round trip time with the fragments that were
+ * sent once.
+ *
+ * @return Void.
+ */
+void Rudp::handle_ack(const char *packet, size_t len,
+		      const struct sockaddr_storage *addr, socklen_t addr_len) {
+  const struct header *h = (const struct header *)packet;
+  const uint8_t *bitmap = (const uint8_t *)packet + RUDP_HEADER_SIZE;
+  uint64_t time = now();
+  uint32_t i, sample;
+
+  if (!m_send_have || ntohl(h->message) != m_send_id || ntohs(h->count) != m_send_count ||
+      len < RUDP_HEADER_SIZE + (size_t)(m_send_count + 7) / 8 ||
+      !same_address(m_send_addr, m_send_addr_len, addr, addr_len))
+    return;
+  for (i = 0; i < m_send_count; i++) {
+    if (!(bitmap[i / 8] & (1 << (i % 8))) || (m_send_have[i / 8] & (1 << (i % 8))))
+      continue;
+    m_send_have[i / 8] |= 1 << (i % 8);
+    m_send_acked++;
+    m_send_inflight--;
+    if (m_send_tries[i] != 1)
+      continue;
+    sample = time - m_send_time[i];
+    m_srtt = m_srtt ? (7 * m_srtt + sample) / 8 : sample;
+    m_rto = 2 * m_srtt < RUDP_RTO_MIN ? RUDP_RTO_MIN : 2 * m_srtt;
+    if (m_rto > RUDP_RTO_MAX)
+      m_rto = RUDP_RTO_MAX;
+  }
+}
+
+/**
+ * @name send_fragment - Send a fragment.
+ * @param sock: The UDP socket.
+ * @param data: The message being sent.
+ * @param data_len: The size of the message.
+ * @param index: The index of the fragment.
+ *
+ * @return 0: success, -1: error.
+ */
+int32_t Rudp::send_fragment(int32_t sock, const char *data, size_t data_len, uint16_t index) {
+  struct header h;
+  struct iovec iov[2];
+  struct msghdr msg;
+  size_t offset = (size_t)index * RUDP_PAYLOAD;
+  size_t length = data_len - offset < RUDP_PAYLOAD ? data_len - offset : RUDP_PAYLOAD;
+
+  h.type = RUDP_DATA;
+  h.flags = 0;
+  h.count = htons(m_send_count);
+  h.message = htonl(m_send_id);
+  h.index = htons(index);
+  h.length = htons(length);
+  iov[0].iov_base = &h;
+  iov[0].iov_len = RUDP_HEADER_SIZE;
+  iov[1].iov_base = (void *)(data + offset);
+  iov[1].iov_len = length;
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_name = (void *)m_send_addr;
+  msg.msg_namelen = m_send_addr_len;
+  msg.msg_iov = iov;
+  msg.msg_iovlen = 2;
+  while (sendmsg(sock, &msg, 0) < 0) {
+    // A full socket buffer counts as a lost packet.
+    if (errno == EAGAIN || errno == EWOULDBLOCK || errno == ENOBUFS ||
+	errno == ECONNREFUSED)
+      return 0;
+    if (errno != EINTR)
+      return -1;
+  }
+  return 0;
+}
+
+/**
+ * @name send_ack - Acknowledge a message.
+ * @param sock: The UDP socket.
+ * @param m: The message.
+ *
+ * This function sends the bitmap of the fragments of a message received so far.
+ *
+ * @return Void.
+ */
+void Rudp::send_ack(int32_t sock, struct message *m) {
+  char packet[UDPPACKETSIZE];
+  struct header *h = (struct header *)packet;
+  uint16_t length = (m->count + 7) / 8;
+
+  h->type = RUDP_ACK;
+  h->flags = 0;
+  h->count = htons(m->count);
+  h->message = htonl(m->id);
+  h->index = 0;
+  h->length = htons(length);
+  memcpy(packet + RUDP_HEADER_SIZE, m->have, length);
+  sendto(sock, packet, RUDP_HEADER_SIZE + length, MSG_DONTWAIT,
+	 (struct sockaddr *)&m->addr, m->addr_len);
+  m->unacked = 0;
+}
+
+/**
+ * @name send_full_ack - Acknowledge a complete message.
+ * @param sock: The UDP socket.
+ * @param id: The message id.
+ * @param count: The number of fragments of the message.
+ * @param addr: The address of the peer.
+ * @param addr_len: The size of the address.
+ *
+ * @return Void.
+ */
+void Rudp::send_full_ack(int32_t sock, uint32_t id, uint16_t count,
+			 const struct sockaddr_storage *addr, socklen_t addr_len) {
+  char packet[UDPPACKETSIZE];
+  struct header *h = (struct header *)packet;
+  uint16_t length = (count + 7) / 8;
+
+  h->type = RUDP_ACK;
+  h->flags = 0;
+  h->count = htons(count);
+  h->message = htonl(id);
+  h->index = 0;
+  h->length = htons(length);
+  memset(packet + RUDP_HEADER_SIZE, 0xff, length);
+  sendto(sock, packet, RUDP_HEADER_SIZE + length, MSG_DONTWAIT,
+	 (const struct sockaddr *)addr, addr_len);
+}
+
+/**
+ * @name reserve - Grow the buffer of a message.
+ * @param m: The message being reassembled.
+ * @param size: The size that the buffer must have.
+ *
+ * This function grows the buffer of a message to hold the fragments up to the
+ * one received, at least doubling it, but to no more than the message can hold.
+ * If the messages being reassembled would hold more than RUDP_REASSEMBLY_MAX
+ * bytes, the oldest other messages are dropped first.
+ *
+ * @return 0: success, -1: error.
+ */
+int32_t Rudp::reserve(struct message *m, size_t size) {
+  size_t max = (size_t)m->count * RUDP_PAYLOAD;
+  char *data;
+
+  if (size <= m->data_size)
+    return 0;
+  if (size < 2 * m->data_size)
+    size = 2 * m->data_size;
+  if (size > max)
+    size = max;
+  while (m_incoming_size + size - m->data_size > RUDP_REASSEMBLY_MAX)
+    if (!drop_oldest(m))
+      return -1;
+  data = (char *)realloc(m->data, size);
+  if (!data)
+    return -1;
+  m->data = data;
+  m_incoming_size += size - m->data_size;
+  m->data_size = size;
+  return 0;
+}
+
+/**
+ * @name drop_oldest - Drop the oldest message being reassembled.
+ * @param keep: A message that must not be dropped, or NULL.
+ *
+ * @return True if a message was dropped.
+ */
+bool Rudp::drop_oldest(struct message *keep) {
+  struct message *m, *prev = NULL, *last = NULL, *last_prev = NULL;
+
+  for (m = m_incoming; m; prev = m, m = m->next) {
+    if (m != keep) {
+      last = m;
+      last_prev = prev;
+    }
+  }
+  if (!last)
+    return false;
+  if (last_prev)
+    last_prev->next = last->next;
+  else
+    m_incoming = last->next;
+  m_incoming_size -= last->data_size;
+  m_incoming_len--;
+  free_message(last);
+  return true;
+}
+
+/**
+ * @name free_message - Free a message.
+ * @param m: The message.
+ *
+ * @return Void.
+ */
+void Rudp::free_message(struct message *m) {
+  free(m->have);
+  free(m->data);
+  free(m);
+}
+
+/**
+ * @name random_id - Get a random message id.
+ *
+ * @return A random number, or one made of the time and the process id if the
+ *         kernel has no random numbers ready.
+ */
+uint32_t Rudp::random_id() {
+  uint32_t id;
+
+  if (getrandom(&id, sizeof(id), GRND_NONBLOCK) != sizeof(id))
+    id = (uint32_t)now() * 2654435761u ^ (uint32_t)getpid();
+  return id;
+}
+
+/**
+ * @name now - Get the time.
+ *
+ * @return The monotonic time in milliseconds.
+ */
+uint64_t Rudp::now() {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
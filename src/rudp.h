@@ -0,0 +1,137 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * libIris - A simple and scalable networking library for Linux.
+ *
+ * Copyright (C) 2014 Giorgos Kappes <geokapp@gmail.com>
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file LICENSE.
+ *
+ */
+
+#ifndef LIBIRIS_RUDP_H
+#define LIBIRIS_RUDP_H
+
+#include <sys/socket.h>
+#include "libiris.h"
+
+namespace iris {
+
+#define RUDP_HEADER_SIZE         12
+#define RUDP_PAYLOAD             (UDPPACKETSIZE - RUDP_HEADER_SIZE)
+#define RUDP_MAX_FRAGMENTS       8192
+#define RUDP_WINDOW              64
+#define RUDP_ACK_EVERY           16
+#define RUDP_MAX_INCOMING        64
+#define RUDP_RECENT              64
+#define RUDP_REASSEMBLY_MAX      (16 * 1024 * 1024)
+#define RUDP_RTO_MIN             5
+#define RUDP_RTO_MAX             1000
+#define RUDP_RETRIES             10
+
+/**
+ * @name Rudp - The reliable UDP protocol state.
+ *
+ * This class implements the Endpoint::RUDP protocol on a UDP socket. A message is
+ * split into numbered fragments of RUDP_PAYLOAD bytes, at most RUDP_MAX_FRAGMENTS,
+ * which the sender keeps sending, RUDP_WINDOW at a time, until the receiver has
+ * acknowledged all of them. The acknowledgements carry a bitmap of the fragments
+ * received, so only the lost fragments are sent again when their retransmission
+ * timer expires. The timer follows the measured round trip time. The receiver
+ * reassembles the messages of every peer separately and delivers each when it is
+ * complete, so a lost fragment delays only its own message. The buffer of a message
+ * grows with the fragments received, and the messages being reassembled hold at
+ * most RUDP_REASSEMBLY_MAX bytes; the oldest are dropped to make room. The message
+ * ids start at a random number, so that a peer that restarts is not taken for a
+ * peer that resends a delivered message.
+ */
+class Rudp {
+ public:
+  /**
+   * message - A message being reassembled.
+   *
+   * The message struct holds the fragments of a message received so far.
+   */
+  struct message {
+    struct sockaddr_storage addr;
+    socklen_t addr_len;
+    int32_t sock;
+    uint32_t id;
+    uint16_t count;
+    uint16_t received;
+    uint16_t unacked;
+    uint8_t *have;
+    char *data;
+    size_t data_len;
+    size_t data_size;
+    struct message *next;
+  };
+
+  /**
+   * recent - A delivered message.
+   *
+   * The recent struct identifies a completed message, so that its late
+   * fragments are acknowledged again instead of starting a new message.
+   */
+  struct recent {
+    struct sockaddr_storage addr;
+    socklen_t addr_len;
+    uint32_t id;
+  };
+
+ private:
+  uint32_t m_next_message;
+  uint32_t m_srtt;
+  uint32_t m_rto;
+  struct message *m_incoming;
+  int32_t m_incoming_len;
+  size_t m_incoming_size;
+  struct message *m_complete;
+  struct message *m_complete_tail;
+  struct recent m_recent[RUDP_RECENT];
+  int32_t m_recent_next;
+
+  // The message being sent.
+  uint32_t m_send_id;
+  uint16_t m_send_count;
+  uint16_t m_send_acked;
+  uint16_t m_send_inflight;
+  uint8_t *m_send_have;
+  uint64_t *m_send_time;
+  uint8_t *m_send_tries;
+  const struct sockaddr *m_send_addr;
+  socklen_t m_send_addr_len;
+
+ public:
+  Rudp();
+  ~Rudp();
+
+  int32_t send(int32_t sock, const struct sockaddr *addr, socklen_t addr_len,
+	       const void *data, const size_t data_len);
+  int32_t receive(int32_t sock, bool nonblocking, void *data, const size_t data_len,
+		  const struct sockaddr *peer = NULL, socklen_t peer_len = 0);
+  bool pending(struct sockaddr_storage *addr, socklen_t *addr_len, int32_t *sock);
+  int32_t input(int32_t sock, int32_t timeout);
+
+ private:
+  void handle_data(int32_t sock, const char *packet, size_t len,
+		   const struct sockaddr_storage *addr, socklen_t addr_len);
+  void handle_ack(const char *packet, size_t len,
+		  const struct sockaddr_storage *addr, socklen_t addr_len);
+  int32_t send_fragment(int32_t sock, const char *data, size_t data_len, uint16_t index);
+  void send_ack(int32_t sock, struct message *m);
+  void send_full_ack(int32_t sock, uint32_t id, uint16_t count,
+		     const struct sockaddr_storage *addr, socklen_t addr_len);
+  int32_t reserve(struct message *m, size_t size);
+  bool drop_oldest(struct message *keep);
+  void free_message(struct message *m);
+  static uint32_t random_id();
+  static uint64_t now();
+};
+
+} // End of namespace
+
+#endif
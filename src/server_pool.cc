@@ -0,0 +1,370 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * libIris - A simple and scalable networking library for Linux.
+ *
+ * Copyright (C) 2014 Giorgos Kappes <geokapp@gmail.com>
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file LICENSE.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "server_pool.h"
+
+using namespace iris;
+
+/**
+ * @name ServerPool - Constructor.
+ *
+ * Initializes a server pool. The default communication protocol is TCP and
+ * the default mode is ReusePort.
+ */
+ServerPool::ServerPool() {
+  m_protocol = Endpoint::TCP; // TCP is the default.
+  m_mode = ServerPool::ReusePort;
+  m_backend = Reactor::Epoll;
+  m_edge_triggered = false;
+  m_server = NULL;
+  m_handler = NULL;
+  m_workers = NULL;
+  m_workers_len = 0;
+}
+
+/**
+ * @name ServerPool - Constructor.
+ * @param proto: The Endpoint protocol (TCP or UDP).
+ *
+ * Initializes a server pool.
+ */
+ServerPool::ServerPool(const Endpoint::Protocol proto) {
+  m_protocol = proto;
+  m_mode = ServerPool::ReusePort;
+  m_backend = Reactor::Epoll;
+  m_edge_triggered = false;
+  m_server = NULL;
+  m_handler = NULL;
+  m_workers = NULL;
+  m_workers_len = 0;
+}
+
+/**
+ * @name ServerPool - Destructor.
+ *
+ * Destroys a server pool. The workers are stopped if they still run.
+ */
+ServerPool::~ServerPool() {
+  stop();
+}
+
+/**
+ * @name set_mode - Set the mode.
+ * @param mode: The mode (ReusePort or SharedListener).
+ *
+ * Use this method before start to select how the workers receive the new
+ * connections.
+ *
+ * @return Void.
+ */
+void ServerPool::set_mode(const ServerPool::Mode mode) {
+  m_mode = mode;
+}
+
+/**
+ * @name mode - Get the mode.
+ *
+ * This function returns the mode of the server pool.
+ *
+ * @return The mode.
+ */
+ServerPool::Mode ServerPool::mode() {
+  return m_mode;
+}
+
+/**
+ * @name set_edge_triggered - Set the epoll triggering mode.
+ * @param on: True for edge-triggered mode, false for level-triggered mode.
+ *
+ * Use this method before start to select the triggering mode of the workers'
+ * server endpoints.
+ *
+ * @return Void.
+ */
+void ServerPool::set_edge_triggered(const bool on) {
+  m_edge_triggered = on;
+}
+
+/**
+ * @name set_backend - Set the reactor backend.
+ * @param backend: The event notification backend (Epoll or IoUring).
+ *
+ * Use this method before start to select the backend of the workers' reactors.
+ *
+ * @return Void.
+ */
+void ServerPool::set_backend(const Reactor::Backend backend) {
+  m_backend = backend;
+}
+
+/**
+ * @name workers_len - Get the number of workers.
+ *
+ * This function returns the number of running workers.
+ *
+ * @return The number of workers.
+ */
+int32_t ServerPool::workers_len() {
+  return m_workers_len;
+}
+
+/**
+ * @name server - Get the server endpoint of a worker.
+ * @param i: The worker index.
+ *
+ * This function returns the server endpoint of a worker. In SharedListener
+ * mode all the workers return the same server endpoint.
+ *
+ * @return The server endpoint or NULL.
+ */
+Server *ServerPool::server(int32_t i) {
+  if (i < 0 || i >= m_workers_len)
+    return NULL;
+  return m_workers[i].server;
+}
+
+/**
+ * @name reactor - Get the reactor of a worker.
+ * @param i: The worker index.
+ *
+ * This function returns the reactor of a worker.
+ *
+ * @return The reactor or NULL.
+ */
+Reactor *ServerPool::reactor(int32_t i) {
+  if (i < 0 || i >= m_workers_len)
+    return NULL;
+  return m_workers[i].reactor;
+}
+
+/**
+ * @name start - Start the workers.
+ * @param host: the hostname or ip address of the server host.
+ * @param service: the port number of the service. In ReusePort mode it must be a
+ *                 fixed port, since every worker binds its own sockets to it.
+ * @param backlog: The size of the backlog of every server endpoint (for TCP only).
+ * @param workers: The number of worker threads, 0 for one per online CPU.
+ * @param handler: The handler whose callbacks receive the events.
+ *
+ * This function creates the server endpoints and starts the worker threads.
+ *
+ * @return 0: success, 1: error.
+ */
+int32_t ServerPool::start(const char *host, const char *service, int32_t backlog,
+			  int32_t workers, Reactor::Handler *handler) {
+  struct worker *w;
+  int32_t i;
+
+  // Check the arguments.
+  if (!handler) {
+    fprintf(stderr, "(start) Error: handler must not be NULL.\n");
+    return 1;
+  }
+  if (m_workers) {
+    fprintf(stderr, "(start) Error: The server pool is already started.\n");
+    return 1;
+  }
+  if (workers <= 0)
+    workers = sysconf(_SC_NPROCESSORS_ONLN);
+  if (workers <= 0)
+    workers = 1;
+  m_handler = handler;
+
+  m_workers = (struct worker *)malloc(workers * sizeof(struct worker));
+  if (!m_workers) {
+    fprintf(stderr, "(start) Error: No free memory left.\n");
+    return 1;
+  }
+  memset(m_workers, 0, workers * sizeof(struct worker));
+  m_workers_len = workers;
+
+  //
+  // In SharedListener mode there is one server endpoint. Its sockets must be
+  // non-blocking, since more than one worker may be woken for a connection.
+  //
+  if (m_mode == ServerPool::SharedListener) {
+    m_server = new Server(m_protocol);
+    m_server->set_edge_triggered(m_edge_triggered);
+    if (m_server->start(host, service, backlog) || m_server->set_nonblocking(true)) {
+      fprintf(stderr, "(start) Error: Can not start the shared server.\n");
+      stop();
+      return 1;
+    }
+  }
+
+  // Otherwise every worker gets its own sockets on the shared address.
+  for (i = 0; i < m_workers_len; i++) {
+    w = &m_workers[i];
+    if (m_server) {
+      w->server = m_server;
+      continue;
+    }
+    w->server = new Server(m_protocol);
+    w->server->set_reuse_port(true);
+    w->server->set_edge_triggered(m_edge_triggered);
+    if (w->server->start(host, service, backlog)) {
+      fprintf(stderr, "(start) Error: Can not start worker %d.\n", i);
+      stop();
+      return 1;
+    }
+  }
+
+  for (i = 0; i < m_workers_len; i++) {
+    if (start_worker(i)) {
+      stop();
+      return 1;
+    }
+  }
+  return 0;
+}
+
+/**
+ * @name stop - Stop the workers.
+ *
+ * This method stops the reactors, waits for the worker threads and stops the
+ * server endpoints.
+ *
+ * @return 0 on success, 1 on error.
+ */
+int32_t ServerPool::stop() {
+  struct worker *w;
+  int32_t i, result = 0;
+
+  if (!m_workers)
+    return 0;
+
+  // Ask all the workers to stop first, so that they stop in parallel.
+  for (i = 0; i < m_workers_len; i++) {
+    if (m_workers[i].reactor)
+      m_workers[i].reactor->stop();
+  }
+
+  for (i = 0; i < m_workers_len; i++) {
+    w = &m_workers[i];
+    if (stop_worker(i))
+      result = 1;
+    if (w->server && w->server != m_server) {
+      if (w->server->stop())
+	result = 1;
+      delete w->server;
+    }
+  }
+  if (m_server) {
+    if (m_server->stop())
+      result = 1;
+    delete m_server;
+  }
+  m_server = NULL;
+  free(m_workers);
+  m_workers = NULL;
+  m_workers_len = 0;
+  return result;
+}
+
+/**
+ * @name restart - Restart a worker.
+ * @param i: The worker index.
+ *
+ * This method stops the reactor of a worker, closing its connections, and
+ * starts a new reactor and thread for it. The server endpoints stay open, so
+ * no queued connection is dropped. In SharedListener mode the other workers
+ * keep accepting from the shared queue while the worker restarts.
+ *
+ * @return 0 on success, 1 on error.
+ */
+int32_t ServerPool::restart(int32_t i) {
+  if (i < 0 || i >= m_workers_len)
+    return 1;
+
+  if (m_workers[i].reactor)
+    m_workers[i].reactor->stop();
+  if (stop_worker(i))
+    return 1;
+  return start_worker(i);
+}
+
+/**
+ * @name start_worker - Start a worker.
+ * @param i: The worker index.
+ *
+ * This function creates the reactor of a worker, attaches it to the worker's
+ * server endpoint and starts the worker thread.
+ *
+ * @return 0: success, 1: error.
+ */
+int32_t ServerPool::start_worker(int32_t i) {
+  struct worker *w = &m_workers[i];
+
+  w->reactor = new Reactor(m_backend);
+  w->reactor->set_exclusive(m_mode == ServerPool::SharedListener);
+  if (w->reactor->attach(w->server, m_handler)) {
+    fprintf(stderr, "(start_worker) Error: Can not start worker %d.\n", i);
+    return 1;
+  }
+  w->status = 0;
+  if (pthread_create(&w->thread, NULL, run_worker, (void *)w)) {
+    fprintf(stderr, "(start_worker) Error: Can not create the thread of worker %d.\n", i);
+    return 1;
+  }
+  w->started = 1;
+  return 0;
+}
+
+/**
+ * @name stop_worker - Stop a worker.
+ * @param i: The worker index.
+ *
+ * This function waits for the thread of a worker whose reactor has been asked
+ * to stop and destroys the reactor.
+ *
+ * @return 0: success, 1: error.
+ */
+int32_t ServerPool::stop_worker(int32_t i) {
+  struct worker *w = &m_workers[i];
+  int32_t result = 0;
+
+  if (w->started) {
+    pthread_join(w->thread, NULL);
+    w->started = 0;
+    if (w->status)
+      result = 1;
+  }
+  if (w->reactor) {
+    if (w->reactor->detach())
+      result = 1;
+    delete w->reactor;
+  }
+  w->reactor = NULL;
+  return result;
+}
+
+/**
+ * @name run_worker - The worker thread.
+ * @param arg: The worker information.
+ *
+ * This function runs the reactor of a worker until it is stopped.
+ *
+ * @return NULL.
+ */
+void *ServerPool::run_worker(void *arg) {
+  struct worker *w = (struct worker *)arg;
+
+  w->status = w->reactor->run();
+  return NULL;
+}
@@ -0,0 +1,103 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * libIris - A simple and scalable networking library for Linux.
+ *
+ * Copyright (C) 2014 Giorgos Kappes <geokapp@gmail.com>
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file LICENSE.
+ *
+ */
+
+#ifndef LIBIRIS_SERVER_POOL_H
+#define LIBIRIS_SERVER_POOL_H
+
+#include <pthread.h>
+#include "libiris.h"
+#include "reactor.h"
+
+namespace iris {
+
+/**
+ * @name ServerPool - The multi-threaded server object.
+ *
+ * This class runs a server on several worker threads. Every worker runs a reactor
+ * with its own epoll set. In ReusePort mode every worker also owns a server
+ * endpoint whose sockets are bound to the same address with SO_REUSEPORT, and the
+ * kernel balances the incoming connections across the workers. In SharedListener
+ * mode the workers share the sockets of one server endpoint, which they monitor
+ * with EPOLLEXCLUSIVE, so there is one accept queue that every worker drains. All
+ * the workers share one handler, so its callbacks must be thread safe; the events
+ * of a connection are always dispatched by the same worker. For example:
+ * ------------------------------------
+ * ServerPool *pool = new ServerPool;
+ * status = pool->start(NULL, "8000", 10, 0, &handler);
+ * if (!status) {
+ *   ...
+ *   pool->stop();
+ * }
+ * delete pool;
+ * ------------------------------------
+ */
+class ServerPool {
+ public:
+  enum Mode {
+    ReusePort,
+    SharedListener
+  };
+
+  /**
+   * worker - Worker thread information.
+   *
+   * The worker struct holds the server endpoint, the reactor and the thread
+   * of a worker.
+   */
+  struct worker {
+    Server *server;
+    Reactor *reactor;
+    pthread_t thread;
+    int32_t started;
+    int32_t status;
+  };
+
+ private:
+  Endpoint::Protocol m_protocol;
+  Mode m_mode;
+  Reactor::Backend m_backend;
+  bool m_edge_triggered;
+  Server *m_server;
+  Reactor::Handler *m_handler;
+  struct worker *m_workers;
+  int32_t m_workers_len;
+
+ public:
+  ServerPool();
+  ServerPool(const Endpoint::Protocol proto);
+  ~ServerPool();
+
+  void set_mode(const Mode mode);
+  void set_edge_triggered(const bool on);
+  void set_backend(const Reactor::Backend backend);
+  Mode mode();
+
+  int32_t start(const char *host, const char *service, int32_t backlog,
+		int32_t workers, Reactor::Handler *handler);
+  int32_t stop();
+  int32_t restart(int32_t i);
+
+  int32_t workers_len();
+  Server *server(int32_t i);
+  Reactor *reactor(int32_t i);
+
+ private:
+  int32_t start_worker(int32_t i);
+  int32_t stop_worker(int32_t i);
+  static void *run_worker(void *arg);
+};
+
+} // End of namespace
+
+#endif
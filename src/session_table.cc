@@ -0,0 +1,572 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * libIris - A simple and scalable networking library for Linux.
+ *
+ * Copyright (C) 2014 Giorgos Kappes <geokapp@gmail.com>
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file LICENSE.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <sys/random.h>
+#include "session_table.h"
+
+using namespace iris;
+
+/**
+ * @name SessionTable - Constructor.
+ *
+ * Initializes an empty session table. Sessions never expire until a timeout
+ * is set.
+ */
+SessionTable::SessionTable() {
+  m_buckets = NULL;
+  m_buckets_len = 0;
+  m_len = 0;
+  m_oldest = m_newest = NULL;
+  m_ready = m_ready_tail = NULL;
+  m_timeout = 0;
+  m_slots = NULL;
+  m_queued = NULL;
+  m_free = NULL;
+  m_starved = -1;
+  m_seed = random_seed();
+  m_msgs = NULL;
+  m_iovs = NULL;
+  m_batch = NULL;
+  m_addrs = NULL;
+}
+
+/**
+ * @name SessionTable - Destructor.
+ *
+ * Destroys the sessions and drops the datagrams that were not received.
+ */
+SessionTable::~SessionTable() {
+  while (m_oldest)
+    remove(m_oldest);
+  free(m_buckets);
+  free(m_slots);
+  free(m_queued);
+  free(m_msgs);
+  free(m_iovs);
+  free(m_batch);
+  free(m_addrs);
+}
+
+/**
+ * @name set_timeout - Set the idle timeout.
+ * @param sec: The seconds after which a session that receives nothing is removed,
+ *             or 0 to keep the sessions.
+ *
+ * @return Void.
+ */
+void SessionTable::set_timeout(const int32_t sec) {
+  m_timeout = sec > 0 ? (uint64_t)sec * 1000 : 0;
+}
+
+/**
+ * @name fill - Read datagrams into the sessions.
+ * @param sock: The server socket.
+ * @param owner: The server socket that the sessions of the datagrams are served
+ *               from, if sock is another socket, or -1.
+ *
+ * This function reads the datagrams that are waiting on a server socket, as many
+ * as there are free slots, up to UDP_BATCH with one recvmmsg, without blocking,
+ * and queues each in the session of its peer, which is created the first time
+ * the peer is seen. The datagrams are read straight into the slots of the batch
+ * buffer, which is allocated the first time; its pages are only backed by
+ * memory as far as datagrams fill them. The idle sessions are then removed.
+ *
+ * @return The number of datagrams read or -1 on error.
+ */
+int32_t SessionTable::fill(int32_t sock, int32_t owner) {
+  struct session *s;
+  struct queued *q;
+  int32_t i, n, len;
+  uint64_t time;
+
+  if (!m_buckets && grow())
+    return -1;
+  if (!m_slots && alloc_slots())
+    return -1;
+
+  // Read into the free slots.
+  for (len = 0, q = m_free; q && len < UDP_BATCH; q = q->next, len++) {
+    m_batch[len] = q;
+    m_iovs[len].iov_base = q->data;
+    m_msgs[len].msg_hdr.msg_namelen = sizeof(struct sockaddr_storage);
+  }
+  if (!len) {
+    if (owner < 0)
+      m_starved = sock;
+    return 0;
+  }
+  n = recvmmsg(sock, m_msgs, len, MSG_DONTWAIT, NULL);
+  if (n < 0)
+    return -1;
+
+  //
+  // The socket may hold more datagrams than there were free slots; they are
+  // read once the queued datagrams have been received.
+  //
+  if (n == len && len < UDP_BATCH && owner < 0)
+    m_starved = sock;
+
+  // Take the filled slots off the free list.
+  if (n > 0)
+    m_free = m_batch[n - 1]->next;
+
+  time = now();
+  for (i = 0; i < n; i++) {
+    q = m_batch[i];
+    q->next = NULL;
+    q->data_len = m_msgs[i].msg_len;
+    s = find(&m_addrs[i], m_msgs[i].msg_hdr.msg_namelen, true);
+    if (!s) {
+      free_slot(q);
+      continue;
+    }
+    s->sock = owner < 0 ? sock : owner;
+    s->seen = time;
+
+    // The most recently seen session is the newest.
+    if (s != m_newest) {
+      if (s->older)
+	s->older->newer = s->newer;
+      else
+	m_oldest = s->newer;
+      s->newer->older = s->older;
+      s->older = m_newest;
+      s->newer = NULL;
+      m_newest->newer = s;
+      m_newest = s;
+    }
+
+    if (s->queued_len >= SESSION_QUEUE_MAX) {
+      free_slot(q);
+      continue;
+    }
+    if (s->tail)
+      s->tail->next = q;
+    else
+      s->head = q;
+    s->tail = q;
+    s->queued_len++;
+
+    if (!s->ready) {
+      s->ready = true;
+      s->ready_next = NULL;
+      if (m_ready_tail)
+	m_ready_tail->ready_next = s;
+      else
+	m_ready = s;
+      m_ready_tail = s;
+    }
+  }
+  expire(time);
+  return n;
+}
+
+/**
+ * @name next_ready - Get the next session with datagrams.
+ * @param addr: Set to the address of the peer.
+ * @param addr_len: Set to the size of the address.
+ *
+ * This function takes the first session of the ready list and puts it at the
+ * end, so that the sessions with datagrams are served in turn. A session stays
+ * in the list until its datagrams have been received. When the list is empty,
+ * a socket that held more datagrams than there were free slots is read again.
+ *
+ * @return The socket of the session or -1 if no session has datagrams.
+ */
+int32_t SessionTable::next_ready(struct sockaddr_storage *addr, socklen_t *addr_len) {
+  struct session *s;
+  int32_t sock;
+
+  if (!m_ready && m_starved >= 0) {
+    sock = m_starved;
+    m_starved = -1;
+    fill(sock);
+  }
+  while ((s = m_ready)) {
+    m_ready = s->ready_next;
+    if (!m_ready)
+      m_ready_tail = NULL;
+    if (!s->head) {
+      s->ready = false;
+      continue;
+    }
+    s->ready_next = NULL;
+    if (m_ready_tail)
+      m_ready_tail->ready_next = s;
+    else
+      m_ready = s;
+    m_ready_tail = s;
+
+    memcpy(addr, &s->addr, s->addr_len);
+    *addr_len = s->addr_len;
+    return s->sock;
+  }
+  return -1;
+}
+
+/**
+ * @name receive - Receive a datagram of a session.
+ * @param sock: The server socket.
+ * @param info: The address of the peer.
+ * @param data: Pointer to the data buffer.
+ * @param data_len: Size of the data buffer.
+ *
+ * This function copies the first queued datagram of a peer to the buffer and
+ * frees its slot. If the peer has none, the datagrams waiting on the socket are
+ * read once. The part of a datagram that does not fit in the buffer is dropped.
+ *
+ * @return The number of bytes received, 0 if the peer has no datagram or -1 on
+ *         error.
+ */
+int32_t SessionTable::receive(int32_t sock, const struct addrinfo *info, void *data,
+			      const size_t data_len) {
+  const struct sockaddr_storage *addr;
+  int32_t bytes;
+
+  if (!info || !info->ai_addr || info->ai_addrlen > sizeof(struct sockaddr_storage))
+    return -1;
+  addr = (const struct sockaddr_storage *)info->ai_addr;
+  bytes = take(addr, info->ai_addrlen, data, data_len);
+  if (bytes < 0) {
+    if (fill(sock) < 0 && errno != EAGAIN && errno != EWOULDBLOCK)
+      return -1;
+    bytes = take(addr, info->ai_addrlen, data, data_len);
+  }
+  return bytes < 0 ? 0 : bytes;
+}
+
+/**
+ * @name take - Take a queued datagram of a session.
+ * @param addr: The address of the peer.
+ * @param addr_len: The size of the address.
+ * @param data: Pointer to the data buffer.
+ * @param data_len: Size of the data buffer.
+ *
+ * This function copies the first queued datagram of a peer to the buffer and
+ * frees its slot, without reading the socket. The part of a datagram that does
+ * not fit in the buffer is dropped.
+ *
+ * @return The number of bytes received or -1 if the peer has no datagram.
+ */
+int32_t SessionTable::take(const struct sockaddr_storage *addr, socklen_t addr_len,
+			   void *data, const size_t data_len) {
+  struct session *s;
+  struct queued *q;
+  size_t len;
+
+  s = find(addr, addr_len, false);
+  if (!s || !s->head)
+    return -1;
+
+  q = s->head;
+  s->head = q->next;
+  if (!s->head)
+    s->tail = NULL;
+  s->queued_len--;
+  len = q->data_len < data_len ? q->data_len : data_len;
+  memcpy(data, q->data, len);
+  free_slot(q);
+  return len;
+}
+
+/**
+ * @name peer_socket - Get the socket connected to a peer.
+ * @param addr: The address of the peer.
+ * @param addr_len: The size of the address.
+ *
+ * @return The socket set with set_peer_socket or -1 if there is none.
+ */
+int32_t SessionTable::peer_socket(const struct sockaddr_storage *addr,
+				  socklen_t addr_len) {
+  struct session *s = find(addr, addr_len, false);
+
+  return s ? s->peer_sock : -1;
+}
+
+/**
+ * @name set_peer_socket - Keep the socket connected to a peer.
+ * @param addr: The address of the peer.
+ * @param addr_len: The size of the address.
+ * @param sock: The socket.
+ *
+ * @return Void.
+ */
+void SessionTable::set_peer_socket(const struct sockaddr_storage *addr,
+				   socklen_t addr_len, int32_t sock) {
+  struct session *s = find(addr, addr_len, false);
+
+  if (s)
+    s->peer_sock = sock;
+}
+
+/**
+ * @name length - Get the number of sessions.
+ *
+ * @return The number of sessions.
+ */
+int32_t SessionTable::length() {
+  return m_len;
+}
+
+/**
+ * @name find - Find the session of a peer.
+ * @param addr: The address of the peer.
+ * @param addr_len: The size of the address.
+ * @param create: True to create the session if the peer is new.
+ *
+ * @return The session or NULL if there is none.
+ */
+struct SessionTable::session *SessionTable::find(const struct sockaddr_storage *addr,
+						  socklen_t addr_len, bool create) {
+  struct session *s;
+  uint32_t h;
+
+  if (!m_buckets)
+    return NULL;
+  h = hash(addr, addr_len);
+  for (s = m_buckets[h & (m_buckets_len - 1)]; s; s = s->next)
+    if (s->hash == h && s->addr_len == addr_len && !memcmp(&s->addr, addr, addr_len))
+      return s;
+  if (!create)
+    return NULL;
+
+  // Make room by removing the oldest session with nothing queued.
+  if (m_len >= SESSION_MAX) {
+    for (s = m_oldest; s && s->ready; s = s->newer)
+      ;
+    if (!s)
+      return NULL;
+    remove(s);
+  }
+  if (m_len >= (int32_t)m_buckets_len && grow())
+    return NULL;
+  s = (struct session *)calloc(1, sizeof(struct session));
+  if (!s)
+    return NULL;
+  memcpy(&s->addr, addr, addr_len);
+  s->addr_len = addr_len;
+  s->hash = h;
+  s->peer_sock = -1;
+  s->next = m_buckets[h & (m_buckets_len - 1)];
+  m_buckets[h & (m_buckets_len - 1)] = s;
+  s->older = m_newest;
+  if (m_newest)
+    m_newest->newer = s;
+  else
+    m_oldest = s;
+  m_newest = s;
+  m_len++;
+  return s;
+}
+
+/**
+ * @name remove - Remove a session.
+ * @param s: The session, which must not be in the ready list.
+ *
+ * This function removes a session from the table and drops its datagrams.
+ *
+ * @return Void.
+ */
+void SessionTable::remove(struct session *s) {
+  struct session **p;
+  struct queued *q;
+
+  for (p = &m_buckets[s->hash & (m_buckets_len - 1)]; *p != s; p = &(*p)->next)
+    ;
+  *p = s->next;
+  if (s->older)
+    s->older->newer = s->newer;
+  else
+    m_oldest = s->newer;
+  if (s->newer)
+    s->newer->older = s->older;
+  else
+    m_newest = s->older;
+  while ((q = s->head)) {
+    s->head = q->next;
+    free_slot(q);
+  }
+  free(s);
+  m_len--;
+}
+
+/**
+ * @name grow - Grow the hash table.
+ *
+ * This function doubles the number of buckets, starting from SESSION_BUCKETS,
+ * and moves the sessions to their new buckets.
+ *
+ * @return 0: success, 1: error.
+ */
+int32_t SessionTable::grow() {
+  struct session **buckets, *s, *next;
+  uint32_t i, len = m_buckets_len ? m_buckets_len * 2 : SESSION_BUCKETS;
+
+  buckets = (struct session **)calloc(len, sizeof(struct session *));
+  if (!buckets) {
+    fprintf(stderr, "(grow) Error: No free memory left.\n");
+    return 1;
+  }
+  for (i = 0; i < m_buckets_len; i++) {
+    for (s = m_buckets[i]; s; s = next) {
+      next = s->next;
+      s->next = buckets[s->hash & (len - 1)];
+      buckets[s->hash & (len - 1)] = s;
+    }
+  }
+  free(m_buckets);
+  m_buckets = buckets;
+  m_buckets_len = len;
+  return 0;
+}
+
+/**
+ * @name expire - Remove the idle sessions.
+ * @param time: The current time.
+ *
+ * This function removes, from the oldest, the sessions that have received nothing
+ * for the timeout and are not in the ready list.
+ *
+ * @return Void.
+ */
+void SessionTable::expire(uint64_t time) {
+  struct session *s, *newer;
+
+  if (!m_timeout)
+    return;
+  for (s = m_oldest; s && s->seen + m_timeout < time; s = newer) {
+    newer = s->newer;
+    if (!s->ready)
+      remove(s);
+  }
+}
+
+/**
+ * @name alloc_slots - Allocate the batch buffer.
+ *
+ * This function allocates the UDP_BATCH slots of SESSION_SLOT_SIZE bytes that
+ * the datagrams are read into, and puts them all in the free list.
+ *
+ * @return 0: success, 1: error.
+ */
+int32_t SessionTable::alloc_slots() {
+  int32_t i;
+
+  m_slots = (char *)malloc((size_t)UDP_BATCH * SESSION_SLOT_SIZE);
+  m_queued = (struct queued *)malloc(UDP_BATCH * sizeof(struct queued));
+  m_msgs = (struct mmsghdr *)calloc(UDP_BATCH, sizeof(struct mmsghdr));
+  m_iovs = (struct iovec *)malloc(UDP_BATCH * sizeof(struct iovec));
+  m_batch = (struct queued **)malloc(UDP_BATCH * sizeof(struct queued *));
+  m_addrs = (struct sockaddr_storage *)malloc(UDP_BATCH * sizeof(struct sockaddr_storage));
+  if (!m_slots || !m_queued || !m_msgs || !m_iovs || !m_batch || !m_addrs) {
+    fprintf(stderr, "(alloc_slots) Error: No free memory left.\n");
+    free(m_slots);
+    free(m_queued);
+    free(m_msgs);
+    free(m_iovs);
+    free(m_batch);
+    free(m_addrs);
+    m_slots = NULL;
+    m_queued = NULL;
+    m_msgs = NULL;
+    m_iovs = NULL;
+    m_batch = NULL;
+    m_addrs = NULL;
+    return 1;
+  }
+  m_free = NULL;
+  for (i = UDP_BATCH - 1; i >= 0; i--) {
+    m_queued[i].data = m_slots + (size_t)i * SESSION_SLOT_SIZE;
+    m_queued[i].next = m_free;
+    m_free = &m_queued[i];
+    m_iovs[i].iov_len = SESSION_SLOT_SIZE;
+    m_msgs[i].msg_hdr.msg_iov = &m_iovs[i];
+    m_msgs[i].msg_hdr.msg_iovlen = 1;
+    m_msgs[i].msg_hdr.msg_name = &m_addrs[i];
+  }
+  return 0;
+}
+
+/**
+ * @name free_slot - Free the slot of a datagram.
+ * @param q: The datagram.
+ *
+ * @return Void.
+ */
+void SessionTable::free_slot(struct queued *q) {
+  q->next = m_free;
+  m_free = q;
+}
+
+/**
+ * @name hash - Hash an address.
+ * @param addr: The address.
+ * @param addr_len: The size of the address.
+ *
+ * This function hashes an address with FNV-1a, starting from the random seed of
+ * the table so that the peers can not choose addresses that fall in one bucket,
+ * and mixes the result so that the low bits, which pick the bucket, depend on
+ * all the bytes.
+ *
+ * @return The hash of the address.
+ */
+uint32_t SessionTable::hash(const void *addr, socklen_t addr_len) {
+  const uint8_t *p = (const uint8_t *)addr;
+  uint32_t h = 2166136261u ^ m_seed;
+  socklen_t i;
+
+  for (i = 0; i < addr_len; i++) {
+    h ^= p[i];
+    h *= 16777619u;
+  }
+  h ^= h >> 16;
+  h *= 0x85ebca6bu;
+  h ^= h >> 13;
+  h *= 0xc2b2ae35u;
+  h ^= h >> 16;
+  return h;
+}
+
+/**
+ * @name random_seed - Get a random hash seed.
+ *
+ * @return A random number, or one made of the time and the process id if the
+ *         kernel has no random numbers ready.
+ */
+uint32_t SessionTable::random_seed() {
+  uint32_t seed;
+
+  if (getrandom(&seed, sizeof(seed), GRND_NONBLOCK) != sizeof(seed))
+    seed = (uint32_t)now() * 2654435761u ^ (uint32_t)getpid();
+  return seed;
+}
+
+/**
+ * @name now - Get the time.
+ *
+ * @return The monotonic time in milliseconds.
+ */
+uint64_t SessionTable::now() {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
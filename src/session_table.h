@@ -0,0 +1,131 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * libIris - A simple and scalable networking library for Linux.
+ *
+ * Copyright (C) 2014 Giorgos Kappes <geokapp@gmail.com>
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file LICENSE.
+ *
+ */
+
+#ifndef LIBIRIS_SESSION_TABLE_H
+#define LIBIRIS_SESSION_TABLE_H
+
+#include <sys/socket.h>
+#include "libiris.h"
+
+namespace iris {
+
+#define SESSION_BUCKETS          256
+#define SESSION_SLOT_SIZE        65536
+#define SESSION_QUEUE_MAX        32
+#define SESSION_MAX              65536
+
+/**
+ * @name SessionTable - The UDP session table of a server.
+ *
+ * This class reads the datagrams of a UDP server socket once, in batches of up
+ * to UDP_BATCH datagrams per recvmmsg, and queues each in the session of its
+ * peer. A datagram stays in the slot of the batch buffer that it was read into
+ * until it is received, so the table holds at most UDP_BATCH datagrams and reads
+ * only into the free slots; the rest wait in the socket. The sessions are kept
+ * in a hash table keyed by the address of the peer, with a random seed, and the
+ * sessions with queued datagrams in a ready list, which get_client serves in
+ * turn. A session holds at most SESSION_QUEUE_MAX datagrams; the datagrams that
+ * arrive for a full session are dropped, as a full socket buffer would drop
+ * them. A session that has received nothing for the timeout and has nothing
+ * queued is removed. The table holds at most SESSION_MAX sessions; a new peer
+ * takes the place of the oldest session with nothing queued. A server that
+ * connects a socket to every peer keeps the socket in the session of the peer.
+ */
+class SessionTable {
+ public:
+  /**
+   * queued - A queued datagram.
+   *
+   * The queued struct holds one datagram of a session, in a slot of the batch
+   * buffer.
+   */
+  struct queued {
+    struct queued *next;
+    char *data;
+    size_t data_len;
+  };
+
+  /**
+   * session - A UDP session.
+   *
+   * The session struct holds the address of a peer and its queued datagrams.
+   */
+  struct session {
+    struct sockaddr_storage addr;
+    socklen_t addr_len;
+    uint32_t hash;
+    int32_t sock;
+    int32_t peer_sock;
+    uint64_t seen;
+    struct queued *head;
+    struct queued *tail;
+    int32_t queued_len;
+    bool ready;
+    struct session *next;
+    struct session *older;
+    struct session *newer;
+    struct session *ready_next;
+  };
+
+ private:
+  struct session **m_buckets;
+  uint32_t m_buckets_len;
+  int32_t m_len;
+  struct session *m_oldest;
+  struct session *m_newest;
+  struct session *m_ready;
+  struct session *m_ready_tail;
+  uint64_t m_timeout;
+  char *m_slots;
+  struct queued *m_queued;
+  struct queued *m_free;
+  int32_t m_starved;
+  uint32_t m_seed;
+  struct mmsghdr *m_msgs;
+  struct iovec *m_iovs;
+  struct queued **m_batch;
+  struct sockaddr_storage *m_addrs;
+
+ public:
+  SessionTable();
+  ~SessionTable();
+
+  void set_timeout(const int32_t sec);
+  int32_t fill(int32_t sock, int32_t owner = -1);
+  int32_t next_ready(struct sockaddr_storage *addr, socklen_t *addr_len);
+  int32_t receive(int32_t sock, const struct addrinfo *info, void *data,
+		  const size_t data_len);
+  int32_t take(const struct sockaddr_storage *addr, socklen_t addr_len, void *data,
+	       const size_t data_len);
+  int32_t peer_socket(const struct sockaddr_storage *addr, socklen_t addr_len);
+  void set_peer_socket(const struct sockaddr_storage *addr, socklen_t addr_len,
+		       int32_t sock);
+  int32_t length();
+
+ private:
+  struct session *find(const struct sockaddr_storage *addr, socklen_t addr_len,
+		       bool create);
+  void remove(struct session *s);
+  int32_t grow();
+  void expire(uint64_t time);
+  int32_t alloc_slots();
+  void free_slot(struct queued *q);
+  uint32_t hash(const void *addr, socklen_t addr_len);
+  static uint32_t random_seed();
+  static uint64_t now();
+};
+
+} // End of namespace
+
+#endif
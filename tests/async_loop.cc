@@ -0,0 +1,106 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+//
+// Checks that the coroutines spawned on an AsyncLoop serve a loopback echo
+// server and its clients together on one thread.
+//
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include "../src/libiris.h"
+#include "../src/coroutine.h"
+
+using namespace iris;
+
+#define CLIENTS                  4
+#define ROUNDS                   8
+
+static int32_t echoed = 0;
+
+static Task<int32_t> serve(AsyncLoop *loop, Client *client) {
+  char data[32];
+  int32_t bytes;
+
+  while ((bytes = co_await loop->receive_data(client, data, sizeof(data))) > 0) {
+    if ((co_await loop->send_data(client, data, bytes)) != bytes)
+      break;
+  }
+  client->detach();
+  delete client;
+  co_return 0;
+}
+
+static Task<int32_t> accept_clients(AsyncLoop *loop, Server *server) {
+  Client *client;
+  int32_t i;
+
+  for (i = 0; i < CLIENTS; i++) {
+    client = new Client;
+    if (co_await loop->get_client(server, client)) {
+      delete client;
+      co_return 1;
+    }
+    loop->spawn(serve(loop, client));
+  }
+  co_return 0;
+}
+
+static Task<int32_t> talk(AsyncLoop *loop, const char *service, int32_t n) {
+  Client client;
+  char data[32], in[32];
+  int32_t i, len;
+
+  if (co_await loop->attach(&client, "127.0.0.1", service))
+    co_return 1;
+  for (i = 0; i < ROUNDS; i++) {
+    len = snprintf(data, sizeof(data), "client %d round %d", n, i);
+    if ((co_await loop->send_data(&client, data, len)) != len)
+      break;
+    memset(in, 0, sizeof(in));
+    if ((co_await loop->receive_data(&client, in, len)) != len || memcmp(in, data, len))
+      break;
+    echoed++;
+  }
+  client.detach();
+  co_return 0;
+}
+
+int main() {
+  struct sockaddr_in addr;
+  socklen_t addr_len = sizeof(addr);
+  char service[8];
+  AsyncLoop loop;
+  Server server;
+  int32_t i;
+
+  alarm(5);
+  // Let the kernel pick a free port.
+  if (server.start("127.0.0.1", "0", 64) ||
+      getsockname(server.sockets()[0], (struct sockaddr *)&addr, &addr_len) < 0 ||
+      loop.open()) {
+    fprintf(stderr, "(async_loop) Error: Can not start the server.\n");
+    return 1;
+  }
+  snprintf(service, sizeof(service), "%d", ntohs(addr.sin_port));
+  loop.spawn(accept_clients(&loop, &server));
+  for (i = 0; i < CLIENTS; i++)
+    loop.spawn(talk(&loop, service, i));
+  if (loop.run()) {
+    fprintf(stderr, "(async_loop) Error: The loop failed.\n");
+    return 1;
+  }
+  if (echoed != CLIENTS * ROUNDS) {
+    fprintf(stderr, "(async_loop) Error: %d of %d messages were echoed.\n", echoed,
+	    CLIENTS * ROUNDS);
+    return 1;
+  }
+  loop.close();
+  server.stop();
+  printf("(async_loop) OK\n");
+  return 0;
+}
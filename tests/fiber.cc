@@ -0,0 +1,111 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+//
+// Checks that two blocking handlers run concurrently on the fibers of one
+// thread, so a handler that waits for its client does not hold back another,
+// and that the listening socket does not block the scheduler.
+//
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include "../src/libiris.h"
+#include "../src/fiber.h"
+
+using namespace iris;
+
+#define CLIENTS                  2
+
+static int32_t served = 0;
+
+// Take a greeting and echo one message with the blocking calls of the endpoints.
+static void echo(Server *server, Client *client, void *arg) {
+  char data[16];
+  int32_t bytes;
+
+  bytes = server->receive_data(data, 1, client);
+  if (bytes > 0)
+    bytes = server->receive_data(data, sizeof(data), client);
+  if (bytes > 0)
+    server->send_data(data, bytes, client);
+  client->detach();
+  delete client;
+  if (++served == CLIENTS)
+    FiberScheduler::current()->stop();
+}
+
+static int32_t exchange(Client *client, const char *data) {
+  char in[16];
+
+  memset(in, 0, sizeof(in));
+  if (client->send_data(data, strlen(data)) != (int32_t)strlen(data) ||
+      client->receive_data(in, sizeof(in) - 1) != (int32_t)strlen(data))
+    return 1;
+  return strcmp(in, data) != 0;
+}
+
+static void *peers(void *arg) {
+  Client first, second;
+  const char *service = (const char *)arg;
+
+  //
+  // The handler of the first client waits for it, while the second client is
+  // served. Each client sends a greeting first, since get_client returns a
+  // connection only when it has data.
+  //
+  if (first.attach("127.0.0.1", service) || first.send_data("x", 1) != 1)
+    return (void *)1;
+  usleep(100000);
+  if (second.attach("127.0.0.1", service) || second.send_data("x", 1) != 1)
+    return (void *)1;
+  usleep(100000);
+  if (exchange(&second, "second"))
+    return (void *)1;
+  if (exchange(&first, "first"))
+    return (void *)1;
+  first.detach();
+  second.detach();
+  return NULL;
+}
+
+int main() {
+  struct sockaddr_in addr;
+  socklen_t addr_len = sizeof(addr);
+  char service[8];
+  FiberScheduler scheduler;
+  Server server;
+  pthread_t thread;
+  void *result;
+
+  alarm(5);
+  // Let the kernel pick a free port.
+  if (server.start("127.0.0.1", "0", 64) ||
+      getsockname(server.sockets()[0], (struct sockaddr *)&addr, &addr_len) < 0) {
+    fprintf(stderr, "(fiber) Error: Can not start the server.\n");
+    return 1;
+  }
+  snprintf(service, sizeof(service), "%d", ntohs(addr.sin_port));
+  if (scheduler.open() || scheduler.serve(&server, echo, NULL) ||
+      pthread_create(&thread, NULL, peers, service)) {
+    fprintf(stderr, "(fiber) Error: Can not start the scheduler.\n");
+    return 1;
+  }
+  if (scheduler.run() || pthread_join(thread, &result) || result) {
+    fprintf(stderr, "(fiber) Error: The handlers did not run concurrently.\n");
+    return 1;
+  }
+  if (!(fcntl(server.sockets()[0], F_GETFL) & O_NONBLOCK)) {
+    fprintf(stderr, "(fiber) Error: The listening socket blocks.\n");
+    return 1;
+  }
+  scheduler.close();
+  server.stop();
+  printf("(fiber) OK\n");
+  return 0;
+}
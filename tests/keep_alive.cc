@@ -0,0 +1,78 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+//
+// Checks that a kept connection which is rearmed with a pipelined message in its
+// read buffer is returned again by get_client with that message.
+//
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include "../src/libiris.h"
+
+using namespace iris;
+
+int main() {
+  struct sockaddr_in addr;
+  socklen_t addr_len = sizeof(addr);
+  char service[8], *in = NULL;
+  const char *messages[2] = {"first request", "second request"};
+  size_t in_size = 0;
+  Server server;
+  Client *client, peer;
+  int32_t bytes;
+
+  // A lost message would leave get_client waiting.
+  alarm(5);
+  server.set_keep_alive(true);
+  // Let the kernel pick a free port.
+  if (server.start("127.0.0.1", "0", 64) ||
+      getsockname(server.sockets()[0], (struct sockaddr *)&addr, &addr_len) < 0) {
+    fprintf(stderr, "(keep_alive) Error: Can not start the server.\n");
+    return 1;
+  }
+  snprintf(service, sizeof(service), "%d", ntohs(addr.sin_port));
+  if (peer.attach("127.0.0.1", service)) {
+    fprintf(stderr, "(keep_alive) Error: Can not connect.\n");
+    return 1;
+  }
+
+  // Both messages are sent back to back, so one read takes both.
+  for (int32_t i = 0; i < 2; i++) {
+    if (peer.send_message(messages[i], strlen(messages[i])) != (int32_t)strlen(messages[i])) {
+      fprintf(stderr, "(keep_alive) Error: Message %d was not sent.\n", i);
+      return 1;
+    }
+  }
+  usleep(100000);
+  for (int32_t i = 0; i < 2; i++) {
+    client = new Client();
+    if (server.get_client(client)) {
+      fprintf(stderr, "(keep_alive) Error: Can not get the client of message %d.\n", i);
+      return 1;
+    }
+    bytes = server.receive_message(&in, &in_size, client);
+    if (bytes != (int32_t)strlen(messages[i]) || memcmp(in, messages[i], bytes)) {
+      fprintf(stderr, "(keep_alive) Error: Message %d is not whole.\n", i);
+      return 1;
+    }
+    if (i == 0 && !client->buffered()) {
+      fprintf(stderr, "(keep_alive) Error: The second message was not buffered.\n");
+      return 1;
+    }
+    if (server.rearm(client)) {
+      fprintf(stderr, "(keep_alive) Error: Can not rearm the client.\n");
+      return 1;
+    }
+    delete client;
+  }
+  peer.detach();
+  server.stop();
+  free(in);
+  printf("(keep_alive) OK\n");
+  return 0;
+}
@@ -0,0 +1,103 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+//
+// Checks that the messages of a non-blocking sender are gathered when the
+// socket buffer is full and that a non-blocking receiver returns every
+// message whole although its bytes come with many reads, and that a message
+// above the maximum size is refused.
+//
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include "../src/libiris.h"
+
+using namespace iris;
+
+#define MESSAGES                 64
+#define MESSAGE_SIZE             (256 * 1024)
+
+static void fill_message(char *data, int32_t n) {
+  for (int32_t i = 0; i < MESSAGE_SIZE; i++)
+    data[i] = (char)(n + i % 253);
+}
+
+int main() {
+  struct sockaddr_in addr;
+  socklen_t addr_len = sizeof(addr);
+  char service[8], *data, *in = NULL;
+  size_t in_size = 0;
+  Server server;
+  Client client, peer;
+  int32_t bytes, sent = 0, received = 0;
+
+  data = (char *)malloc(MESSAGE_SIZE);
+  // Let the kernel pick a free port.
+  if (!data || server.start("127.0.0.1", "0", 64) ||
+      getsockname(server.sockets()[0], (struct sockaddr *)&addr, &addr_len) < 0) {
+    fprintf(stderr, "(message) Error: Can not start the server.\n");
+    return 1;
+  }
+  snprintf(service, sizeof(service), "%d", ntohs(addr.sin_port));
+  if (peer.attach("127.0.0.1", service) || peer.set_nonblocking(true)) {
+    fprintf(stderr, "(message) Error: Can not connect.\n");
+    return 1;
+  }
+
+  // The socket buffer fills up long before the last message.
+  for (sent = 0; sent < MESSAGES; sent++) {
+    fill_message(data, sent);
+    if (peer.send_message(data, MESSAGE_SIZE) != MESSAGE_SIZE) {
+      fprintf(stderr, "(message) Error: Message %d was not sent.\n", sent);
+      return 1;
+    }
+  }
+  if (server.get_client(&client) || client.set_nonblocking(true)) {
+    fprintf(stderr, "(message) Error: Can not accept.\n");
+    return 1;
+  }
+  while (received < MESSAGES) {
+    if (peer.flush() < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
+      fprintf(stderr, "(message) Error: Can not flush.\n");
+      return 1;
+    }
+    bytes = server.receive_message(&in, &in_size, &client);
+    if (bytes == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+      continue;
+    fill_message(data, received);
+    if (bytes != MESSAGE_SIZE || memcmp(in, data, MESSAGE_SIZE)) {
+      fprintf(stderr, "(message) Error: Message %d is not whole.\n", received);
+      return 1;
+    }
+    received++;
+  }
+
+  // A message above the maximum size is refused before it is buffered.
+  server.set_message_max(MESSAGE_SIZE / 2);
+  if (peer.send_message(data, MESSAGE_SIZE) != MESSAGE_SIZE) {
+    fprintf(stderr, "(message) Error: The large message was not sent.\n");
+    return 1;
+  }
+  do {
+    if (peer.flush() < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
+      fprintf(stderr, "(message) Error: Can not flush.\n");
+      return 1;
+    }
+    bytes = server.receive_message(&in, &in_size, &client);
+  } while (bytes == -1 && (errno == EAGAIN || errno == EWOULDBLOCK));
+  if (bytes != -1 || errno != EMSGSIZE) {
+    fprintf(stderr, "(message) Error: The large message was not refused.\n");
+    return 1;
+  }
+  peer.detach();
+  client.detach();
+  server.stop();
+  free(data);
+  free(in);
+  printf("(message) OK\n");
+  return 0;
+}
@@ -0,0 +1,106 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+//
+// Checks that a UDP server in the connected peer mode gives a burst of a peer
+// one client with a socket of its own, which receives the datagrams of that
+// peer only, in order.
+//
+
+#include <stdio.h>
+#include <string.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include "../src/libiris.h"
+
+using namespace iris;
+
+#define PEERS                    2
+#define BURST                    5
+
+static int32_t expect(Server *server, Client *client, char peer, int32_t n) {
+  char data[16], want[16];
+  int32_t bytes;
+
+  bytes = server->receive_data(data, sizeof(data) - 1, client);
+  if (bytes <= 0)
+    return 1;
+  data[bytes] = '\0';
+  snprintf(want, sizeof(want), "%c%d", peer, n);
+  if (strcmp(data, want)) {
+    fprintf(stderr, "(peer_sockets) Error: Got %s instead of %s.\n", data, want);
+    return 1;
+  }
+  return 0;
+}
+
+int main() {
+  struct sockaddr_in addr, peer_addr[PEERS];
+  socklen_t addr_len = sizeof(addr);
+  char service[8], data[16];
+  Server server(Endpoint::UDP);
+  Client clients[PEERS], peers[PEERS];
+  int32_t i, j, served[PEERS];
+
+  server.set_peer_sockets(true);
+  // Let the kernel pick a free port.
+  if (server.start("127.0.0.1", "0", 64) ||
+      getsockname(server.sockets()[0], (struct sockaddr *)&addr, &addr_len) < 0) {
+    fprintf(stderr, "(peer_sockets) Error: Can not start the server.\n");
+    return 1;
+  }
+  snprintf(service, sizeof(service), "%d", ntohs(addr.sin_port));
+
+  // Both peers send a burst before the server sees any of it.
+  for (i = 0; i < PEERS; i++) {
+    peers[i].set_protocol(Endpoint::UDP);
+    served[i] = -1;
+    if (peers[i].attach("127.0.0.1", service)) {
+      fprintf(stderr, "(peer_sockets) Error: Can not connect.\n");
+      return 1;
+    }
+    for (j = 0; j < BURST; j++) {
+      snprintf(data, sizeof(data), "%c%d", 'a' + i, j);
+      peers[i].send_data(data, strlen(data));
+    }
+    addr_len = sizeof(peer_addr[i]);
+    getsockname(peers[i].sockets()[0], (struct sockaddr *)&peer_addr[i], &addr_len);
+  }
+
+  // Every peer gets one client, with a socket of its own.
+  for (i = 0; i < PEERS; i++) {
+    if (server.get_client(&clients[i])) {
+      fprintf(stderr, "(peer_sockets) Error: get_client failed.\n");
+      return 1;
+    }
+    for (j = 0; j < PEERS; j++)
+      if (((struct sockaddr_in *)clients[i].address_info()->ai_addr)->sin_port ==
+	  peer_addr[j].sin_port)
+	break;
+    if (j == PEERS || served[j] >= 0 ||
+	clients[i].get_socket() == server.sockets()[0]) {
+      fprintf(stderr, "(peer_sockets) Error: Peer %d was served twice.\n", j);
+      return 1;
+    }
+    served[j] = i;
+  }
+
+  // The burst was moved to the client, and the next datagram reaches its socket.
+  for (i = 0; i < PEERS; i++) {
+    snprintf(data, sizeof(data), "%c%d", 'a' + i, BURST);
+    peers[i].send_data(data, strlen(data));
+  }
+  for (i = 0; i < PEERS; i++) {
+    for (j = 0; j <= BURST; j++) {
+      if (expect(&server, &clients[served[i]], 'a' + i, j))
+	return 1;
+    }
+  }
+  for (i = 0; i < PEERS; i++) {
+    clients[i].detach();
+    peers[i].detach();
+  }
+  server.stop();
+  printf("(peer_sockets) OK\n");
+  return 0;
+}
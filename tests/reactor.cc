@@ -0,0 +1,80 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <iostream>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netdb.h>
+#include "../src/libiris.h"
+#include "../src/reactor.h"
+
+using namespace iris;
+
+//
+// Print the data of every client, like the server test, but serve all the
+// connections from one event loop.
+//
+class Printer : public Reactor::Handler {
+ public:
+  void on_accept(Reactor *reactor, Client *client) {
+    std::cout << "(Reactor) Client reached.\n";
+  }
+
+  void on_readable(Reactor *reactor, Client *client) {
+    char data[100];
+    int bytes;
+
+    memset(data, 0, 100);
+    bytes = client->receive_data(data, 99);
+    if (bytes <= 0) {
+      reactor->close_client(client);
+      return;
+    }
+    std::cout << data << std::endl;
+  }
+
+  void on_close(Reactor *reactor, Client *client) {
+    std::cout << "(Reactor) Client left.\n";
+  }
+};
+
+int main(int argc, char *argv[]) {
+  int status;
+  Server server;
+  Reactor reactor;
+  Printer printer;
+
+  status = server.start(NULL, "9999", 10);
+  if (status) {
+    std::cout << "(Reactor) Error on startup.\n";
+    return 1;
+  }
+  status = reactor.attach(&server, &printer);
+  if (status) {
+    std::cout << "(Reactor) Error on attach.\n";
+    server.stop();
+    return 1;
+  }
+  std::cout << "(Reactor) Up and running!\n";
+
+  //
+  // Dispatch events until an error occurs.
+  //
+  status = reactor.run();
+  if (status)
+    std::cout << "(Reactor) run error.\n";
+
+  std::cout << "(Reactor) Stopping...\n";
+  reactor.detach();
+  status = server.stop();
+  if (status) {
+    std::cout << "(Reactor) Error on stop.\n";
+    return 1;
+  } else {
+    std::cout << "(Reactor) Stopped!\n";
+  }
+}
@@ -0,0 +1,112 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+//
+// Checks that a warm connection record pool serves get_client and detach
+// without allocating records, and that the server side of a request allocates
+// nothing but the Client object.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include "../src/libiris.h"
+#include "../src/record_pool.h"
+
+using namespace iris;
+
+#define WARMUP                   16
+#define ROUNDS                   256
+
+//
+// Count the allocations of the server side by wrapping the allocator of the C
+// library.
+//
+extern "C" void *__libc_malloc(size_t size);
+extern "C" void *__libc_calloc(size_t n, size_t size);
+extern "C" void *__libc_realloc(void *ptr, size_t size);
+
+static bool counting = false;
+static uint64_t allocations = 0;
+
+extern "C" void *malloc(size_t size) {
+  if (counting)
+    allocations++;
+  return __libc_malloc(size);
+}
+
+extern "C" void *calloc(size_t n, size_t size) {
+  if (counting)
+    allocations++;
+  return __libc_calloc(n, size);
+}
+
+extern "C" void *realloc(void *ptr, size_t size) {
+  if (counting)
+    allocations++;
+  return __libc_realloc(ptr, size);
+}
+
+static int32_t round_trip(Server *server, const char *service) {
+  Client *client, peer;
+  char data[16];
+  int32_t result = 0;
+
+  if (peer.attach("127.0.0.1", service) || peer.send_data("ping", 4) != 4)
+    return 1;
+  counting = true;
+  client = new Client;
+  if (server->get_client(client) || server->receive_data(data, sizeof(data), client) != 4)
+    result = 1;
+  client->detach();
+  delete client;
+  counting = false;
+  peer.detach();
+  return result;
+}
+
+int main() {
+  struct sockaddr_in addr;
+  socklen_t addr_len = sizeof(addr);
+  char service[8];
+  Server server;
+  uint64_t warm;
+  int32_t i;
+
+  // Let the kernel pick a free port.
+  if (server.start("127.0.0.1", "0", 64) ||
+      getsockname(server.sockets()[0], (struct sockaddr *)&addr, &addr_len) < 0) {
+    fprintf(stderr, "(record_pool) Error: Can not start the server.\n");
+    return 1;
+  }
+  snprintf(service, sizeof(service), "%d", ntohs(addr.sin_port));
+  for (i = 0; i < WARMUP; i++) {
+    if (round_trip(&server, service)) {
+      fprintf(stderr, "(record_pool) Error: Round trip %d failed.\n", i);
+      return 1;
+    }
+  }
+  warm = RecordPool::allocations();
+  allocations = 0;
+  for (i = 0; i < ROUNDS; i++) {
+    if (round_trip(&server, service)) {
+      fprintf(stderr, "(record_pool) Error: Round trip %d failed.\n", WARMUP + i);
+      return 1;
+    }
+  }
+  server.stop();
+  if (RecordPool::allocations() != warm) {
+    fprintf(stderr, "(record_pool) Error: %llu records allocated after warm-up.\n",
+	    (unsigned long long)(RecordPool::allocations() - warm));
+    return 1;
+  }
+  if (allocations != ROUNDS) {
+    fprintf(stderr, "(record_pool) Error: %llu allocations in %d requests.\n",
+	    (unsigned long long)allocations, ROUNDS);
+    return 1;
+  }
+  printf("(record_pool) OK\n");
+  return 0;
+}
@@ -0,0 +1,133 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+//
+// Checks that a relay forwards the data that an endpoint buffered before the
+// spliced data although the other endpoint gathers, that a sender is held back
+// while the receiver does not read, and that each side can be closed on its own.
+//
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include "../src/libiris.h"
+#include "../src/relay.h"
+
+using namespace iris;
+
+#define FLOOD_MAX                (16 * 1024 * 1024)
+
+static void *run(void *arg) {
+  return (void *)(intptr_t)((Relay *)arg)->run();
+}
+
+static int32_t read_all(int32_t fd, char *data, size_t len) {
+  size_t total = 0;
+  ssize_t bytes;
+
+  while (total < len) {
+    bytes = read(fd, data + total, len - total);
+    if (bytes <= 0)
+      return 1;
+    total += bytes;
+  }
+  return 0;
+}
+
+int main() {
+  int32_t left[2], right[2];
+  char data[4096], in[4096];
+  size_t flooded = 0, drained = 0;
+  Client a, b;
+  Relay relay;
+  pthread_t thread;
+  void *result;
+  ssize_t bytes;
+
+  // A relay that does not forward or close its sides would leave the test waiting.
+  alarm(10);
+  if (socketpair(AF_UNIX, SOCK_STREAM, 0, left) < 0 ||
+      socketpair(AF_UNIX, SOCK_STREAM, 0, right) < 0) {
+    fprintf(stderr, "(relay) Error: Can not create the sockets.\n");
+    return 1;
+  }
+  a.set_socket(left[1]);
+  b.set_socket(right[0]);
+
+  // The first bytes are read into a's buffer, and b gathers.
+  if (write(left[0], "one", 3) != 3 || a.set_read_buffer(READ_BUFFER_SIZE) ||
+      a.fill() != 3) {
+    fprintf(stderr, "(relay) Error: Can not buffer the first bytes.\n");
+    return 1;
+  }
+  b.set_gather(true);
+  relay.set_pipe_size(4096);
+  if (relay.open(&a, &b) || pthread_create(&thread, NULL, run, &relay)) {
+    fprintf(stderr, "(relay) Error: Can not open the relay.\n");
+    return 1;
+  }
+  if (write(left[0], "two", 3) != 3 || read_all(right[1], in, 6) || memcmp(in, "onetwo", 6)) {
+    fprintf(stderr, "(relay) Error: The buffered bytes were not forwarded first.\n");
+    return 1;
+  }
+
+  // The sender stops when the receiver does not read.
+  memset(data, 'x', sizeof(data));
+  fcntl(left[0], F_SETFL, O_NONBLOCK);
+  while (flooded < FLOOD_MAX) {
+    bytes = write(left[0], data, sizeof(data));
+    if (bytes < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      // Let the relay fill its side before the sender gives up.
+      usleep(100000);
+      bytes = write(left[0], data, sizeof(data));
+      if (bytes < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+	break;
+    }
+    if (bytes < 0) {
+      fprintf(stderr, "(relay) Error: Can not flood the relay.\n");
+      return 1;
+    }
+    flooded += bytes;
+  }
+  if (flooded >= FLOOD_MAX) {
+    fprintf(stderr, "(relay) Error: The sender was not held back.\n");
+    return 1;
+  }
+
+  // The left side closes; the right side drains, reads the end and answers.
+  shutdown(left[0], SHUT_WR);
+  while ((bytes = read(right[1], in, sizeof(in))) > 0)
+    drained += bytes;
+  if (bytes < 0 || drained != flooded) {
+    fprintf(stderr, "(relay) Error: %zu of %zu bytes arrived.\n", drained, flooded);
+    return 1;
+  }
+  fcntl(left[0], F_SETFL, 0);
+  if (write(right[1], "back", 4) != 4 || read_all(left[0], in, 4) || memcmp(in, "back", 4)) {
+    fprintf(stderr, "(relay) Error: The half-closed relay did not answer.\n");
+    return 1;
+  }
+  shutdown(right[1], SHUT_WR);
+  if (read(left[0], in, sizeof(in)) != 0 || pthread_join(thread, &result) || result) {
+    fprintf(stderr, "(relay) Error: The relay did not end.\n");
+    return 1;
+  }
+  if (relay.forwarded(&a) != 6 + flooded || relay.forwarded(&b) != 4) {
+    fprintf(stderr, "(relay) Error: The forwarded byte counts are wrong.\n");
+    return 1;
+  }
+  relay.close();
+  a.detach();
+  b.detach();
+  close(left[0]);
+  close(right[1]);
+  printf("(relay) OK\n");
+  return 0;
+}
@@ -0,0 +1,153 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+//
+// Checks that a RUDP message crosses a path that loses packets, with the lost
+// fragments sent again, and that a client of the server replies through the
+// protocol state of the server's socket.
+//
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <poll.h>
+#include <pthread.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include "../src/libiris.h"
+
+using namespace iris;
+
+#define DATA                     (200 * 1024)
+#define DROP_EVERY               7
+
+struct proxy {
+  int32_t sock;
+  struct sockaddr_in server;
+  volatile bool stop;
+  int32_t dropped;
+};
+
+struct rudp_server {
+  Server *server;
+  char *data;
+  int32_t bytes;
+  int32_t replied;
+};
+
+// Forward the packets between the peer and the server, losing some of the peer's.
+static void *forward(void *arg) {
+  struct proxy *p = (struct proxy *)arg;
+  struct sockaddr_in from, peer;
+  socklen_t from_len;
+  struct pollfd pfd;
+  char packet[65536];
+  ssize_t bytes;
+  int32_t count = 0;
+
+  memset(&peer, 0, sizeof(peer));
+  pfd.fd = p->sock;
+  pfd.events = POLLIN;
+  while (!p->stop) {
+    if (poll(&pfd, 1, 10) <= 0)
+      continue;
+    from_len = sizeof(from);
+    bytes = recvfrom(p->sock, packet, sizeof(packet), 0, (struct sockaddr *)&from,
+		     &from_len);
+    if (bytes < 0)
+      continue;
+    if (from.sin_port == p->server.sin_port) {
+      sendto(p->sock, packet, bytes, 0, (struct sockaddr *)&peer, sizeof(peer));
+    } else {
+      peer = from;
+      if (++count % DROP_EVERY == 0) {
+	p->dropped++;
+	continue;
+      }
+      sendto(p->sock, packet, bytes, 0, (struct sockaddr *)&p->server,
+	     sizeof(p->server));
+    }
+  }
+  return NULL;
+}
+
+static void *serve(void *arg) {
+  struct rudp_server *rs = (struct rudp_server *)arg;
+  Client client;
+
+  rs->bytes = -1;
+  rs->replied = -1;
+  if (!rs->server->get_client(&client)) {
+    rs->bytes = client.receive_data(rs->data, DATA);
+    rs->replied = client.send_data("done", 4);
+  }
+  client.detach();
+  return NULL;
+}
+
+static int32_t bind_local(int32_t sock, struct sockaddr_in *addr) {
+  socklen_t addr_len = sizeof(*addr);
+
+  memset(addr, 0, sizeof(*addr));
+  addr->sin_family = AF_INET;
+  addr->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  if (bind(sock, (struct sockaddr *)addr, sizeof(*addr)) < 0)
+    return 1;
+  return getsockname(sock, (struct sockaddr *)addr, &addr_len) < 0;
+}
+
+int main() {
+  Server server(Endpoint::RUDP);
+  Client peer(Endpoint::RUDP);
+  struct rudp_server rs;
+  struct proxy p;
+  struct sockaddr_in proxy_addr;
+  socklen_t addr_len = sizeof(p.server);
+  pthread_t proxy_thread, server_thread;
+  char service[8], *data, *in, reply[8];
+  int32_t i, sent, replied;
+
+  data = (char *)malloc(DATA);
+  in = (char *)malloc(DATA);
+  p.sock = socket(AF_INET, SOCK_DGRAM, 0);
+  p.stop = false;
+  p.dropped = 0;
+  // Let the kernel pick free ports.
+  if (!data || !in || p.sock < 0 || bind_local(p.sock, &proxy_addr) ||
+      server.start("127.0.0.1", "0", 64) ||
+      getsockname(server.sockets()[0], (struct sockaddr *)&p.server, &addr_len) < 0) {
+    fprintf(stderr, "(rudp) Error: Can not start the server.\n");
+    return 1;
+  }
+  // The peer talks to the proxy.
+  snprintf(service, sizeof(service), "%d", ntohs(proxy_addr.sin_port));
+  for (i = 0; i < DATA; i++)
+    data[i] = (char)(i % 241);
+  rs.server = &server;
+  rs.data = in;
+  if (peer.attach("127.0.0.1", service) ||
+      pthread_create(&proxy_thread, NULL, forward, &p) ||
+      pthread_create(&server_thread, NULL, serve, &rs)) {
+    fprintf(stderr, "(rudp) Error: Can not connect.\n");
+    return 1;
+  }
+  sent = peer.send_data(data, DATA);
+  replied = peer.receive_data(reply, sizeof(reply));
+  pthread_join(server_thread, NULL);
+  p.stop = true;
+  pthread_join(proxy_thread, NULL);
+  if (sent != DATA || rs.bytes != DATA || memcmp(in, data, DATA) || !p.dropped) {
+    fprintf(stderr, "(rudp) Error: The message was not sent again.\n");
+    return 1;
+  }
+  if (rs.replied != 4 || replied != 4 || memcmp(reply, "done", 4)) {
+    fprintf(stderr, "(rudp) Error: The client did not reply.\n");
+    return 1;
+  }
+  peer.detach();
+  server.stop();
+  free(data);
+  free(in);
+  printf("(rudp) OK\n");
+  return 0;
+}
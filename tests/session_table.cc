@@ -0,0 +1,85 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+//
+// Checks that a UDP server in session mode delivers every datagram of a burst
+// larger than its batch buffer, in order, to the client of its peer.
+//
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include "../src/libiris.h"
+
+using namespace iris;
+
+#define PEERS                    3
+#define DATAGRAMS                30
+
+int main() {
+  struct sockaddr_in addr, peer_addr[PEERS];
+  socklen_t addr_len = sizeof(addr);
+  char service[8], data[16];
+  Server server(Endpoint::UDP);
+  Client client, peers[PEERS];
+  int32_t i, j, bytes, next[PEERS], total = 0;
+
+  server.set_sessions(true);
+  // Let the kernel pick a free port.
+  if (server.start("127.0.0.1", "0", 64) ||
+      getsockname(server.sockets()[0], (struct sockaddr *)&addr, &addr_len) < 0) {
+    fprintf(stderr, "(session_table) Error: Can not start the server.\n");
+    return 1;
+  }
+  snprintf(service, sizeof(service), "%d", ntohs(addr.sin_port));
+  for (i = 0; i < PEERS; i++) {
+    peers[i].set_protocol(Endpoint::UDP);
+    next[i] = 0;
+    if (peers[i].attach("127.0.0.1", service)) {
+      fprintf(stderr, "(session_table) Error: Can not connect.\n");
+      return 1;
+    }
+    for (j = 0; j < DATAGRAMS; j++) {
+      snprintf(data, sizeof(data), "%d", j);
+      if (peers[i].send_data(data, strlen(data)) < 0) {
+	fprintf(stderr, "(session_table) Error: Can not send.\n");
+	return 1;
+      }
+    }
+    // The server sees the address that the peer sends from.
+    addr_len = sizeof(peer_addr[i]);
+    getsockname(peers[i].sockets()[0], (struct sockaddr *)&peer_addr[i], &addr_len);
+  }
+
+  while (total < PEERS * DATAGRAMS) {
+    if (server.get_client(&client)) {
+      fprintf(stderr, "(session_table) Error: get_client failed.\n");
+      return 1;
+    }
+    bytes = server.receive_data(data, sizeof(data) - 1, &client);
+    for (i = 0; i < PEERS; i++)
+      if (((struct sockaddr_in *)client.address_info()->ai_addr)->sin_port ==
+	  peer_addr[i].sin_port)
+	break;
+    client.detach();
+    if (bytes <= 0 || i == PEERS) {
+      fprintf(stderr, "(session_table) Error: No datagram for the client.\n");
+      return 1;
+    }
+    data[bytes] = '\0';
+    if (atoi(data) != next[i]) {
+      fprintf(stderr, "(session_table) Error: Peer %d got %s instead of %d.\n", i, data,
+	      next[i]);
+      return 1;
+    }
+    next[i]++;
+    total++;
+  }
+  for (i = 0; i < PEERS; i++)
+    peers[i].detach();
+  server.stop();
+  printf("(session_table) OK\n");
+  return 0;
+}
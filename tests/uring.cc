@@ -0,0 +1,125 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+//
+// Checks that the IoUring backend of the reactor accepts connections with
+// their peer address, echoes their data and reports the written echoes with
+// on_drain. The test passes without running on kernels that lack io_uring.
+//
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include "../src/libiris.h"
+#include "../src/reactor.h"
+
+using namespace iris;
+
+#define CONNECTIONS              4
+
+class Echo : public Reactor::Handler {
+ public:
+  int32_t accepted;
+  int32_t addressed;
+  int32_t drained;
+
+  Echo() : accepted(0), addressed(0), drained(0) {}
+
+  void on_accept(Reactor *reactor, Client *client) {
+    accepted++;
+    if (client->address_info() && client->address_info()->ai_family == AF_INET)
+      addressed++;
+  }
+
+  void on_readable(Reactor *reactor, Client *client) {
+    char data[100];
+    int32_t bytes;
+
+    bytes = client->receive_data(data, sizeof(data));
+    if (bytes <= 0) {
+      reactor->close_client(client);
+      return;
+    }
+    reactor->send_data(client, data, bytes);
+  }
+
+  void on_drain(Reactor *reactor, Client *client) {
+    drained++;
+  }
+};
+
+static void *run(void *arg) {
+  ((Reactor *)arg)->run();
+  return NULL;
+}
+
+int main() {
+  struct sockaddr_in addr;
+  socklen_t addr_len = sizeof(addr);
+  char service[8], data[16], in[16];
+  Server server;
+  Reactor reactor(Reactor::IoUring);
+  Client peers[CONNECTIONS];
+  Echo echo;
+  pthread_t thread;
+  int32_t i, bytes;
+
+  alarm(5);
+  // Let the kernel pick a free port.
+  if (server.start("127.0.0.1", "0", 64) ||
+      getsockname(server.sockets()[0], (struct sockaddr *)&addr, &addr_len) < 0) {
+    fprintf(stderr, "(uring) Error: Can not start the server.\n");
+    return 1;
+  }
+  if (reactor.attach(&server, &echo)) {
+    printf("(uring) OK, io_uring is not available\n");
+    reactor.detach();
+    server.stop();
+    return 0;
+  }
+  if (pthread_create(&thread, NULL, run, &reactor)) {
+    fprintf(stderr, "(uring) Error: Can not start the reactor.\n");
+    return 1;
+  }
+  snprintf(service, sizeof(service), "%d", ntohs(addr.sin_port));
+  for (i = 0; i < CONNECTIONS; i++) {
+    if (peers[i].attach("127.0.0.1", service)) {
+      fprintf(stderr, "(uring) Error: Can not connect.\n");
+      return 1;
+    }
+  }
+  for (i = 0; i < CONNECTIONS; i++) {
+    snprintf(data, sizeof(data), "echo %d", i);
+    if (peers[i].send_data(data, strlen(data)) != (int32_t)strlen(data)) {
+      fprintf(stderr, "(uring) Error: Can not send.\n");
+      return 1;
+    }
+    memset(in, 0, sizeof(in));
+    bytes = peers[i].receive_data(in, sizeof(in) - 1);
+    if (bytes != (int32_t)strlen(data) || strcmp(in, data)) {
+      fprintf(stderr, "(uring) Error: The data of connection %d were not echoed.\n", i);
+      return 1;
+    }
+  }
+  reactor.stop();
+  pthread_join(thread, NULL);
+  if (echo.accepted != CONNECTIONS || echo.addressed != CONNECTIONS) {
+    fprintf(stderr, "(uring) Error: The clients have no peer address.\n");
+    return 1;
+  }
+  if (echo.drained != CONNECTIONS) {
+    fprintf(stderr, "(uring) Error: %d of %d echoes were drained.\n", echo.drained,
+	    CONNECTIONS);
+    return 1;
+  }
+  for (i = 0; i < CONNECTIONS; i++)
+    peers[i].detach();
+  reactor.detach();
+  server.stop();
+  printf("(uring) OK\n");
+  return 0;
+}
@@ -0,0 +1,220 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+//
+// Checks that a TCP vector cut short by a full socket buffer is resumed inside
+// the buffer where it stopped, that a vector sent to a UDP or RUDP endpoint is
+// packetized like contiguous data and that a received message is scattered
+// across a vector.
+//
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <sys/uio.h>
+#include <pthread.h>
+#include "../src/libiris.h"
+
+using namespace iris;
+
+#define PACKET                   1000
+#define DATA                     2500
+#define TCP_DATA                 (8 * 1024 * 1024)
+
+static int32_t start(Server *server, char *service, size_t service_len) {
+  struct sockaddr_in addr;
+  socklen_t addr_len = sizeof(addr);
+
+  // Let the kernel pick a free port.
+  if (server->start("127.0.0.1", "0", 64) ||
+      getsockname(server->sockets()[0], (struct sockaddr *)&addr, &addr_len) < 0)
+    return 1;
+  snprintf(service, service_len, "%d", ntohs(addr.sin_port));
+  return 0;
+}
+
+static void fill_vector(struct iovec *iov, char *data) {
+  for (int32_t i = 0; i < DATA; i++)
+    data[i] = (char)(i % 251);
+  iov[0].iov_base = data;
+  iov[0].iov_len = 100;
+  iov[1].iov_base = data + 100;
+  iov[1].iov_len = 1700;
+  iov[2].iov_base = data + 1800;
+  iov[2].iov_len = DATA - 1800;
+}
+
+static int32_t check_udp() {
+  Server server(Endpoint::UDP);
+  Client client, peer(Endpoint::UDP);
+  struct iovec iov[3];
+  char service[8], data[DATA], in[DATA];
+  int32_t bytes, total = 0;
+
+  fill_vector(iov, data);
+  if (start(&server, service, sizeof(service)) ||
+      peer.attach("127.0.0.1", service) || peer.set_packet_size(PACKET) ||
+      peer.send_data(iov, 3) != DATA)
+    return 1;
+  // Every datagram must fit in the packet size.
+  while (total < DATA) {
+    if (server.get_client(&client))
+      return 1;
+    bytes = server.receive_data(in + total, sizeof(in) - total, &client);
+    client.detach();
+    if (bytes <= 0 || bytes > PACKET)
+      return 1;
+    total += bytes;
+  }
+  server.stop();
+  return memcmp(in, data, DATA) != 0;
+}
+
+struct rudp_server {
+  Server *server;
+  struct iovec *out;
+  int32_t bytes;
+};
+
+// The peer waits for the acknowledgements, so the server receives on a thread.
+static void *receive_rudp(void *arg) {
+  struct rudp_server *rs = (struct rudp_server *)arg;
+  Client client;
+
+  rs->bytes = -1;
+  if (!rs->server->get_client(&client))
+    rs->bytes = rs->server->receive_data(rs->out, 3, &client);
+  client.detach();
+  return NULL;
+}
+
+static int32_t check_rudp() {
+  Server server(Endpoint::RUDP);
+  Client peer(Endpoint::RUDP);
+  struct iovec iov[3], out[3];
+  struct rudp_server rs;
+  char service[8], data[DATA], in[DATA];
+  pthread_t thread;
+  int32_t bytes;
+
+  fill_vector(iov, data);
+  memset(in, 0, sizeof(in));
+  out[0].iov_base = in;
+  out[0].iov_len = 7;
+  out[1].iov_base = in + 7;
+  out[1].iov_len = 993;
+  out[2].iov_base = in + 1000;
+  out[2].iov_len = DATA - 1000;
+  if (start(&server, service, sizeof(service)) || peer.attach("127.0.0.1", service))
+    return 1;
+  rs.server = &server;
+  rs.out = out;
+  if (pthread_create(&thread, NULL, receive_rudp, &rs))
+    return 1;
+  bytes = peer.send_data(iov, 3);
+  pthread_join(thread, NULL);
+  server.stop();
+  return bytes != DATA || rs.bytes != DATA || memcmp(in, data, DATA) != 0;
+}
+
+// Point a vector at the part of three buffers that follows off.
+static int32_t advance(const struct iovec *iov, struct iovec *out, size_t off) {
+  int32_t i, len = 0;
+
+  for (i = 0; i < 3; i++) {
+    if (off >= iov[i].iov_len) {
+      off -= iov[i].iov_len;
+      continue;
+    }
+    out[len].iov_base = (char *)iov[i].iov_base + off;
+    out[len].iov_len = iov[i].iov_len - off;
+    off = 0;
+    len++;
+  }
+  return len;
+}
+
+static int32_t check_tcp() {
+  Server server;
+  Client client, peer;
+  struct sockaddr_in addr;
+  socklen_t addr_len = sizeof(addr);
+  struct iovec iov[3], in_iov[3], vec[3];
+  size_t sent = 0, received = 0;
+  char service[8], *data, *in;
+  int32_t bytes, partial = 0;
+  bool accepted = false;
+
+  data = (char *)malloc(TCP_DATA);
+  in = (char *)malloc(TCP_DATA);
+  for (int32_t i = 0; i < TCP_DATA; i++)
+    data[i] = (char)(i % 239);
+  iov[0].iov_base = data;
+  iov[0].iov_len = 3;
+  iov[1].iov_base = data + 3;
+  iov[1].iov_len = TCP_DATA / 2;
+  iov[2].iov_base = data + 3 + TCP_DATA / 2;
+  iov[2].iov_len = TCP_DATA - 3 - TCP_DATA / 2;
+  in_iov[0].iov_base = in;
+  in_iov[0].iov_len = 1000;
+  in_iov[1].iov_base = in + 1000;
+  in_iov[1].iov_len = 7;
+  in_iov[2].iov_base = in + 1007;
+  in_iov[2].iov_len = TCP_DATA - 1007;
+  if (!data || !in || server.start("127.0.0.1", "0", 64) ||
+      getsockname(server.sockets()[0], (struct sockaddr *)&addr, &addr_len) < 0)
+    return 1;
+  snprintf(service, sizeof(service), "%d", ntohs(addr.sin_port));
+  if (peer.attach("127.0.0.1", service) || peer.set_nonblocking(true))
+    return 1;
+
+  // The socket buffer takes only a part; the rest is sent where it stopped.
+  while (sent < TCP_DATA || received < TCP_DATA) {
+    if (sent < TCP_DATA) {
+      bytes = peer.send_data(vec, advance(iov, vec, sent));
+      if (bytes > 0 && sent + bytes < TCP_DATA)
+	partial++;
+      if (bytes > 0)
+	sent += bytes;
+      else if (errno != EAGAIN && errno != EWOULDBLOCK)
+	return 1;
+    }
+    if (!accepted) {
+      if (server.get_client(&client) || client.set_nonblocking(true))
+	return 1;
+      accepted = true;
+    }
+    bytes = server.receive_data(vec, advance(in_iov, vec, received), &client);
+    if (bytes > 0)
+      received += bytes;
+    else if (bytes == 0 || (errno != EAGAIN && errno != EWOULDBLOCK))
+      return 1;
+  }
+  peer.detach();
+  client.detach();
+  server.stop();
+  bytes = !partial || memcmp(in, data, TCP_DATA) != 0;
+  free(data);
+  free(in);
+  return bytes;
+}
+
+int main() {
+  if (check_tcp()) {
+    fprintf(stderr, "(vector) Error: TCP vector was not resumed.\n");
+    return 1;
+  }
+  if (check_udp()) {
+    fprintf(stderr, "(vector) Error: UDP vector was not packetized.\n");
+    return 1;
+  }
+  if (check_rudp()) {
+    fprintf(stderr, "(vector) Error: RUDP vector was not received.\n");
+    return 1;
+  }
+  printf("(vector) OK\n");
+  return 0;
+}
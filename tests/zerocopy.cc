@@ -0,0 +1,98 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+//
+// Checks that the tickets of a buffer sent with MSG_ZEROCOPY and of a smaller,
+// copied buffer are both reported done over loopback, and that the data arrive
+// whole and in order.
+//
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include "../src/libiris.h"
+
+using namespace iris;
+
+#define LARGE_SIZE               (4 * ZEROCOPY_THRESHOLD)
+#define SMALL_SIZE               (ZEROCOPY_THRESHOLD / 4)
+
+int main() {
+  struct sockaddr_in addr;
+  socklen_t addr_len = sizeof(addr);
+  char service[8], *large, *small, *in;
+  uint32_t large_ticket, small_ticket;
+  Server server;
+  Client client, peer;
+  int32_t bytes, total = 0;
+
+  alarm(5);
+  large = (char *)malloc(LARGE_SIZE);
+  small = (char *)malloc(SMALL_SIZE);
+  in = (char *)malloc(LARGE_SIZE + SMALL_SIZE);
+  // Let the kernel pick a free port.
+  if (!large || !small || !in || server.start("127.0.0.1", "0", 64) ||
+      getsockname(server.sockets()[0], (struct sockaddr *)&addr, &addr_len) < 0) {
+    fprintf(stderr, "(zerocopy) Error: Can not start the server.\n");
+    return 1;
+  }
+  snprintf(service, sizeof(service), "%d", ntohs(addr.sin_port));
+  if (peer.attach("127.0.0.1", service) || peer.set_zerocopy(true)) {
+    fprintf(stderr, "(zerocopy) Error: Can not connect in zero-copy mode.\n");
+    return 1;
+  }
+  memset(large, 'l', LARGE_SIZE);
+  memset(small, 's', SMALL_SIZE);
+  if (peer.send_zerocopy(large, LARGE_SIZE, &large_ticket) != LARGE_SIZE ||
+      peer.send_zerocopy(small, SMALL_SIZE, &small_ticket) != SMALL_SIZE) {
+    fprintf(stderr, "(zerocopy) Error: Can not send.\n");
+    return 1;
+  }
+
+  if (!large_ticket) {
+    fprintf(stderr, "(zerocopy) Error: The large buffer was not sent with MSG_ZEROCOPY.\n");
+    return 1;
+  }
+
+  // The small buffer was copied, so it can be reused at once.
+  if (!peer.zerocopy_done(small_ticket)) {
+    fprintf(stderr, "(zerocopy) Error: The copied buffer is not done.\n");
+    return 1;
+  }
+
+  if (server.get_client(&client)) {
+    fprintf(stderr, "(zerocopy) Error: Can not accept.\n");
+    return 1;
+  }
+  while (total < LARGE_SIZE + SMALL_SIZE) {
+    bytes = server.receive_data(in + total, LARGE_SIZE + SMALL_SIZE - total, &client);
+    if (bytes <= 0) {
+      fprintf(stderr, "(zerocopy) Error: Can not receive.\n");
+      return 1;
+    }
+    total += bytes;
+  }
+  if (memcmp(in, large, LARGE_SIZE) || memcmp(in + LARGE_SIZE, small, SMALL_SIZE)) {
+    fprintf(stderr, "(zerocopy) Error: The data are not whole.\n");
+    return 1;
+  }
+
+  // The kernel releases the large buffer once the data have left the socket.
+  while (!peer.zerocopy_done(large_ticket))
+    usleep(1000);
+  if (!peer.zerocopy_done(small_ticket)) {
+    fprintf(stderr, "(zerocopy) Error: The copied buffer is not done.\n");
+    return 1;
+  }
+  peer.detach();
+  client.detach();
+  server.stop();
+  free(large);
+  free(small);
+  free(in);
+  printf("(zerocopy) OK\n");
+  return 0;
+}